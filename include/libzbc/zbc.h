@@ -57,6 +57,23 @@
  */
 extern void zbc_set_log_level(char const *log_level);
 
+/**
+ * @brief Enable or disable asynchronous log output
+ * @param[in] enable	Enable asynchronous output if true
+ *
+ * By default, log messages are written out synchronously by the thread
+ * emitting them, which can serialize threads issuing commands concurrently
+ * with verbose log levels. When asynchronous output is enabled, messages are
+ * queued in a per-thread lock-free ring buffer and written out by a
+ * background thread. Messages emitted faster than they can be written out
+ * are dropped and the number of dropped messages reported.
+ * Disabling asynchronous output waits for all queued messages to be
+ * written out before returning.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_set_log_async(bool enable);
+
 /**
  * @brief Zone type definitions
  *
@@ -668,6 +685,15 @@ extern int zbc_device_is_zoned(const char *filename, bool fake,
  */
 enum zbc_oflags {
 
+	/**
+	 * Set up the device for asynchronous execution of read and write
+	 * requests using \a zbc_aio_submit and \a zbc_aio_wait. This flag
+	 * is supported only by the block device backend driver, which
+	 * implements asynchronous requests using io_uring. Opening the
+	 * device fails if the kernel does not support io_uring.
+	 */
+	ZBC_O_ASYNC		= 0x00800000,
+
 	/** Allow use of the block device backend driver */
 	ZBC_O_DRV_BLOCK		= 0x01000000,
 
@@ -882,6 +908,156 @@ extern int zbc_list_zones(struct zbc_device *dev,
 			  uint64_t sector, enum zbc_reporting_options ro,
 			  struct zbc_zone **zones, unsigned int *nr_zones);
 
+/**
+ * @brief Zone iteration callback function
+ * @param[in] zone	Zone information of the current zone
+ * @param[in] idx	Index of the zone in the iteration, starting at 0
+ * @param[in] ctx	Caller private data passed to \a zbc_report_zones_iter
+ *
+ * Called by \a zbc_report_zones_iter for every zone reported. The zone
+ * information pointed to by \a zone is only valid for the duration of
+ * the call: it must be copied if it is needed afterward.
+ *
+ * @return 0 to continue the iteration. Any other value stops the
+ * iteration and is returned to the caller of \a zbc_report_zones_iter.
+ */
+typedef int (*zbc_zone_cb)(struct zbc_zone *zone, unsigned int idx, void *ctx);
+
+/**
+ * @brief Iterate over the zone information of a device
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] sector	Sector from which to report zones
+ * @param[in] ro	Reporting options
+ * @param[in] cb	Callback function executed for every zone reported
+ * @param[in] ctx	Caller private data passed to \a cb
+ *
+ * Execute \a cb for every zone of \a dev matching the reporting options
+ * \a ro, starting from the zone containing \a sector. Unlike
+ * \a zbc_list_zones, the zone information is obtained from the device
+ * in fixed size batches and processed as it arrives, so the memory used
+ * is constant regardless of the number of zones of the device.
+ *
+ * @return 0 if all zones were processed, a negative error code if
+ * reporting zones failed, or the first non-zero value returned by \a cb.
+ */
+extern int zbc_report_zones_iter(struct zbc_device *dev, uint64_t sector,
+				 enum zbc_reporting_options ro,
+				 zbc_zone_cb cb, void *ctx);
+
+/**
+ * @brief Enable or disable the device zone cache
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] enable	If true, enable zone caching
+ *
+ * Enable or disable caching of the device zone information inside the
+ * library. When enabled, the entire zone configuration of \a dev is
+ * read once from the device and kept up to date locally using the
+ * results of the write and zone operations executed through \a dev.
+ * Cached zone information can then be obtained with
+ * \a zbc_report_zones_cached without any device access. The cache is
+ * automatically refreshed from the device when a write or zone
+ * operation result cannot be applied locally (e.g. a failed command).
+ * Zone caching is disabled by default. Disabling zone caching frees
+ * the cached zone information.
+ *
+ * The cache coherency is only guaranteed for device state changes
+ * performed through \a dev: changes made by other processes or through
+ * other handles of the same device are not seen until the cache is
+ * refreshed with \a zbc_refresh_zone_cache.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_set_zone_cache(struct zbc_device *dev, bool enable);
+
+/**
+ * @brief Refresh the device zone cache
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ *
+ * Discard the cached zone information of \a dev and repopulate the
+ * cache from the device. Zone caching must have been enabled with
+ * \a zbc_set_zone_cache.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ * Returns -ENXIO if zone caching is not enabled.
+ */
+extern int zbc_refresh_zone_cache(struct zbc_device *dev);
+
+/**
+ * @brief Attach or detach the shared zone cache of the device
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] enable	If true, attach the shared zone cache
+ *
+ * Attach the zone cache of \a dev to a named shared memory segment so
+ * that all the processes of the host operating on the same device
+ * share a single copy of the device zone information: a single
+ * report zones refresh then serves every attached process. The segment
+ * is keyed by the device node identity and is created by the first
+ * process attaching it. Zone entries are protected by sequence locks
+ * and are updated in place by whichever process executes a
+ * state-changing operation; a process that cannot apply an operation
+ * result locally marks the shared copy stale, forcing the next refresh
+ * to read from the device and republish. Attaching the shared cache
+ * enables zone caching (see \a zbc_set_zone_cache) if it is not
+ * already enabled. Detaching leaves the segment in place for the other
+ * attached processes.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_set_shared_zone_cache(struct zbc_device *dev, bool enable);
+
+/**
+ * @brief Get zone information from the device zone cache
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] sector	Sector from which to report zones
+ * @param[in] ro	Reporting options
+ * @param[in] zones	Pointer to the array of zone information to fill
+ * @param[in] nr_zones	Number of zones in the array \a zones
+ *
+ * Similar to \a zbc_report_zones, but serves the zone information from
+ * the zone cache enabled with \a zbc_set_zone_cache, avoiding a device
+ * round-trip when the cache is valid. If zone caching is not enabled,
+ * this is equivalent to \a zbc_report_zones.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_report_zones_cached(struct zbc_device *dev, uint64_t sector,
+				   enum zbc_reporting_options ro,
+				   struct zbc_zone *zones,
+				   unsigned int *nr_zones);
+
+/**
+ * @brief Zone condition mask for \a zbc_find_zone
+ *
+ * Convert a zone condition (enum zbc_zone_condition) to a condition
+ * mask bit. Condition mask bits can be combined with bitwise OR to
+ * search zones in any of several conditions.
+ */
+#define zbc_zone_cond_mask(cond)	(1U << (cond))
+
+/**
+ * @brief Find the first cached zone in one of a set of conditions
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] cond_mask	Bitwise OR of \a zbc_zone_cond_mask condition bits
+ * @param[in] from_sector 512B sector from which to search
+ * @param[out] zone	Zone information of the zone found
+ *
+ * Search the zone cache enabled with \a zbc_set_zone_cache for the
+ * first zone at or after \a from_sector whose condition matches one of
+ * the conditions set in \a cond_mask, and return its information in
+ * \a zone. The search uses per-condition zone bitmaps maintained
+ * together with the zone cache, so it does not scan the zone array:
+ * repeated queries such as "next empty zone after sector X" are cheap
+ * even on devices with a very large number of zones. To continue a
+ * search from a zone found previously, pass the sector following the
+ * end of that zone as \a from_sector.
+ *
+ * @return 0 if a zone was found, -ENOENT if no zone at or after
+ * \a from_sector matches \a cond_mask, and -ENXIO if zone caching
+ * is not enabled.
+ */
+extern int zbc_find_zone(struct zbc_device *dev, unsigned int cond_mask,
+			 uint64_t from_sector, struct zbc_zone *zone);
+
 /**
  * @brief Zone operation codes definitions
  *
@@ -949,6 +1125,30 @@ enum zbc_zone_op_flags {
 extern int zbc_zone_operation(struct zbc_device *dev, uint64_t sector,
 			      enum zbc_zone_op op, unsigned int flags);
 
+/**
+ * @brief Execute an operation on a range of zones
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] sector	First sector of the first zone of the range
+ * @param[in] nr_zones	Number of zones in the range
+ * @param[in] op	The operation to perform
+ * @param[in] flags	Zone operation flags (ZBC_OP_ALL_ZONES is ignored)
+ *
+ * Execute the operation \a op on the \a nr_zones zones starting at the
+ * zone containing \a sector. This is functionally equivalent to
+ * calling \a zbc_zone_operation on every zone of the range, but much
+ * faster: depending on the backend driver, the range is processed with
+ * a single multi-zone kernel request, or the per-zone commands are
+ * pipelined instead of executed one at a time. Zones of the range on
+ * which the operation would have no effect (e.g. resetting an already
+ * empty zone) are skipped.
+ *
+ * @return Returns 0 on success. If the operation failed on any zone of
+ * the range, the first error encountered is returned.
+ */
+extern int zbc_zone_operation_range(struct zbc_device *dev, uint64_t sector,
+				    unsigned int nr_zones,
+				    enum zbc_zone_op op, unsigned int flags);
+
 /**
  * @brief Explicitly open a zone
  * @param[in] dev	Device handle obtained with \a zbc_open
@@ -1070,6 +1270,66 @@ static inline int zbc_reset_zone(struct zbc_device *dev,
 extern ssize_t zbc_pread(struct zbc_device *dev, void *buf,
 			 size_t count, uint64_t offset);
 
+/**
+ * @brief Enable or disable sequential read prefetching
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] enable	If true, enable read prefetching
+ *
+ * When enabled, sequential read streams executed with \a zbc_pread
+ * (several consecutive reads of the same size, each starting where the
+ * previous one ended, as done when scanning a zone front-to-back) are
+ * detected and the next reads of the stream are issued ahead of the
+ * caller into a small ring of internal buffers, overlapping command
+ * execution with data consumption. This primarily benefits backends
+ * executing reads as synchronous commands (SG nodes and ATA devices),
+ * which get no kernel readahead. Reads that do not continue a
+ * sequential stream are unaffected, and a prefetched read that fails
+ * (e.g. the stream runs into unwritten sectors of a zone) is discarded
+ * and retried synchronously, so error reporting is unchanged.
+ *
+ * Prefetching uses the device asynchronous command interface and can
+ * therefore not be combined with application use of \a zbc_aio_submit
+ * and \a zbc_aio_wait on the same device handle. Read prefetching is
+ * disabled by default. Disabling it discards and frees the prefetch
+ * buffers.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ * Returns -ENXIO if the backend driver of \a dev does not support
+ * asynchronous command execution.
+ */
+extern int zbc_set_read_prefetch(struct zbc_device *dev, bool enable);
+
+/**
+ * @brief Enable or disable write coalescing
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] bufsz	Staging buffer size in bytes, 0 to disable
+ * @param[in] hold_ms	Maximum time data may stay staged in
+ *			milliseconds, 0 for no time limit
+ *
+ * Coalesce small sequential writes issued with \a zbc_pwrite into
+ * larger device commands: writes continuing a sequential stream are
+ * staged in a per-zone buffer of \a bufsz bytes (rounded up to a
+ * physical block multiple and capped at the maximum command size) and
+ * written out as a single command when the buffer fills, when a write
+ * does not continue the stream, when the staged data is older than
+ * \a hold_ms, or on \a zbc_flush. Reads, zone operations,
+ * \a zbc_pwritev and \a zbc_pwrite_append write out staged data
+ * first, so they always
+ * see the device as if the writes had not been buffered; the tracked
+ * write pointers of the zone cache reflect only written out data. As
+ * a write may be reported complete while still staged, its error can
+ * surface on the later call that writes it out: call \a zbc_flush
+ * before relying on the data being on the device. The age limit is
+ * checked when the library is entered, as no background thread is
+ * used. Write coalescing is not coordinated with requests issued
+ * directly with \a zbc_aio_submit and cannot be combined with them.
+ * Disabling write coalescing writes out any staged data.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_set_write_coalescing(struct zbc_device *dev, size_t bufsz,
+				    unsigned int hold_ms);
+
 /**
  * @brief Write sectors to a device
  * @param[in] dev	Device handle obtained with \a zbc_open
@@ -1130,6 +1390,32 @@ extern ssize_t zbc_pwritev(struct zbc_device *dev,
 			   const struct iovec *iov, int iovcnt,
 			   uint64_t offset);
 
+/**
+ * @brief Write sectors at the write pointer of a zone
+ * @param[in] dev		Device handle obtained with \a zbc_open
+ * @param[in] buf		Caller supplied buffer to write from
+ * @param[in] count		Number of 512B sectors to write
+ * @param[in] zone_sector	Start sector of the target zone
+ *
+ * Write \a count 512B sectors to the sequential zone starting at
+ * \a zone_sector, at the current write pointer position of the zone as
+ * tracked by the library, removing the need for the caller to track
+ * write pointers or to issue a report zones before writing. The zone
+ * cache must be enabled with \a zbc_set_zone_cache: the tracked write
+ * pointer is fed from the cached zone information and advances with
+ * every successful write to the device.
+ * \a count and the write pointer position must satisfy the same
+ * alignment constraints as described in \a zbc_pwrite.
+ *
+ * @return On success, the sector at which the data was written is
+ * returned (that is, the write pointer position before the write).
+ * -ENOSPC is returned if the zone is full or if \a count sectors do
+ * not fit in the remaining space of the zone. Any error returned by
+ * \a zbc_pwrite can also be returned.
+ */
+extern ssize_t zbc_pwrite_append(struct zbc_device *dev, const void *buf,
+				 size_t count, uint64_t zone_sector);
+
 /**
  * @brief Map a buffer to an I/O vector
  * @param[in] buf	Data buffer to map
@@ -1149,6 +1435,63 @@ extern ssize_t zbc_pwritev(struct zbc_device *dev,
 extern int zbc_map_iov(const void *buf, size_t sectors,
 		       struct iovec *iov, int iovcnt, size_t iovlen);
 
+/**
+ * @brief Map a buffer to an I/O vector with automatic segment sizing
+ * @param[in] buf	Data buffer to map
+ * @param[in] sectors	Size of \a buf in 512B sectors unit
+ * @param[in] iov	Array of I/O vectors to which \a buf will be mapped
+ * @param[in] iovcnt	The maximum number of entries in the \a iov array
+ *
+ * Map the buffer \a buf to a set of I/O vectors, choosing the segment
+ * sizes automatically: the entire buffer is always mapped, regardless
+ * of the number of entries of the \a iov array, so a caller-owned
+ * array can be reused across requests without sizing it for the
+ * largest possible request. Segments are split on transparent huge
+ * page region boundaries: a buffer contained within a single huge
+ * page region is mapped to a single segment and, for THP backed
+ * buffers, every segment is physically contiguous, minimizing the
+ * number of SG list entries needed to execute the command. If the
+ * \a iov array cannot hold one segment per huge page region, the
+ * buffer is split evenly instead.
+ *
+ * @return the number of I/O vectors mapped or a negative error code
+ * in case of error
+ */
+extern int zbc_map_iov_auto(const void *buf, size_t sectors,
+			    struct iovec *iov, int iovcnt);
+
+/**
+ * @brief Allocate an I/O buffer suitable for device commands
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] size	Buffer size in bytes
+ *
+ * Allocate a buffer of at least \a size bytes suitable for I/O to
+ * \a dev: the buffer is page aligned (huge page aligned and THP backed
+ * for buffers of at least a huge page) and its pages are pre-touched,
+ * so that I/Os using it take the direct I/O path and do not page-fault.
+ * Buffers are recycled through a per-device pool shared with the
+ * library internal commands: once the pool is warm, allocation does no
+ * memory management work at all. As with command execution, pool
+ * accesses are not serialized by the library: concurrent callers must
+ * serialize externally or use one device handle per thread. Buffers
+ * must be freed with \a zbc_buf_free before the device is closed.
+ *
+ * @return The address of the allocated buffer or NULL if no memory
+ * is available.
+ */
+extern void *zbc_buf_alloc(struct zbc_device *dev, size_t size);
+
+/**
+ * @brief Free an I/O buffer obtained with \a zbc_buf_alloc
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] buf	Buffer obtained with \a zbc_buf_alloc
+ * @param[in] size	Buffer size in bytes, as passed to \a zbc_buf_alloc
+ *
+ * Return \a buf to the device buffer pool for recycling, or free it
+ * if the pool is full.
+ */
+extern void zbc_buf_free(struct zbc_device *dev, void *buf, size_t size);
+
 /**
  * @brief Flush a device write cache
  * @param[in] dev	Device handle obtained with \a zbc_open
@@ -1160,6 +1503,462 @@ extern int zbc_map_iov(const void *buf, size_t sectors,
  */
 extern int zbc_flush(struct zbc_device *dev);
 
+/**
+ * @brief Flush a device write cache for a range of sectors
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] sector	First 512B sector of the range to flush
+ * @param[in] count	Number of 512B sectors to flush
+ *
+ * Similar to \a zbc_flush, but flushes only the cached data of the
+ * \a count sectors starting at \a sector, e.g. the sectors of a zone
+ * that was just finished. Devices that cannot flush a sector range
+ * fall back to a full device cache flush.
+ *
+ * @return Returns 0 on success and a negative error code in case of
+ * error.
+ */
+extern int zbc_flush_range(struct zbc_device *dev, uint64_t sector,
+			   uint64_t count);
+
+/**
+ * @brief Command timeout classes
+ *
+ * Classes of commands that can be given a timeout with
+ * \a zbc_set_timeout.
+ */
+enum zbc_timeout_class {
+
+	/** Read commands */
+	ZBC_TIMEOUT_READ	= 0,
+
+	/** Write commands */
+	ZBC_TIMEOUT_WRITE,
+
+	/** Zone operation commands (reset, open, close and finish) */
+	ZBC_TIMEOUT_ZONE_OP,
+
+	/** All other commands (report zones, flush, control commands) */
+	ZBC_TIMEOUT_CTRL,
+
+};
+
+/**
+ * @brief Set the command timeout of a class of commands
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] timeout_class	Class of commands the timeout applies to
+ * @param[in] timeout_ms	Timeout in milliseconds, 0 to restore
+ *			the default timeout
+ *
+ * Set the completion timeout of the commands of the class
+ * \a timeout_class. The default timeout is 20 seconds. Changing a
+ * timeout is a host-side operation without any device command and takes
+ * effect for the next command issued, so an application hedging
+ * requests can change it on a per-call basis. A command exceeding its
+ * timeout is aborted and fails with -ETIMEDOUT, with \a zbc_errno
+ * reporting the sense key Aborted-command. Timeouts apply to devices
+ * accessed through SCSI or ATA passthrough commands; they are ignored
+ * by the block device and emulation backends, which rely on the kernel
+ * and file system command handling.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_set_timeout(struct zbc_device *dev,
+			   enum zbc_timeout_class timeout_class,
+			   unsigned int timeout_ms);
+
+/**
+ * @brief Asynchronous request operation codes
+ *
+ * Operations that can be executed asynchronously using \a zbc_aio_submit
+ * and \a zbc_aio_wait.
+ */
+enum zbc_aio_op {
+
+	/** Read data from the device */
+	ZBC_AIO_PREAD		= 0x01,
+
+	/** Write data to the device */
+	ZBC_AIO_PWRITE		= 0x02,
+
+	/** Execute a zone operation */
+	ZBC_AIO_ZONE_OP		= 0x03,
+
+};
+
+/**
+ * @brief Asynchronous request descriptor
+ *
+ * Describes a read, write or zone operation to execute asynchronously.
+ * The caller owns the descriptor and must keep it, as well as the data
+ * buffers it points to, unchanged until the request completion is
+ * reaped with \a zbc_aio_wait.
+ */
+struct zbc_aio {
+
+	/** Operation to execute */
+	enum zbc_aio_op		aio_op;
+
+	/** Target 512B sector of the operation */
+	uint64_t		aio_sector;
+
+	/** Data buffers of I/O requests, with buffer lengths specified
+	 *  in 512B sectors (ignored for zone operations) */
+	const struct iovec	*aio_iov;
+
+	/** Number of data buffers (ignored for zone operations) */
+	int			aio_iovcnt;
+
+	/** Zone operation code (ZBC_AIO_ZONE_OP requests only) */
+	enum zbc_zone_op	aio_zone_op;
+
+	/** Zone operation flags (ZBC_AIO_ZONE_OP requests only) */
+	unsigned int		aio_flags;
+
+	/** Caller private data (never touched by the library) */
+	void			*aio_user;
+
+	/** Operation result: on success, the number of 512B sectors
+	 *  transferred for I/O requests and 0 for zone operations.
+	 *  A negative error code indicates a failed request */
+	ssize_t			aio_result;
+
+	/** Library internal request state (do not touch) */
+	void			*aio_private;
+
+	/** Library internal byte-unit copy of aio_iov (do not touch) */
+	struct iovec		*aio_biov;
+
+};
+
+/**
+ * @brief Submit an asynchronous request
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] aio	Request descriptor
+ *
+ * Queue the read, write or zone operation described by \a aio without
+ * waiting for its execution, allowing a single thread to keep several
+ * commands in flight against \a dev. Completed requests must be reaped
+ * with \a zbc_aio_wait. The range of sectors accessed by an I/O request
+ * must satisfy the same alignment constraints as \a zbc_pread and
+ * \a zbc_pwrite and may not exceed the device maximum R/W size
+ * indicated by the zbd_max_rw_sectors field of the device information
+ * (asynchronous requests are not internally segmented). On devices
+ * where the maximum R/W size was raised using the device bsg node,
+ * asynchronous requests remain bound by the lower limit of the SG
+ * interface used to queue them and -EINVAL is returned for larger
+ * requests.
+ *
+ * Asynchronous execution is an optional backend feature. The SCSI and
+ * ATA backend drivers support it when operating on an SG character
+ * device node. The block device backend driver supports read and write
+ * requests through io_uring if the device was open with the
+ * ZBC_O_ASYNC flag, but not zone operations (-ENOTSUP is returned for
+ * those). -ENXIO is returned if the backend driver of \a dev does not
+ * support asynchronous requests or if the device was not open with
+ * ZBC_O_ASYNC.
+ *
+ * @return 0 if the request was queued and a negative error code otherwise.
+ */
+extern int zbc_aio_submit(struct zbc_device *dev, struct zbc_aio *aio);
+
+/**
+ * @brief Wait for the completion of an asynchronous request
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[out] paio	Completed request descriptor
+ *
+ * Wait for a request queued with \a zbc_aio_submit to complete and
+ * return its descriptor in \a paio. Completions are returned in device
+ * completion order, which may differ from the submission order. The
+ * result of the completed request, including any error, is indicated
+ * by the aio_result field of the returned descriptor.
+ *
+ * @return 0 if a completion was reaped and a negative error code if
+ * waiting for a completion failed.
+ */
+extern int zbc_aio_wait(struct zbc_device *dev, struct zbc_aio **paio);
+
+/**
+ * @brief Command classes accounted in device statistics
+ *
+ * Commands executed by a device are accounted per class, grouping
+ * together the different backend driver commands used to implement
+ * the same library operation.
+ */
+enum zbc_stats_op {
+
+	/** Read commands */
+	ZBC_STATS_READ = 0,
+
+	/** Write commands */
+	ZBC_STATS_WRITE,
+
+	/** Report zones commands */
+	ZBC_STATS_REPORT_ZONES,
+
+	/** Zone management commands (reset, open, close, finish) */
+	ZBC_STATS_ZONE_OP,
+
+	/** Cache flush commands */
+	ZBC_STATS_FLUSH,
+
+	/** Any other command */
+	ZBC_STATS_OTHER,
+
+	/** Number of command classes */
+	ZBC_STATS_NR_OPS,
+
+};
+
+/**
+ * @brief Number of command latency histogram buckets
+ *
+ * Bucket 0 counts commands that completed in less than one microsecond.
+ * Bucket \a b counts commands with a latency of at least 2^(b-1) and
+ * less than 2^b microseconds. The last bucket also counts all commands
+ * with a larger latency.
+ */
+#define ZBC_STATS_NR_LAT_BUCKETS	32
+
+/**
+ * @brief Statistics of one command class
+ */
+struct zbc_op_stats {
+
+	/** Number of commands executed */
+	unsigned long long	zbs_count;
+
+	/** Number of commands that failed */
+	unsigned long long	zbs_errors;
+
+	/** Sum of all command latencies (microseconds) */
+	unsigned long long	zbs_lat_sum;
+
+	/** Smallest command latency seen (microseconds, 0 if no command) */
+	unsigned long long	zbs_lat_min;
+
+	/** Largest command latency seen (microseconds) */
+	unsigned long long	zbs_lat_max;
+
+	/** Log-bucketed command latency histogram */
+	unsigned long long	zbs_lat_hist[ZBC_STATS_NR_LAT_BUCKETS];
+
+};
+
+/**
+ * @brief Device command statistics
+ */
+struct zbc_stats {
+
+	/** Per command class statistics */
+	struct zbc_op_stats	zbs_ops[ZBC_STATS_NR_OPS];
+
+};
+
+/**
+ * @brief Enable or disable device command statistics
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[in] enable	If true, enable statistics collection
+ *
+ * Statistics collection is disabled by default and commands execute
+ * without any accounting overhead. When enabled, every command executed
+ * by the device accumulates a latency histogram, a command count and an
+ * error count for its command class, at the cost of a clock reading
+ * pair and a few atomic increments per command. Enabling statistics
+ * clears any previously accumulated counters.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_set_stats(struct zbc_device *dev, bool enable);
+
+/**
+ * @brief Get device command statistics
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ * @param[out] stats	Address where to copy the device statistics
+ *
+ * Copy the statistics accumulated since statistics collection was
+ * enabled with \a zbc_set_stats, or since the last call to
+ * \a zbc_reset_stats. If statistics collection is not enabled,
+ * all counters are reported as 0.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_get_stats(struct zbc_device *dev, struct zbc_stats *stats);
+
+/**
+ * @brief Reset device command statistics
+ * @param[in] dev	Device handle obtained with \a zbc_open
+ *
+ * Clear all statistics counters accumulated so far.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_reset_stats(struct zbc_device *dev);
+
+/**
+ * @brief Device pool handle (opaque)
+ *
+ * A device pool aggregates several zoned devices, e.g. the drives of a
+ * JBOD shelf, behind a single sector namespace. Member devices are
+ * mapped back to back: the zones of the first device come first,
+ * followed by the zones of the second device, and so on. Reads, writes
+ * and zone operations are routed to the member device owning the
+ * target sector, and zone allocation spreads write streams over the
+ * members based on their number of in-flight operations.
+ */
+struct zbc_pool;
+
+/**
+ * @brief Open a pool of devices
+ * @param[in] paths	Array of device paths, one per member device
+ * @param[in] nr_devs	Number of member devices
+ * @param[in] flags	Open flags, as accepted by \a zbc_open
+ * @param[out] ppool	Opened pool handle
+ *
+ * Open the \a nr_devs devices of the array \a paths with \a zbc_open
+ * and aggregate them in a pool. Zone caching (\a zbc_set_zone_cache)
+ * is enabled on every member device. All member devices must use the
+ * same logical block size. If opening any member fails, already opened
+ * members are closed and the error is returned.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_pool_open(char * const *paths, unsigned int nr_devs,
+			 int flags, struct zbc_pool **ppool);
+
+/**
+ * @brief Close a pool of devices
+ * @param[in] pool	Pool handle obtained with \a zbc_pool_open
+ *
+ * Close all member devices and free the resources of \a pool.
+ *
+ * @return 0 on success. If closing a member device fails, the error
+ * code of the failure is returned, but all members are still closed.
+ */
+extern int zbc_pool_close(struct zbc_pool *pool);
+
+/**
+ * @brief Get the number of member devices of a pool
+ * @param[in] pool	Pool handle obtained with \a zbc_pool_open
+ *
+ * @return The number of member devices of \a pool.
+ */
+extern unsigned int zbc_pool_nr_devices(struct zbc_pool *pool);
+
+/**
+ * @brief Get the total capacity of a pool
+ * @param[in] pool	Pool handle obtained with \a zbc_pool_open
+ *
+ * @return The total capacity of \a pool in 512B sectors, that is, the
+ * sum of the capacities of its member devices.
+ */
+extern uint64_t zbc_pool_capacity(struct zbc_pool *pool);
+
+/**
+ * @brief Get the member device containing a pool sector
+ * @param[in] pool	Pool handle obtained with \a zbc_pool_open
+ * @param[in] sector	Pool sector
+ * @param[out] dev_sector Corresponding sector on the member device
+ *
+ * Get the device handle of the pool member containing \a sector,
+ * for operations that the pool interface does not provide directly.
+ * If \a dev_sector is not NULL, the sector of the member device
+ * corresponding to the pool sector \a sector is returned at the
+ * address it points to.
+ *
+ * @return The member device handle, or NULL if \a sector is beyond
+ * the pool capacity.
+ */
+extern struct zbc_device *zbc_pool_get_device(struct zbc_pool *pool,
+					      uint64_t sector,
+					      uint64_t *dev_sector);
+
+/**
+ * @brief Get zone information of a pool
+ * @param[in] pool	Pool handle obtained with \a zbc_pool_open
+ * @param[in] sector	Pool sector from which to report zones
+ * @param[in] ro	Reporting options
+ * @param[in] zones	Pointer to the array of zone information to fill
+ * @param[in,out] nr_zones Number of zones in the array \a zones
+ *
+ * Similar to \a zbc_report_zones, but reports the zones of all member
+ * devices of \a pool as a single zone list, with zone start sectors
+ * and write pointers expressed in the pool sector namespace. The zone
+ * information is served from the zone caches of the member devices.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_pool_report_zones(struct zbc_pool *pool, uint64_t sector,
+				 enum zbc_reporting_options ro,
+				 struct zbc_zone *zones,
+				 unsigned int *nr_zones);
+
+/**
+ * @brief Allocate an empty zone of a pool for writing
+ * @param[in] pool	Pool handle obtained with \a zbc_pool_open
+ * @param[out] zone	Information of the zone allocated
+ *
+ * Pick an empty zone for a new write stream, on the member device with
+ * the least in-flight operations, breaking ties round-robin over the
+ * members. The zone information returned is expressed in the pool
+ * sector namespace. The zone is not opened: it transitions to the open
+ * condition with the first write, or explicitly with
+ * \a zbc_pool_zone_operation.
+ *
+ * @return 0 on success, -ENOSPC if no member device has an empty zone
+ * left, and another negative error code in case of error.
+ */
+extern int zbc_pool_alloc_zone(struct zbc_pool *pool, struct zbc_zone *zone);
+
+/**
+ * @brief Read sectors from a pool
+ * @param[in] pool	Pool handle obtained with \a zbc_pool_open
+ * @param[in] buf	Caller supplied buffer to read into
+ * @param[in] count	Number of 512B sectors to read
+ * @param[in] offset	Pool sector from which to read
+ *
+ * Similar to \a zbc_pread, but operates on the pool sector namespace.
+ * The read is executed by the member device containing \a offset and
+ * must not span member devices.
+ *
+ * @return The number of read sectors on success and a negative error
+ * code otherwise.
+ */
+extern ssize_t zbc_pool_pread(struct zbc_pool *pool, void *buf,
+			      size_t count, uint64_t offset);
+
+/**
+ * @brief Write sectors to a pool
+ * @param[in] pool	Pool handle obtained with \a zbc_pool_open
+ * @param[in] buf	Caller supplied buffer to write from
+ * @param[in] count	Number of 512B sectors to write
+ * @param[in] offset	Pool sector at which to write
+ *
+ * Similar to \a zbc_pwrite, but operates on the pool sector namespace.
+ * The write is executed by the member device containing \a offset and
+ * must not span member devices.
+ *
+ * @return The number of written sectors on success and a negative
+ * error code otherwise.
+ */
+extern ssize_t zbc_pool_pwrite(struct zbc_pool *pool, const void *buf,
+			       size_t count, uint64_t offset);
+
+/**
+ * @brief Execute an operation on a zone of a pool
+ * @param[in] pool	Pool handle obtained with \a zbc_pool_open
+ * @param[in] sector	First pool sector of the target zone
+ * @param[in] op	The operation to perform
+ * @param[in] flags	Zone operation flags
+ *
+ * Similar to \a zbc_zone_operation, but operates on the pool sector
+ * namespace. If ZBC_OP_ALL_ZONES is set in \a flags, the operation is
+ * executed on all possible zones of every member device.
+ *
+ * @return 0 on success and a negative error code otherwise.
+ */
+extern int zbc_pool_zone_operation(struct zbc_pool *pool, uint64_t sector,
+				   enum zbc_zone_op op, unsigned int flags);
+
 /**
  * @}
  */
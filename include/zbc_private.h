@@ -65,4 +65,66 @@ extern int zbc_set_zones(struct zbc_device *dev,
 extern int zbc_set_write_pointer(struct zbc_device *dev,
 				 uint64_t sector, uint64_t wp_sector);
 
+/**
+ * @brief Zone write pointer update entry for zbc_set_write_pointers()
+ */
+struct zbc_wp {
+
+	/** Starting 512B sector of the zone to configure */
+	uint64_t	zbw_sector;
+
+	/** New 512B sector value of the zone write pointer */
+	uint64_t	zbw_wp_sector;
+
+};
+
+/**
+ * zbc_set_write_pointers - Change the write pointers of several zones
+ * @dev:	(IN) ZBC device handle of the device to configure
+ * @wps:	(IN) Array of zone write pointer updates to apply
+ * @nr_wps:	(IN) Number of entries in @wps
+ *
+ * Description:
+ * This function only affects devices operating with the emulation (fake)
+ * backend driver. All the updates of @wps are applied under a single
+ * metadata lock acquisition, making this much faster than calling
+ * zbc_set_write_pointer() once per zone when restoring the state of a
+ * device with many zones. Each entry is handled as described for
+ * zbc_set_write_pointer().
+ */
+extern int zbc_set_write_pointers(struct zbc_device *dev,
+				  const struct zbc_wp *wps,
+				  unsigned int nr_wps);
+
+/**
+ * zbc_get_state - Get a snapshot of an emulated device zone state
+ * @dev:	(IN) ZBC device handle of the device to snapshot
+ * @buf:	(IN) Snapshot buffer, or NULL to query the snapshot size
+ * @bufsz:	(IN) Size in B of @buf
+ *
+ * Description:
+ * This function only affects devices operating with the emulation (fake)
+ * backend driver. The entire zone state of the device (zone conditions
+ * and write pointers) is copied to @buf in one pass. The snapshot does
+ * not include the zone data. Returns the snapshot size in B, or a
+ * negative error code. Calling with @buf set to NULL returns the buffer
+ * size needed to hold a snapshot.
+ */
+extern ssize_t zbc_get_state(struct zbc_device *dev, void *buf, size_t bufsz);
+
+/**
+ * zbc_set_state - Restore a snapshot of an emulated device zone state
+ * @dev:	(IN) ZBC device handle of the device to restore
+ * @buf:	(IN) Snapshot obtained with zbc_get_state()
+ * @bufsz:	(IN) Size in B of the snapshot
+ *
+ * Description:
+ * This function only affects devices operating with the emulation (fake)
+ * backend driver. The zone state saved in @buf replaces the current zone
+ * state of the device in a single metadata write. The snapshot must have
+ * been taken from a device with the same zone configuration.
+ */
+extern int zbc_set_state(struct zbc_device *dev, const void *buf,
+			 size_t bufsz);
+
 #endif /* _LIBZBC_PRIVATE_H_ */
@@ -19,6 +19,9 @@
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/sysmacros.h>
 
 /*
  * Log level.
@@ -278,6 +281,171 @@ static int zbc_realpath(const char *filename, char **path)
 	return ret;
 }
 
+/**
+ * Read a sysfs attribute of the device identified by \a st.
+ * The attribute value is returned with trailing whitespace stripped.
+ */
+static int zbc_sysfs_get_attr(struct stat *st, const char *attr,
+			      char *buf, size_t bufsz)
+{
+	char sys_path[128];
+	FILE *f;
+
+	snprintf(sys_path, sizeof(sys_path), "/sys/dev/%s/%u:%u/%s",
+		 S_ISBLK(st->st_mode) ? "block" : "char",
+		 (unsigned int)major(st->st_rdev),
+		 (unsigned int)minor(st->st_rdev),
+		 attr);
+
+	f = fopen(sys_path, "r");
+	if (!f)
+		return -ENOENT;
+
+	if (!fgets(buf, bufsz, f)) {
+		fclose(f);
+		return -EIO;
+	}
+	fclose(f);
+
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return 0;
+}
+
+/**
+ * Classify a device using sysfs to get the backend driver most likely
+ * to accept it, avoiding a full probe sequence of every driver.
+ * Returns one of the ZBC_O_DRV_xxx flags, or 0 if the device cannot
+ * be classified. The result is only a probe ordering hint: the other
+ * drivers are still tried if the preferred one rejects the device.
+ */
+static unsigned int zbc_classify_dev(const char *path)
+{
+	char buf[128];
+	struct stat st;
+
+	if (stat(path, &st) != 0)
+		return 0;
+
+	/* Regular files can only be emulated devices */
+	if (S_ISREG(st.st_mode))
+		return ZBC_O_DRV_FAKE;
+
+	if (S_ISBLK(st.st_mode)) {
+		if (zbc_sysfs_get_attr(&st, "queue/zoned",
+				       buf, sizeof(buf)) == 0) {
+			if (strcmp(buf, "none") != 0)
+				return ZBC_O_DRV_BLOCK;
+			/* Not zoned: only emulation applies */
+			return ZBC_O_DRV_FAKE;
+		}
+		return 0;
+	}
+
+	if (S_ISCHR(st.st_mode)) {
+		/* SG node: host-managed devices have SCSI type 0x14 */
+		if (zbc_sysfs_get_attr(&st, "device/type",
+				       buf, sizeof(buf)) == 0 &&
+		    strcmp(buf, "20") == 0)
+			return ZBC_O_DRV_SCSI;
+		return 0;
+	}
+
+	return 0;
+}
+
+/**
+ * Get the WWN based device identifier from sysfs.
+ */
+static int zbc_dev_wwid(const char *path, char *wwid, size_t bufsz)
+{
+	struct stat st;
+	char *p;
+	int ret;
+
+	if (stat(path, &st) != 0 ||
+	    (!S_ISBLK(st.st_mode) && !S_ISCHR(st.st_mode)))
+		return -ENXIO;
+
+	ret = zbc_sysfs_get_attr(&st, "device/wwid", wwid, bufsz);
+	if (ret != 0)
+		return ret;
+
+	/* Normalize: some identifier formats contain spaces */
+	for (p = wwid; *p; p++) {
+		if (*p == ' ' || *p == '\t')
+			*p = '_';
+	}
+
+	if (!wwid[0])
+		return -ENOENT;
+
+	return 0;
+}
+
+/**
+ * Driver probe result cache, enabled by setting the ZBC_PROBE_CACHE
+ * environment variable to the path of a cache file. Entries are keyed
+ * by the device WWN so that they stay valid across device renames.
+ * Lookups return the driver flag of the last matching entry, so
+ * updates simply append to the file.
+ */
+static unsigned int zbc_probe_cache_get(const char *path)
+{
+	char wwid[128], key[128], line[160];
+	const char *cache_path;
+	unsigned int val, flag = 0;
+	FILE *f;
+
+	cache_path = getenv("ZBC_PROBE_CACHE");
+	if (!cache_path)
+		return 0;
+
+	if (zbc_dev_wwid(path, wwid, sizeof(wwid)) != 0)
+		return 0;
+
+	f = fopen(cache_path, "r");
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%127s 0x%x", key, &val) == 2 &&
+		    strcmp(key, wwid) == 0)
+			flag = val & ZBC_O_DRV_MASK;
+	}
+	fclose(f);
+
+	return flag;
+}
+
+/**
+ * Record the result of a successful device probe.
+ */
+static void zbc_probe_cache_set(const char *path, unsigned int flag)
+{
+	char wwid[128];
+	const char *cache_path;
+	FILE *f;
+
+	cache_path = getenv("ZBC_PROBE_CACHE");
+	if (!cache_path)
+		return;
+
+	if (zbc_dev_wwid(path, wwid, sizeof(wwid)) != 0)
+		return;
+
+	if (zbc_probe_cache_get(path) == flag)
+		return;
+
+	f = fopen(cache_path, "a");
+	if (!f)
+		return;
+
+	flock(fileno(f), LOCK_EX);
+	fprintf(f, "%s 0x%08x\n", wwid, flag);
+	fclose(f);
+}
+
 /**
  * zbc_device_is_zoned - Test if a physical device is zoned.
  */
@@ -286,25 +454,34 @@ int zbc_device_is_zoned(const char *filename,
 			struct zbc_device_info *info)
 {
 	struct zbc_device *dev = NULL;
+	unsigned int hint;
 	char *path = NULL;
-	int ret, i;
+	int ret, i, pass;
 
 	ret = zbc_realpath(filename, &path);
 	if (ret)
 		return ret;
 
-	/* Test all backends until one accepts the drive. */
-	for (i = 0; zbc_drv[i]; i++) {
-		ret = zbc_drv[i]->zbd_open(filename, O_RDONLY, &dev);
-		if (ret == 0) {
-			/* This backend accepted the device */
-			dev->zbd_drv = zbc_drv[i];
-			break;
+	/* Test all backends until one accepts the drive,
+	 * starting with the one sysfs points at. */
+	hint = zbc_classify_dev(path);
+	for (pass = 0; pass < 2; pass++) {
+		for (i = 0; zbc_drv[i]; i++) {
+			if ((pass == 0) != (zbc_drv[i]->flag == hint))
+				continue;
+			ret = zbc_drv[i]->zbd_open(filename, O_RDONLY, &dev);
+			if (ret == 0) {
+				/* This backend accepted the device */
+				dev->zbd_drv = zbc_drv[i];
+				goto done;
+			}
+			if (ret != -ENXIO)
+				goto out;
 		}
-		if (ret != -ENXIO)
-			goto out;
 	}
 
+done:
+
 	if (dev && dev->zbd_drv) {
 		if (dev->zbd_drv == &zbc_fake_drv && !fake) {
 			ret = 0;
@@ -314,6 +491,7 @@ int zbc_device_is_zoned(const char *filename,
 				memcpy(info, &dev->zbd_info,
 				       sizeof(struct zbc_device_info));
 		}
+		zbc_sg_drain_buf_pool(dev);
 		dev->zbd_drv->zbd_close(dev);
 	} else {
 		if ((ret != -EPERM) && (ret != -EACCES))
@@ -332,9 +510,9 @@ out:
 int zbc_open(const char *filename, int flags, struct zbc_device **pdev)
 {
 	struct zbc_device *dev = NULL;
-	unsigned int allowed_drv;
+	unsigned int allowed_drv, hint;
 	char *path = NULL;
-	int ret, i;
+	int ret, i, pass;
 
 	ret = zbc_realpath(filename, &path);
 	if (ret)
@@ -347,24 +525,41 @@ int zbc_open(const char *filename, int flags, struct zbc_device **pdev)
 	allowed_drv &= ~ZBC_O_DRV_BLOCK;
 #endif
 
+	/*
+	 * Get the most likely driver from the probe cache or from sysfs
+	 * and try it first: in the common case this makes the device
+	 * open a single probe instead of a walk of all drivers.
+	 */
+	hint = zbc_probe_cache_get(path);
+	if (!hint)
+		hint = zbc_classify_dev(path);
+	hint &= allowed_drv;
+
 	/* Test all backends until one accepts the drive */
 	ret = -ENODEV;
-	for (i = 0; zbc_drv[i] != NULL; i++) {
-
-		if (!(zbc_drv[i]->flag & allowed_drv))
-			continue;
+	for (pass = 0; pass < 2; pass++) {
+
+		for (i = 0; zbc_drv[i] != NULL; i++) {
+
+			if (!(zbc_drv[i]->flag & allowed_drv))
+				continue;
+			if ((pass == 0) != (zbc_drv[i]->flag == hint))
+				continue;
+
+			ret = zbc_drv[i]->zbd_open(path, flags, &dev);
+			switch (ret) {
+			case 0:
+				/* This backend accepted the drive */
+				dev->zbd_drv = zbc_drv[i];
+				zbc_probe_cache_set(path, zbc_drv[i]->flag);
+				*pdev = dev;
+				goto out;
+			case -ENXIO:
+				continue;
+			default:
+				goto out;
+			}
 
-		ret = zbc_drv[i]->zbd_open(path, flags, &dev);
-		switch (ret) {
-		case 0:
-			/* This backend accepted the drive */
-			dev->zbd_drv = zbc_drv[i];
-			*pdev = dev;
-			goto out;
-		case -ENXIO:
-			continue;
-		default:
-			goto out;
 		}
 
 	}
@@ -379,6 +574,24 @@ out:
  */
 int zbc_close(struct zbc_device *dev)
 {
+	/* Write out staged data and release the coalescing state */
+	zbc_wbuf_free(dev);
+
+	/* Release the read prefetcher */
+	zbc_prefetch_free(dev);
+
+	/* Release the zone cache and its shared segment mapping */
+	zbc_shm_detach(dev);
+	free(dev->zbd_zones);
+	dev->zbd_zones = NULL;
+	dev->zbd_nr_zones = 0;
+	free(dev->zbd_zone_cond_bitmaps);
+	dev->zbd_zone_cond_bitmaps = NULL;
+	dev->zbd_zone_bitmap_words = 0;
+
+	/* Release pooled command buffers */
+	zbc_sg_drain_buf_pool(dev);
+
 	return dev->zbd_drv->zbd_close(dev);
 }
 
@@ -533,6 +746,77 @@ int zbc_report_zones(struct zbc_device *dev, uint64_t sector,
 	return 0;
 }
 
+/**
+ * Number of zones reported per batch by zbc_report_zones_iter().
+ * 4096 zones keep the batch buffer at 256 KB.
+ */
+#define ZBC_REPORT_ITER_NR_ZONES	4096
+
+/**
+ * zbc_report_zones_iter - Iterate over zone information
+ */
+int zbc_report_zones_iter(struct zbc_device *dev, uint64_t sector,
+			  enum zbc_reporting_options ro,
+			  zbc_zone_cb cb, void *ctx)
+{
+	struct zbc_zone *zones;
+	unsigned int i, n, idx = 0;
+	uint64_t last_sector;
+	int ret = 0;
+
+	if (!cb)
+		return -EINVAL;
+
+	if (!zbc_test_mode(dev) &&
+	    sector >= dev->zbd_info.zbd_sectors)
+		/* No zones to report beyond drive capacity */
+		return 0;
+
+	/* Allocate the batch buffer */
+	zones = (struct zbc_zone *) calloc(ZBC_REPORT_ITER_NR_ZONES,
+					   sizeof(struct zbc_zone));
+	if (!zones)
+		return -ENOMEM;
+
+	/* Report and process zones, one batch at a time */
+	while (1) {
+
+		n = ZBC_REPORT_ITER_NR_ZONES;
+		ret = (dev->zbd_drv->zbd_report_zones)(dev, sector,
+					zbc_ro_mask(ro) | ZBC_RO_PARTIAL,
+					zones, &n);
+		if (ret != 0) {
+			zbc_error("%s: Get zones from sector %llu failed %d (%s)\n",
+				  dev->zbd_filename,
+				  (unsigned long long) sector,
+				  ret, strerror(-ret));
+			break;
+		}
+
+		if (n == 0)
+			break;
+
+		for (i = 0; i < n; i++) {
+			ret = cb(&zones[i], idx, ctx);
+			if (ret != 0)
+				goto out;
+			idx++;
+		}
+
+		last_sector = zones[n - 1].zbz_start + zones[n - 1].zbz_length;
+		if (last_sector >= dev->zbd_info.zbd_sectors)
+			break;
+
+		sector = last_sector;
+
+	}
+
+out:
+	free(zones);
+
+	return ret;
+}
+
 /**
  * zbc_list_zones - Get zone information
  */
@@ -570,27 +854,779 @@ int zbc_list_zones(struct zbc_device *dev, uint64_t sector,
 		return ret;
 	}
 
-out:
-	*pzones = zones;
-	*pnr_zones = nr_zones;
+out:
+	*pzones = zones;
+	*pnr_zones = nr_zones;
+
+	return 0;
+}
+
+/**
+ * Test if a zone matches a reporting option filter.
+ */
+static bool zbc_zone_ro_match(struct zbc_zone *zone,
+			      enum zbc_reporting_options ro)
+{
+	switch (zbc_ro_mask(ro)) {
+	case ZBC_RO_ALL:
+		return true;
+	case ZBC_RO_EMPTY:
+		return zbc_zone_empty(zone);
+	case ZBC_RO_IMP_OPEN:
+		return zbc_zone_imp_open(zone);
+	case ZBC_RO_EXP_OPEN:
+		return zbc_zone_exp_open(zone);
+	case ZBC_RO_CLOSED:
+		return zbc_zone_closed(zone);
+	case ZBC_RO_FULL:
+		return zbc_zone_full(zone);
+	case ZBC_RO_RDONLY:
+		return zbc_zone_rdonly(zone);
+	case ZBC_RO_OFFLINE:
+		return zbc_zone_offline(zone);
+	case ZBC_RO_RWP_RECOMMENDED:
+		return zbc_zone_rwp_recommended(zone);
+	case ZBC_RO_NON_SEQ:
+		return zbc_zone_non_seq(zone);
+	case ZBC_RO_NOT_WP:
+		return zbc_zone_not_wp(zone);
+	default:
+		return false;
+	}
+}
+
+/**
+ * Find the cached zone containing a sector. The cached zone array is
+ * sorted by start sector, so a binary search can be used.
+ */
+static struct zbc_zone *zbc_cached_zone(struct zbc_device *dev,
+					uint64_t sector)
+{
+	int low = 0, high = (int)dev->zbd_nr_zones - 1, mid;
+	struct zbc_zone *zone;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		zone = &dev->zbd_zones[mid];
+		if (sector < zbc_zone_start(zone))
+			high = mid - 1;
+		else if (sector >= zbc_zone_start(zone) + zbc_zone_length(zone))
+			low = mid + 1;
+		else
+			return zone;
+	}
+
+	return NULL;
+}
+
+/**
+ * Find the index of the first cached zone ending after a sector.
+ * Returns the number of cached zones if there is no such zone.
+ */
+static unsigned int zbc_cached_zone_index(struct zbc_device *dev,
+					  uint64_t sector)
+{
+	unsigned int low = 0, high = dev->zbd_nr_zones, mid;
+	struct zbc_zone *zone;
+
+	while (low < high) {
+		mid = (low + high) / 2;
+		zone = &dev->zbd_zones[mid];
+		if (zbc_zone_start(zone) + zbc_zone_length(zone) <= sector)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+/**
+ * Number of bits of a zone condition bitmap word.
+ */
+#define ZBC_ZONE_BITS_PER_WORD	(sizeof(unsigned long) * 8)
+
+/**
+ * Get the zone bitmap of a zone condition.
+ */
+static inline unsigned long *zbc_zone_cond_bitmap(struct zbc_device *dev,
+						  unsigned int cond)
+{
+	return dev->zbd_zone_cond_bitmaps +
+		(size_t)(cond & (ZBC_ZONE_COND_NR - 1)) *
+		dev->zbd_zone_bitmap_words;
+}
+
+/**
+ * Change the condition of a cached zone, keeping the per-condition
+ * zone bitmaps in sync. The bitmaps are always allocated when the
+ * zone cache is valid.
+ */
+static void zbc_zone_set_cond(struct zbc_device *dev, struct zbc_zone *zone,
+			      unsigned int cond)
+{
+	unsigned int i = zone - dev->zbd_zones;
+	unsigned long bit = 1UL << (i % ZBC_ZONE_BITS_PER_WORD);
+
+	zbc_zone_cond_bitmap(dev, zone->zbz_condition)
+		[i / ZBC_ZONE_BITS_PER_WORD] &= ~bit;
+	zone->zbz_condition = cond;
+	zbc_zone_cond_bitmap(dev, cond)
+		[i / ZBC_ZONE_BITS_PER_WORD] |= bit;
+}
+
+/**
+ * Rebuild the per-condition zone bitmaps from the cached zone array.
+ */
+static int zbc_zone_cond_bitmaps_rebuild(struct zbc_device *dev)
+{
+	unsigned int words = (dev->zbd_nr_zones + ZBC_ZONE_BITS_PER_WORD - 1) /
+		ZBC_ZONE_BITS_PER_WORD;
+	unsigned long *bitmaps;
+	unsigned int i;
+
+	if (words != dev->zbd_zone_bitmap_words) {
+		bitmaps = (unsigned long *)
+			realloc(dev->zbd_zone_cond_bitmaps,
+				(size_t)ZBC_ZONE_COND_NR * words *
+				sizeof(unsigned long));
+		if (!bitmaps)
+			return -ENOMEM;
+		dev->zbd_zone_cond_bitmaps = bitmaps;
+		dev->zbd_zone_bitmap_words = words;
+	}
+
+	memset(dev->zbd_zone_cond_bitmaps, 0,
+	       (size_t)ZBC_ZONE_COND_NR * words * sizeof(unsigned long));
+
+	for (i = 0; i < dev->zbd_nr_zones; i++)
+		zbc_zone_cond_bitmap(dev, dev->zbd_zones[i].zbz_condition)
+			[i / ZBC_ZONE_BITS_PER_WORD] |=
+			1UL << (i % ZBC_ZONE_BITS_PER_WORD);
+
+	return 0;
+}
+
+/**
+ * Invalidate the zone cache: the next cached access will refresh the
+ * entire cache from the device.
+ */
+static void zbc_zone_cache_invalidate(struct zbc_device *dev)
+{
+	dev->zbd_zone_cache_valid = false;
+
+	/* The shared copy can no longer be trusted either */
+	zbc_shm_set_stale(dev);
+}
+
+/**
+ * zbc_refresh_zone_cache - Refresh the device zone cache
+ */
+int zbc_refresh_zone_cache(struct zbc_device *dev)
+{
+	unsigned int nr_zones = 0;
+	struct zbc_zone *zones;
+	int ret;
+
+	/* Do this only if zone caching is enabled */
+	if (!dev->zbd_zone_cache)
+		return -ENXIO;
+
+	/* Use the copy published by another process if there is one */
+	if (zbc_shm_pull(dev)) {
+		ret = zbc_zone_cond_bitmaps_rebuild(dev);
+		if (ret != 0)
+			return ret;
+		dev->zbd_zone_cache_valid = true;
+		zbc_debug("%s: Zone cache refreshed from the shared cache, "
+			  "%u zones\n",
+			  dev->zbd_filename, dev->zbd_nr_zones);
+		return 0;
+	}
+
+	/* Get total number of zones */
+	ret = zbc_report_nr_zones(dev, 0, ZBC_RO_ALL, &nr_zones);
+	if (ret != 0)
+		return ret;
+
+	if (nr_zones != dev->zbd_nr_zones) {
+		zones = (struct zbc_zone *)
+			realloc(dev->zbd_zones,
+				(size_t)nr_zones * sizeof(struct zbc_zone));
+		if (!zones)
+			return -ENOMEM;
+		dev->zbd_zones = zones;
+		dev->zbd_nr_zones = nr_zones;
+	}
+
+	/* Get zones information */
+	ret = zbc_report_zones(dev, 0, ZBC_RO_ALL, dev->zbd_zones, &nr_zones);
+	if (ret != 0) {
+		zbc_error("%s: zbc_report_zones failed %d\n",
+			  dev->zbd_filename, ret);
+		return ret;
+	}
+
+	dev->zbd_nr_zones = nr_zones;
+
+	/* Rebuild the condition bitmaps used by zbc_find_zone() */
+	ret = zbc_zone_cond_bitmaps_rebuild(dev);
+	if (ret != 0)
+		return ret;
+
+	dev->zbd_zone_cache_valid = true;
+
+	/* Make the refreshed copy available to the other processes */
+	zbc_shm_publish(dev);
+
+	zbc_debug("%s: Zone cache refreshed, %u zones\n",
+		  dev->zbd_filename, nr_zones);
+
+	return 0;
+}
+
+/**
+ * zbc_set_zone_cache - Enable or disable the device zone cache
+ */
+int zbc_set_zone_cache(struct zbc_device *dev, bool enable)
+{
+	int ret;
+
+	if (enable == dev->zbd_zone_cache)
+		return 0;
+
+	if (!enable) {
+		/* The shared cache cannot outlive the local cache */
+		zbc_shm_detach(dev);
+		free(dev->zbd_zones);
+		dev->zbd_zones = NULL;
+		dev->zbd_nr_zones = 0;
+		free(dev->zbd_zone_cond_bitmaps);
+		dev->zbd_zone_cond_bitmaps = NULL;
+		dev->zbd_zone_bitmap_words = 0;
+		dev->zbd_zone_cache = false;
+		dev->zbd_zone_cache_valid = false;
+		return 0;
+	}
+
+	/* Populate the cache */
+	dev->zbd_zone_cache = true;
+	ret = zbc_refresh_zone_cache(dev);
+	if (ret != 0) {
+		zbc_set_zone_cache(dev, false);
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_report_zones_cached - Get zone information from the zone cache
+ */
+int zbc_report_zones_cached(struct zbc_device *dev, uint64_t sector,
+			    enum zbc_reporting_options ro,
+			    struct zbc_zone *zones, unsigned int *nr_zones)
+{
+	struct zbc_zone *zone;
+	unsigned int i, nz = 0;
+	int ret;
+
+	/* If zone caching is not enabled, ask the device */
+	if (!dev->zbd_zone_cache)
+		return zbc_report_zones(dev, sector, ro, zones, nr_zones);
+
+	if (!dev->zbd_zone_cache_valid) {
+		ret = zbc_refresh_zone_cache(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	for (i = 0; i < dev->zbd_nr_zones; i++) {
+
+		zone = &dev->zbd_zones[i];
+		if (zbc_zone_start(zone) + zbc_zone_length(zone) <= sector)
+			continue;
+		if (!zbc_zone_ro_match(zone, ro))
+			continue;
+
+		if (zones) {
+			if (nz >= *nr_zones)
+				break;
+			memcpy(&zones[nz], zone, sizeof(struct zbc_zone));
+		}
+		nz++;
+
+	}
+
+	*nr_zones = nz;
+
+	return 0;
+}
+
+/**
+ * zbc_find_zone - Find the first cached zone in one of a set of conditions
+ */
+int zbc_find_zone(struct zbc_device *dev, unsigned int cond_mask,
+		  uint64_t from_sector, struct zbc_zone *zone)
+{
+	unsigned int i, w, cond;
+	unsigned long word, bit;
+	int ret;
+
+	if (!dev->zbd_zone_cache)
+		return -ENXIO;
+
+	if (!dev->zbd_zone_cache_valid) {
+		ret = zbc_refresh_zone_cache(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	i = zbc_cached_zone_index(dev, from_sector);
+	if (i >= dev->zbd_nr_zones)
+		return -ENOENT;
+
+	bit = i % ZBC_ZONE_BITS_PER_WORD;
+
+	for (w = i / ZBC_ZONE_BITS_PER_WORD;
+	     w < dev->zbd_zone_bitmap_words; w++) {
+
+		/* Combine the bitmap words of the wanted conditions */
+		word = 0;
+		for (cond = 0; cond < ZBC_ZONE_COND_NR; cond++) {
+			if (cond_mask & (1U << cond))
+				word |= zbc_zone_cond_bitmap(dev, cond)[w];
+		}
+
+		/* Ignore zones before the search start */
+		word &= ~0UL << bit;
+		bit = 0;
+
+		if (!word)
+			continue;
+
+		i = w * ZBC_ZONE_BITS_PER_WORD + __builtin_ctzl(word);
+		if (i >= dev->zbd_nr_zones)
+			break;
+
+		memcpy(zone, &dev->zbd_zones[i], sizeof(struct zbc_zone));
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+/**
+ * zbc_stats_account - Account for the completion of a command
+ */
+void zbc_stats_account(struct zbc_device *dev, enum zbc_stats_op op,
+		       unsigned long long start, int err)
+{
+	struct zbc_op_stats *stats;
+	unsigned long long lat, old;
+	unsigned int bucket;
+
+	if (!start || !dev->zbd_stats_enabled)
+		return;
+
+	if (op >= ZBC_STATS_NR_OPS)
+		op = ZBC_STATS_OTHER;
+	stats = &dev->zbd_stats.zbs_ops[op];
+
+	lat = zbc_stats_start(dev) - start;
+	bucket = lat ? 64 - __builtin_clzll(lat) : 0;
+	if (bucket >= ZBC_STATS_NR_LAT_BUCKETS)
+		bucket = ZBC_STATS_NR_LAT_BUCKETS - 1;
+
+	__atomic_fetch_add(&stats->zbs_count, 1, __ATOMIC_RELAXED);
+	if (err)
+		__atomic_fetch_add(&stats->zbs_errors, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->zbs_lat_sum, lat, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stats->zbs_lat_hist[bucket], 1, __ATOMIC_RELAXED);
+
+	old = __atomic_load_n(&stats->zbs_lat_min, __ATOMIC_RELAXED);
+	while ((!old || lat < old) &&
+	       !__atomic_compare_exchange_n(&stats->zbs_lat_min, &old, lat,
+					    false, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+
+	old = __atomic_load_n(&stats->zbs_lat_max, __ATOMIC_RELAXED);
+	while (lat > old &&
+	       !__atomic_compare_exchange_n(&stats->zbs_lat_max, &old, lat,
+					    false, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * zbc_set_stats - Enable or disable device command statistics
+ */
+int zbc_set_stats(struct zbc_device *dev, bool enable)
+{
+	if (enable == dev->zbd_stats_enabled)
+		return 0;
+
+	if (enable)
+		memset(&dev->zbd_stats, 0, sizeof(struct zbc_stats));
+
+	dev->zbd_stats_enabled = enable;
+
+	return 0;
+}
+
+/**
+ * zbc_get_stats - Get device command statistics
+ */
+int zbc_get_stats(struct zbc_device *dev, struct zbc_stats *stats)
+{
+	if (!stats)
+		return -EFAULT;
+
+	memcpy(stats, &dev->zbd_stats, sizeof(struct zbc_stats));
+
+	return 0;
+}
+
+/**
+ * zbc_reset_stats - Reset device command statistics
+ */
+int zbc_reset_stats(struct zbc_device *dev)
+{
+	memset(&dev->zbd_stats, 0, sizeof(struct zbc_stats));
+
+	return 0;
+}
+
+/**
+ * Apply the result of a successful write to the cached zone
+ * information. Any write that cannot be tracked locally invalidates
+ * the cache.
+ */
+static void zbc_zone_cache_update_write(struct zbc_device *dev,
+					uint64_t sector, size_t count)
+{
+	struct zbc_zone *zone;
+
+	if (!dev->zbd_zone_cache_valid)
+		return;
+
+	zone = zbc_cached_zone(dev, sector);
+	if (!zone)
+		goto invalidate;
+
+	/* Writes to conventional zones do not change any zone state */
+	if (!zbc_zone_sequential(zone))
+		return;
+
+	if (zbc_zone_full(zone) ||
+	    zbc_zone_wp(zone) != sector ||
+	    sector + count > zbc_zone_start(zone) + zbc_zone_length(zone))
+		/* Not a simple write pointer advance: state is unknown */
+		goto invalidate;
+
+	zone->zbz_write_pointer = sector + count;
+	if (zbc_zone_wp(zone) ==
+	    zbc_zone_start(zone) + zbc_zone_length(zone))
+		zbc_zone_set_cond(dev, zone, ZBC_ZC_FULL);
+	else if (zbc_zone_empty(zone) || zbc_zone_closed(zone))
+		zbc_zone_set_cond(dev, zone, ZBC_ZC_IMP_OPEN);
+
+	zbc_shm_update_zone(dev, zone);
+
+	return;
+
+invalidate:
+	zbc_zone_cache_invalidate(dev);
+}
+
+/**
+ * Apply the result of a successful zone operation to the cached zone
+ * information.
+ */
+static void zbc_zone_cache_update_op(struct zbc_device *dev, uint64_t sector,
+				     enum zbc_zone_op op, unsigned int flags)
+{
+	struct zbc_zone *zone;
+
+	if (!dev->zbd_zone_cache_valid)
+		return;
+
+	if (flags & ZBC_OP_ALL_ZONES) {
+		/* Refresh the entire cache on the next access */
+		zbc_zone_cache_invalidate(dev);
+		return;
+	}
+
+	zone = zbc_cached_zone(dev, sector);
+	if (!zone || !zbc_zone_sequential(zone)) {
+		zbc_zone_cache_invalidate(dev);
+		return;
+	}
+
+	switch (op) {
+	case ZBC_OP_RESET_ZONE:
+		zbc_zone_set_cond(dev, zone, ZBC_ZC_EMPTY);
+		zone->zbz_write_pointer = zbc_zone_start(zone);
+		break;
+	case ZBC_OP_OPEN_ZONE:
+		if (zbc_zone_empty(zone) || zbc_zone_imp_open(zone) ||
+		    zbc_zone_closed(zone))
+			zbc_zone_set_cond(dev, zone, ZBC_ZC_EXP_OPEN);
+		break;
+	case ZBC_OP_CLOSE_ZONE:
+		if (zbc_zone_is_open(zone)) {
+			if (zbc_zone_wp(zone) == zbc_zone_start(zone))
+				zbc_zone_set_cond(dev, zone, ZBC_ZC_EMPTY);
+			else
+				zbc_zone_set_cond(dev, zone, ZBC_ZC_CLOSED);
+		}
+		break;
+	case ZBC_OP_FINISH_ZONE:
+		zbc_zone_set_cond(dev, zone, ZBC_ZC_FULL);
+		zone->zbz_write_pointer =
+			zbc_zone_start(zone) + zbc_zone_length(zone);
+		break;
+	default:
+		zbc_zone_cache_invalidate(dev);
+		return;
+	}
+
+	zbc_shm_update_zone(dev, zone);
+}
+
+/**
+ * zbc_zone_operation - Execute an operation on a zone
+ */
+int zbc_zone_operation(struct zbc_device *dev, uint64_t sector,
+		       enum zbc_zone_op op, unsigned int flags)
+{
+	int ret;
+
+	if (!zbc_test_mode(dev) &&
+	    (!(flags & ZBC_OP_ALL_ZONES)) &&
+	    !zbc_dev_sect_laligned(dev, sector))
+		return -EINVAL;
+
+	/* Prefetched data may no longer match the device content */
+	if (dev->zbd_prefetch)
+		zbc_prefetch_reset(dev);
+
+	/* Staged writes must reach the device before the operation */
+	if (dev->zbd_wbuf) {
+		ret = zbc_wbuf_flush(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	/* Execute the operation */
+	ret = (dev->zbd_drv->zbd_zone_op)(dev, sector, op, flags);
+
+	if (dev->zbd_zone_cache) {
+		if (ret == 0)
+			zbc_zone_cache_update_op(dev, sector, op, flags);
+		else
+			zbc_zone_cache_invalidate(dev);
+	}
+
+	return ret;
+}
+
+/**
+ * Queue depth used to pipeline per-zone commands when a ranged zone
+ * operation falls back to per-zone execution on an asynchronous
+ * capable backend.
+ */
+#define ZBC_ZONE_OP_RANGE_QD	16
+
+/**
+ * Test if a zone operation has an effect on a zone and needs to be
+ * issued to the device.
+ */
+static bool zbc_zone_op_needed(struct zbc_zone *zone, enum zbc_zone_op op)
+{
+	if (!zbc_zone_sequential(zone))
+		return false;
+
+	switch (op) {
+	case ZBC_OP_RESET_ZONE:
+		return !zbc_zone_empty(zone);
+	case ZBC_OP_FINISH_ZONE:
+		return !zbc_zone_full(zone);
+	case ZBC_OP_CLOSE_ZONE:
+		return zbc_zone_is_open(zone);
+	default:
+		return true;
+	}
+}
+
+/**
+ * Synchronous execution of a ranged zone operation, one zone at a time.
+ */
+static int zbc_zone_op_range_serial(struct zbc_device *dev,
+				    struct zbc_zone *zones,
+				    unsigned int nr_zones,
+				    enum zbc_zone_op op, unsigned int flags)
+{
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nr_zones; i++) {
+		if (!zbc_zone_op_needed(&zones[i], op))
+			continue;
+		ret = zbc_zone_operation(dev, zones[i].zbz_start, op, flags);
+		if (ret != 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Per-zone execution of a ranged zone operation, pipelining the
+ * commands when the backend supports asynchronous requests.
+ */
+static int zbc_do_zone_op_range(struct zbc_device *dev,
+				struct zbc_zone *zones, unsigned int nr_zones,
+				enum zbc_zone_op op, unsigned int flags)
+{
+	struct zbc_aio aios[ZBC_ZONE_OP_RANGE_QD];
+	int free_slot[ZBC_ZONE_OP_RANGE_QD];
+	unsigned int nr_free = 0, next = 0;
+	struct zbc_aio *aio;
+	unsigned int i;
+	int ret = 0, r;
+
+	if (!dev->zbd_drv->zbd_aio_submit)
+		return zbc_zone_op_range_serial(dev, zones, nr_zones,
+						op, flags);
+
+	/* Pipelined execution */
+	memset(aios, 0, sizeof(aios));
+	for (i = 0; i < ZBC_ZONE_OP_RANGE_QD; i++)
+		free_slot[nr_free++] = i;
+
+	while (next < nr_zones || nr_free < ZBC_ZONE_OP_RANGE_QD) {
+
+		/* Keep the queue full as long as no error occurred */
+		while (ret == 0 && next < nr_zones && nr_free) {
+
+			if (!zbc_zone_op_needed(&zones[next], op)) {
+				next++;
+				continue;
+			}
+
+			aio = &aios[free_slot[nr_free - 1]];
+			aio->aio_op = ZBC_AIO_ZONE_OP;
+			aio->aio_sector = zones[next].zbz_start;
+			aio->aio_zone_op = op;
+			aio->aio_flags = flags;
+
+			r = zbc_aio_submit(dev, aio);
+			if (r != 0) {
+				if ((r == -ENXIO || r == -ENOTSUP) &&
+				    nr_free == ZBC_ZONE_OP_RANGE_QD)
+					/*
+					 * Asynchronous execution not available
+					 * for this operation: run serially.
+					 */
+					return zbc_zone_op_range_serial(dev,
+							zones, nr_zones,
+							op, flags);
+				ret = r;
+				break;
+			}
+			nr_free--;
+			next++;
+
+		}
+
+		if (nr_free == ZBC_ZONE_OP_RANGE_QD)
+			break;
+
+		/* Reap one completion */
+		r = zbc_aio_wait(dev, &aio);
+		if (r != 0) {
+			/*
+			 * The queued requests reference this stack frame:
+			 * try to drain them before returning. If waiting
+			 * fails again, completions are lost and there is
+			 * nothing more that can be done.
+			 */
+			while (nr_free < ZBC_ZONE_OP_RANGE_QD &&
+			       zbc_aio_wait(dev, &aio) == 0)
+				nr_free++;
+			if (dev->zbd_zone_cache)
+				zbc_zone_cache_invalidate(dev);
+			return r;
+		}
+
+		free_slot[nr_free++] = aio - aios;
+		if (aio->aio_result < 0 && ret == 0)
+			ret = aio->aio_result;
+
+	}
+
+	if (dev->zbd_zone_cache)
+		zbc_zone_cache_invalidate(dev);
 
-	return 0;
+	return ret;
 }
 
 /**
- * zbc_zone_operation - Execute an operation on a zone
+ * zbc_zone_operation_range - Execute an operation on a range of zones
  */
-int zbc_zone_operation(struct zbc_device *dev, uint64_t sector,
-		       enum zbc_zone_op op, unsigned int flags)
+int zbc_zone_operation_range(struct zbc_device *dev, uint64_t sector,
+			     unsigned int nr_zones, enum zbc_zone_op op,
+			     unsigned int flags)
 {
+	struct zbc_zone *zones;
+	unsigned int nz = nr_zones;
+	int ret;
 
-	if (!zbc_test_mode(dev) &&
-	    (!(flags & ZBC_OP_ALL_ZONES)) &&
-	    !zbc_dev_sect_laligned(dev, sector))
+	if (!nr_zones)
+		return 0;
+
+	if (!zbc_dev_sect_laligned(dev, sector))
 		return -EINVAL;
 
-	/* Execute the operation */
-	return (dev->zbd_drv->zbd_zone_op)(dev, sector, op, flags);
+	flags &= ~ZBC_OP_ALL_ZONES;
+
+	/* Prefetched data may no longer match the device content */
+	if (dev->zbd_prefetch)
+		zbc_prefetch_reset(dev);
+
+	/* Staged writes must reach the device before the operations */
+	if (dev->zbd_wbuf) {
+		ret = zbc_wbuf_flush(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	/* Use the backend ranged operation if there is one */
+	if (dev->zbd_drv->zbd_zone_op_range) {
+		ret = (dev->zbd_drv->zbd_zone_op_range)(dev, sector, nr_zones,
+							op, flags);
+		if (ret != -EOPNOTSUPP) {
+			if (dev->zbd_zone_cache)
+				zbc_zone_cache_invalidate(dev);
+			return ret;
+		}
+	}
+
+	/* Get the target zones */
+	zones = (struct zbc_zone *) calloc(nr_zones,
+					   sizeof(struct zbc_zone));
+	if (!zones)
+		return -ENOMEM;
+
+	ret = zbc_report_zones_cached(dev, sector, ZBC_RO_ALL, zones, &nz);
+	if (ret == 0)
+		ret = zbc_do_zone_op_range(dev, zones, nz, op, flags);
+
+	free(zones);
+
+	return ret;
 }
 
 /**
@@ -635,7 +1671,13 @@ static ssize_t zbc_do_preadv(struct zbc_device *dev,
 			     const struct iovec *iov, int iovcnt,
 			     uint64_t offset)
 {
-	size_t max_count = dev->zbd_info.zbd_max_rw_sectors;
+	/*
+	 * Single buffer transfers can use the larger bsg command limit,
+	 * vectored transfers stay bound by the SG v3 limit.
+	 */
+	size_t max_count = iovcnt == 1 ?
+		dev->zbd_info.zbd_max_rw_sectors :
+		zbc_dev_max_sg_rw_sectors(dev);
 	size_t count = zbc_iov_count(iov, iovcnt);
 	struct iovec rd_iov[iovcnt];
 	size_t rd_iov_count = 0, rd_iov_offset = 0;
@@ -713,6 +1755,119 @@ static ssize_t zbc_do_preadv(struct zbc_device *dev,
 	return count;
 }
 
+/**
+ * Number of in-flight segments used when a read or write larger than
+ * the device maximum transfer size is split (see zbc_pipelined_rw()).
+ */
+#define ZBC_RW_PIPELINE_QD	2
+
+/**
+ * Execute a read or write larger than the device maximum transfer
+ * size by segmenting it at the transfer limit and keeping several
+ * segments in flight through the backend asynchronous interface,
+ * instead of paying a full command turnaround per segment.
+ */
+static ssize_t zbc_pipelined_rw(struct zbc_device *dev, void *buf,
+				size_t count, uint64_t offset,
+				enum zbc_aio_op op)
+{
+	struct zbc_aio aios[ZBC_RW_PIPELINE_QD], *aio;
+	struct iovec iovs[ZBC_RW_PIPELINE_QD];
+	int free_slot[ZBC_RW_PIPELINE_QD];
+	int i, slot, nr_free = ZBC_RW_PIPELINE_QD, inflight = 0;
+	/* Queued commands are bound by the SG v3 transfer limit */
+	size_t max_count = zbc_dev_max_sg_rw_sectors(dev);
+	size_t chunk, remaining = count;
+	uint64_t next = offset, done_end = offset + count;
+	ssize_t ret, first_error = 0;
+
+	for (i = 0; i < ZBC_RW_PIPELINE_QD; i++)
+		free_slot[i] = i;
+
+	while ((remaining && !first_error) || inflight) {
+
+		/* Keep the pipeline full */
+		while (remaining && nr_free && !first_error) {
+
+			chunk = remaining > max_count ? max_count : remaining;
+			slot = free_slot[nr_free - 1];
+
+			iovs[slot].iov_base =
+				(char *)buf + ((next - offset) << 9);
+			iovs[slot].iov_len = chunk;
+
+			aio = &aios[slot];
+			memset(aio, 0, sizeof(struct zbc_aio));
+			aio->aio_op = op;
+			aio->aio_sector = next;
+			aio->aio_iov = &iovs[slot];
+			aio->aio_iovcnt = 1;
+
+			ret = zbc_aio_submit(dev, aio);
+			if (ret != 0) {
+				if (!inflight && next == offset)
+					/* Nothing started yet */
+					return ret;
+				first_error = ret;
+				break;
+			}
+
+			nr_free--;
+			inflight++;
+			next += chunk;
+			remaining -= chunk;
+
+		}
+
+		if (!inflight)
+			break;
+
+		ret = zbc_aio_wait(dev, &aio);
+		if (ret != 0) {
+			/*
+			 * The queued requests reference buffers on this
+			 * stack frame: try to drain them before returning.
+			 * If waiting fails again, completions are lost and
+			 * there is nothing more that can be done.
+			 */
+			while (inflight && zbc_aio_wait(dev, &aio) == 0)
+				inflight--;
+			if (op == ZBC_AIO_PWRITE && dev->zbd_zone_cache)
+				zbc_zone_cache_invalidate(dev);
+			return ret;
+		}
+
+		inflight--;
+		slot = aio - aios;
+		free_slot[nr_free++] = slot;
+
+		if (aio->aio_result < 0) {
+			if (!first_error)
+				first_error = aio->aio_result;
+			if (aio->aio_sector < done_end)
+				done_end = aio->aio_sector;
+		} else if ((size_t)aio->aio_result < iovs[slot].iov_len) {
+			/* Short transfer: do not submit anything further */
+			remaining = 0;
+			if (aio->aio_sector + aio->aio_result < done_end)
+				done_end = aio->aio_sector + aio->aio_result;
+		}
+
+	}
+
+	if (op == ZBC_AIO_PWRITE && dev->zbd_zone_cache) {
+		if (first_error || done_end != offset + count)
+			zbc_zone_cache_invalidate(dev);
+		else
+			zbc_zone_cache_update_write(dev, offset, count);
+	}
+
+	if (first_error)
+		return first_error;
+
+	return done_end - offset;
+}
+
 /**
  * zbc_pread - Read sectors from a device
  */
@@ -720,6 +1875,34 @@ ssize_t zbc_pread(struct zbc_device *dev, void *buf, size_t count,
 		  uint64_t offset)
 {
 	const struct iovec iov = { buf, count };
+	ssize_t ret;
+
+	/* Reads must see the data staged by write coalescing */
+	if (dev->zbd_wbuf) {
+		ret = zbc_wbuf_flush(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	if (dev->zbd_prefetch &&
+	    count <= dev->zbd_info.zbd_max_rw_sectors)
+		return zbc_prefetch_pread(dev, buf, count, offset);
+
+	if (count > dev->zbd_info.zbd_max_rw_sectors &&
+	    dev->zbd_drv->zbd_aio_submit) {
+		/*
+		 * The pipelined read reaps every completion it sees: an
+		 * in-flight prefetch must be retired first so that its
+		 * completion cannot be mistaken for a pipeline segment.
+		 */
+		if (dev->zbd_prefetch)
+			zbc_prefetch_reset(dev);
+		ret = zbc_pipelined_rw(dev, buf, count, offset,
+				       ZBC_AIO_PREAD);
+		if (ret != -ENXIO && ret != -ENOTSUP)
+			return ret;
+		/* Asynchronous execution not available: run serially */
+	}
 
 	return zbc_do_preadv(dev, &iov, 1, offset);
 }
@@ -730,20 +1913,39 @@ ssize_t zbc_pread(struct zbc_device *dev, void *buf, size_t count,
 ssize_t zbc_preadv(struct zbc_device *dev,
 		   const struct iovec *iov, int iovcnt, uint64_t offset)
 {
+	ssize_t ret;
+
 	if (!iov || iovcnt <= 0)
 		return -EINVAL;
 
+	/* Reads must see the data staged by write coalescing */
+	if (dev->zbd_wbuf) {
+		ret = zbc_wbuf_flush(dev);
+		if (ret != 0)
+			return ret;
+	}
+
 	return zbc_do_preadv(dev, iov, iovcnt, offset);
 }
 
 /**
  * zbc_do_pwritev - Execute a vector write
+ *
+ * Internal entry point: unlike zbc_pwritev(), this does not write out
+ * the data staged by write coalescing first, which makes it the write
+ * path that the coalescing layer itself uses to flush.
  */
-static ssize_t zbc_do_pwritev(struct zbc_device *dev,
-			      const struct iovec *iov, int iovcnt,
-			      uint64_t offset)
+ssize_t zbc_do_pwritev(struct zbc_device *dev,
+		       const struct iovec *iov, int iovcnt,
+		       uint64_t offset)
 {
-	size_t max_count = dev->zbd_info.zbd_max_rw_sectors;
+	/*
+	 * Single buffer transfers can use the larger bsg command limit,
+	 * vectored transfers stay bound by the SG v3 limit.
+	 */
+	size_t max_count = iovcnt == 1 ?
+		dev->zbd_info.zbd_max_rw_sectors :
+		zbc_dev_max_sg_rw_sectors(dev);
 	size_t count = zbc_iov_count(iov, iovcnt);
 	struct iovec wr_iov[iovcnt];
 	size_t wr_iov_count = 0, wr_iov_offset = 0;
@@ -753,6 +1955,10 @@ static ssize_t zbc_do_pwritev(struct zbc_device *dev,
 	if (count << 9 > SSIZE_MAX)
 		return -EINVAL;
 
+	/* Prefetched data may no longer match the device content */
+	if (dev->zbd_prefetch)
+		zbc_prefetch_reset(dev);
+
 	if (zbc_test_mode(dev)) {
 		if (!count) {
 			zbc_error("%s: zero-length write at sector %llu\n",
@@ -810,9 +2016,14 @@ static ssize_t zbc_do_pwritev(struct zbc_device *dev,
 				  dev->zbd_filename,
 				  wr_iov_count, (unsigned long long) offset,
 				  -ret, strerror(-ret));
+			if (dev->zbd_zone_cache)
+				zbc_zone_cache_invalidate(dev);
 			return ret ? ret : -EIO;
 		}
 
+		if (dev->zbd_zone_cache)
+			zbc_zone_cache_update_write(dev, offset, ret);
+
 		offset += ret;
 		wr_iov_offset += ret;
 
@@ -828,6 +2039,23 @@ ssize_t zbc_pwrite(struct zbc_device *dev, const void *buf, size_t count,
 		   uint64_t offset)
 {
 	const struct iovec iov = { (void *)buf, count };
+	ssize_t ret;
+
+	/* Coalesce writes when enabled */
+	if (dev->zbd_wbuf)
+		return zbc_wbuf_pwrite(dev, buf, count, offset);
+
+	if (count > dev->zbd_info.zbd_max_rw_sectors &&
+	    dev->zbd_drv->zbd_aio_submit) {
+		/* Prefetched data may no longer match the device content */
+		if (dev->zbd_prefetch)
+			zbc_prefetch_reset(dev);
+		ret = zbc_pipelined_rw(dev, (void *)buf, count, offset,
+				       ZBC_AIO_PWRITE);
+		if (ret != -ENXIO && ret != -ENOTSUP)
+			return ret;
+		/* Asynchronous execution not available: run serially */
+	}
 
 	return zbc_do_pwritev(dev, &iov, 1, offset);
 }
@@ -838,12 +2066,87 @@ ssize_t zbc_pwrite(struct zbc_device *dev, const void *buf, size_t count,
 ssize_t zbc_pwritev(struct zbc_device *dev, const struct iovec *iov, int iovcnt,
 		    uint64_t offset)
 {
+	ssize_t ret;
+
 	if (!iov || iovcnt <= 0)
 		return -EINVAL;
 
+	/*
+	 * Data staged by write coalescing must reach the device first
+	 * to preserve the program write order.
+	 */
+	if (dev->zbd_wbuf) {
+		ret = zbc_wbuf_flush(dev);
+		if (ret != 0)
+			return ret;
+	}
+
 	return zbc_do_pwritev(dev, iov, iovcnt, offset);
 }
 
+/**
+ * zbc_pwrite_append - Write sectors at the write pointer of a zone
+ */
+ssize_t zbc_pwrite_append(struct zbc_device *dev, const void *buf,
+			  size_t count, uint64_t zone_sector)
+{
+	struct zbc_zone *zone;
+	uint64_t wp;
+	ssize_t ret;
+
+	if (!dev->zbd_zone_cache) {
+		zbc_error("%s: zbc_pwrite_append requires the zone cache "
+			  "(see zbc_set_zone_cache())\n",
+			  dev->zbd_filename);
+		return -ENXIO;
+	}
+
+	/* The tracked write pointer must account for any staged data */
+	if (dev->zbd_wbuf) {
+		ret = zbc_wbuf_flush(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	if (!dev->zbd_zone_cache_valid) {
+		ret = zbc_refresh_zone_cache(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	zone = zbc_cached_zone(dev, zone_sector);
+	if (!zone || zbc_zone_start(zone) != zone_sector) {
+		zbc_error("%s: No zone starts at sector %llu\n",
+			  dev->zbd_filename,
+			  (unsigned long long)zone_sector);
+		return -EINVAL;
+	}
+
+	if (!zbc_zone_sequential(zone)) {
+		zbc_error("%s: Zone at sector %llu is not sequential\n",
+			  dev->zbd_filename,
+			  (unsigned long long)zone_sector);
+		return -EINVAL;
+	}
+
+	if (zbc_zone_full(zone))
+		return -ENOSPC;
+
+	wp = zbc_zone_wp(zone);
+	if (wp + count > zbc_zone_start(zone) + zbc_zone_length(zone))
+		return -ENOSPC;
+
+	/*
+	 * The write advances the tracked write pointer through the
+	 * zone cache update done on the write completion.
+	 */
+	ret = zbc_pwrite(dev, buf, count, wp);
+	if (ret < 0)
+		return ret;
+
+	return wp;
+}
+
 /**
  * zbc_map_iov - Map a buffer to an IOV
  */
@@ -875,14 +2178,257 @@ int zbc_map_iov(const void *buf, size_t sectors,
 	return i;
 }
 
+/**
+ * zbc_thp_size - Transparent huge page size of the system
+ */
+size_t zbc_thp_size(void)
+{
+	static size_t thp_size;
+	unsigned long long sz = 0;
+	FILE *f;
+
+	if (thp_size)
+		return thp_size;
+
+	f = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+	if (f) {
+		if (fscanf(f, "%llu", &sz) != 1)
+			sz = 0;
+		fclose(f);
+	}
+	if (sz)
+		thp_size = sz;
+	else
+		thp_size = 2 * 1024 * 1024;
+
+	return thp_size;
+}
+
+/**
+ * zbc_map_iov_auto - Map a buffer to an IOV with automatic segment sizing
+ */
+int zbc_map_iov_auto(const void *buf, size_t sectors,
+		     struct iovec *iov, int iovcnt)
+{
+	size_t thp_sectors = zbc_thp_size() >> 9;
+	size_t start, end, len;
+	int i = 0;
+
+	if (!buf || !sectors || !iov || iovcnt <= 0)
+		return -EINVAL;
+
+	/*
+	 * A buffer contained within a single huge page region maps to a
+	 * single segment: for THP backed buffers, such a segment is
+	 * physically contiguous and needs a single SG list entry. This
+	 * also covers buffers that are not sector aligned and cannot be
+	 * split on sector boundaries.
+	 */
+	start = ((size_t)buf >> 9) / thp_sectors;
+	end = (((size_t)buf + (sectors << 9) - 1) >> 9) / thp_sectors;
+	if (iovcnt == 1 || start == end || ((size_t)buf & 511))
+		return zbc_map_iov(buf, sectors, iov, iovcnt, sectors);
+
+	/*
+	 * If the IOV array cannot hold one segment per huge page region,
+	 * fall back to splitting the buffer evenly.
+	 */
+	if (end - start + 1 > (size_t)iovcnt)
+		return zbc_map_iov(buf, sectors, iov, iovcnt,
+				   (sectors + iovcnt - 1) / iovcnt);
+
+	/* Split the buffer on huge page region boundaries */
+	while (sectors) {
+
+		len = thp_sectors - (((size_t)buf >> 9) % thp_sectors);
+		if (len > sectors)
+			len = sectors;
+
+		iov[i].iov_base = (void *)buf;
+		iov[i].iov_len = len;
+
+		buf += len << 9;
+		sectors -= len;
+		i++;
+	}
+
+	return i;
+}
+
 /**
  * zbc_flush - flush a device write cache
  */
 int zbc_flush(struct zbc_device *dev)
 {
+	int ret;
+
+	/* Write out any staged data first */
+	if (dev->zbd_wbuf) {
+		ret = zbc_wbuf_flush(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	return (dev->zbd_drv->zbd_flush)(dev);
+}
+
+/**
+ * zbc_flush_range - flush a device write cache for a range of sectors
+ */
+int zbc_flush_range(struct zbc_device *dev, uint64_t sector, uint64_t count)
+{
+	int ret;
+
+	if (!count)
+		return 0;
+
+	if (!zbc_dev_sect_laligned(dev, sector) ||
+	    !zbc_dev_sect_laligned(dev, count))
+		return -EINVAL;
+
+	/* Write out any staged data first */
+	if (dev->zbd_wbuf) {
+		ret = zbc_wbuf_flush(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	/* Use the backend ranged flush if there is one */
+	if (dev->zbd_drv->zbd_flush_range) {
+		ret = (dev->zbd_drv->zbd_flush_range)(dev, sector, count);
+		if (ret != -EOPNOTSUPP)
+			return ret;
+	}
+
 	return (dev->zbd_drv->zbd_flush)(dev);
 }
 
+/**
+ * zbc_set_timeout - Set the command timeout of a class of commands
+ */
+int zbc_set_timeout(struct zbc_device *dev,
+		    enum zbc_timeout_class timeout_class,
+		    unsigned int timeout_ms)
+{
+	if (timeout_class > ZBC_TIMEOUT_CTRL)
+		return -EINVAL;
+
+	dev->zbd_timeout_ms[timeout_class] = timeout_ms;
+
+	return 0;
+}
+
+/**
+ * zbc_aio_submit - Submit an asynchronous request
+ */
+int zbc_aio_submit(struct zbc_device *dev, struct zbc_aio *aio)
+{
+	size_t count;
+	int ret;
+
+	/* Do this only if supported */
+	if (!dev->zbd_drv->zbd_aio_submit)
+		return -ENXIO;
+
+	switch (aio->aio_op) {
+	case ZBC_AIO_PREAD:
+	case ZBC_AIO_PWRITE:
+
+		if (!aio->aio_iov || aio->aio_iovcnt <= 0)
+			return -EINVAL;
+
+		count = zbc_iov_count(aio->aio_iov, aio->aio_iovcnt);
+		if (aio->aio_op == ZBC_AIO_PWRITE) {
+			if (!zbc_dev_sect_paligned(dev, count) ||
+			    !zbc_dev_sect_paligned(dev, aio->aio_sector)) {
+				zbc_error("%s: Unaligned write %zu sectors at "
+					  "sector %llu\n",
+					  dev->zbd_filename, count,
+					  (unsigned long long) aio->aio_sector);
+				return -EINVAL;
+			}
+		} else if (!zbc_dev_sect_laligned(dev, count) ||
+			   !zbc_dev_sect_laligned(dev, aio->aio_sector)) {
+			zbc_error("%s: Unaligned read %zu sectors at "
+				  "sector %llu\n",
+				  dev->zbd_filename, count,
+				  (unsigned long long) aio->aio_sector);
+			return -EINVAL;
+		}
+
+		/*
+		 * Asynchronous requests are not segmented and are issued
+		 * through the SG v3 interface: they stay bound by its
+		 * transfer limit even when a bsg node raised the device
+		 * maximum R/W size.
+		 */
+		if (!count ||
+		    count > zbc_dev_max_sg_rw_sectors(dev) ||
+		    aio->aio_sector + count > dev->zbd_info.zbd_sectors)
+			return -EINVAL;
+
+		/*
+		 * The caller vector specifies buffer lengths in 512B
+		 * sectors but the backend drivers consume byte-unit
+		 * vectors: keep a converted copy with the request until
+		 * its completion is reaped (the asynchronous analogue of
+		 * the conversion done by zbc_do_preadv()).
+		 */
+		aio->aio_biov = (struct iovec *)
+			malloc(sizeof(struct iovec) * aio->aio_iovcnt);
+		if (!aio->aio_biov)
+			return -ENOMEM;
+		zbc_iov_convert(aio->aio_biov, aio->aio_iov,
+				aio->aio_iovcnt, 0, count);
+
+		break;
+
+	case ZBC_AIO_ZONE_OP:
+
+		if (!(aio->aio_flags & ZBC_OP_ALL_ZONES) &&
+		    !zbc_dev_sect_laligned(dev, aio->aio_sector))
+			return -EINVAL;
+
+		aio->aio_biov = NULL;
+
+		break;
+
+	default:
+		return -EINVAL;
+	}
+
+	aio->aio_result = 0;
+
+	/* Queue the request */
+	ret = (dev->zbd_drv->zbd_aio_submit)(dev, aio);
+	if (ret != 0) {
+		free(aio->aio_biov);
+		aio->aio_biov = NULL;
+	}
+
+	return ret;
+}
+
+/**
+ * zbc_aio_wait - Wait for an asynchronous request completion
+ */
+int zbc_aio_wait(struct zbc_device *dev, struct zbc_aio **paio)
+{
+	int ret;
+
+	/* Do this only if supported */
+	if (!dev->zbd_drv->zbd_aio_wait)
+		return -ENXIO;
+
+	ret = (dev->zbd_drv->zbd_aio_wait)(dev, paio);
+	if (ret == 0 && *paio) {
+		free((*paio)->aio_biov);
+		(*paio)->aio_biov = NULL;
+	}
+
+	return ret;
+}
+
 /**
  * zbc_set_zones - Configure zones of an emulated device
  */
@@ -919,3 +2465,68 @@ int zbc_set_write_pointer(struct zbc_device *dev,
 	return (dev->zbd_drv->zbd_set_wp)(dev, sector, wp_sector);
 }
 
+/**
+ * zbc_set_write_pointers - Change several zone write pointers at once
+ */
+int zbc_set_write_pointers(struct zbc_device *dev,
+			   const struct zbc_wp *wps, unsigned int nr_wps)
+{
+	unsigned int i;
+	int ret;
+
+	/* Do this only if supported */
+	if (!dev->zbd_drv->zbd_set_wps)
+		return -ENXIO;
+
+	if (!wps && nr_wps)
+		return -EFAULT;
+
+	for (i = 0; i < nr_wps; i++) {
+		if (!zbc_dev_sect_paligned(dev, wps[i].zbw_sector) ||
+		    !zbc_dev_sect_paligned(dev, wps[i].zbw_wp_sector))
+			return -EINVAL;
+	}
+
+	ret = (dev->zbd_drv->zbd_set_wps)(dev, wps, nr_wps);
+	if (ret == 0)
+		/* The cached zone information is out of date */
+		zbc_zone_cache_invalidate(dev);
+
+	return ret;
+}
+
+/**
+ * zbc_get_state - Get a snapshot of an emulated device zone state
+ */
+ssize_t zbc_get_state(struct zbc_device *dev, void *buf, size_t bufsz)
+{
+
+	/* Do this only if supported */
+	if (!dev->zbd_drv->zbd_get_state)
+		return -ENXIO;
+
+	return (dev->zbd_drv->zbd_get_state)(dev, buf, bufsz);
+}
+
+/**
+ * zbc_set_state - Restore a snapshot of an emulated device zone state
+ */
+int zbc_set_state(struct zbc_device *dev, const void *buf, size_t bufsz)
+{
+	int ret;
+
+	/* Do this only if supported */
+	if (!dev->zbd_drv->zbd_set_state)
+		return -ENXIO;
+
+	if (!buf)
+		return -EFAULT;
+
+	ret = (dev->zbd_drv->zbd_set_state)(dev, buf, bufsz);
+	if (ret == 0)
+		/* The cached zone information is out of date */
+		zbc_zone_cache_invalidate(dev);
+
+	return ret;
+}
+
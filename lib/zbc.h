@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <scsi/scsi.h>
 #include <scsi/sg.h>
@@ -60,6 +61,14 @@ struct zbc_drv {
 	int		(*zbd_zone_op)(struct zbc_device *, uint64_t,
 				       enum zbc_zone_op, unsigned int);
 
+	/**
+	 * Execute a zone operation on a range of zones (optional).
+	 * May return -EOPNOTSUPP to fall back to per-zone execution.
+	 */
+	int		(*zbd_zone_op_range)(struct zbc_device *, uint64_t,
+					     unsigned int, enum zbc_zone_op,
+					     unsigned int);
+
 	/**
 	 * Vector read from a ZBC device.
 	 */
@@ -77,6 +86,25 @@ struct zbc_drv {
 	 */
 	int		(*zbd_flush)(struct zbc_device *);
 
+	/**
+	 * Flush a range of sectors of a ZBC device cache (optional).
+	 * May return -EOPNOTSUPP to fall back to a full cache flush.
+	 */
+	int		(*zbd_flush_range)(struct zbc_device *, uint64_t,
+					   uint64_t);
+
+	/**
+	 * Submit an asynchronous request (optional).
+	 */
+	int		(*zbd_aio_submit)(struct zbc_device *,
+					  struct zbc_aio *);
+
+	/**
+	 * Wait for an asynchronous request completion (optional).
+	 */
+	int		(*zbd_aio_wait)(struct zbc_device *,
+					struct zbc_aio **);
+
 	/**
 	 * Change a device zone configuration.
 	 * For emulated drives only (optional).
@@ -91,8 +119,59 @@ struct zbc_drv {
 	int		(*zbd_set_wp)(struct zbc_device *,
 				      uint64_t, uint64_t);
 
+	/**
+	 * Change several zone write pointers at once.
+	 * For emulated drives only (optional).
+	 */
+	int		(*zbd_set_wps)(struct zbc_device *,
+				       const struct zbc_wp *, unsigned int);
+
+	/**
+	 * Get a snapshot of the device zone state.
+	 * For emulated drives only (optional).
+	 */
+	ssize_t		(*zbd_get_state)(struct zbc_device *,
+					 void *, size_t);
+
+	/**
+	 * Restore a snapshot of the device zone state.
+	 * For emulated drives only (optional).
+	 */
+	int		(*zbd_set_state)(struct zbc_device *,
+					 const void *, size_t);
+
+};
+
+/**
+ * Number of data buffers recycled in the per-device SG command
+ * buffer pool.
+ */
+#define ZBC_SG_BUF_POOL_SIZE	4
+
+/**
+ * Recycled SG command data buffer (see lib/zbc_sg.c).
+ */
+struct zbc_sg_buf {
+
+	/**
+	 * Page aligned buffer, NULL for free pool slots.
+	 */
+	void			*buf;
+
+	/**
+	 * Allocated buffer size (B).
+	 */
+	size_t			size;
+
 };
 
+/**
+ * Number of zone conditions tracked by the zone cache condition
+ * bitmaps. Zone condition codes fit in a nibble (ZBC_ZC_NOT_WP to
+ * ZBC_ZC_OFFLINE).
+ */
+#define ZBC_ZONE_COND_NR	16
+
 /**
  * Device descriptor.
  */
@@ -114,6 +193,23 @@ struct zbc_device {
 	 */
 	int			zbd_sg_fd;
 
+	/**
+	 * BSG (SG v4) node file descriptor, used instead of zbd_sg_fd
+	 * for command execution when the device has a bsg node.
+	 * 0 if not available.
+	 */
+	int			zbd_bsg_fd;
+
+	/**
+	 * Maximum data transfer size (512B sectors) of commands issued
+	 * through the SG v3 interface. Vectored and queued commands
+	 * always use this interface and stay bound by this limit even
+	 * when a bsg node allows larger single buffer transfers, in
+	 * which case this is lower than zbd_info.zbd_max_rw_sectors
+	 * (see zbc_sg_open_bsg()). 0 if never probed.
+	 */
+	uint64_t		zbd_sg_max_rw_sectors;
+
 	/**
 	 * Device operations.
 	 */
@@ -134,6 +230,83 @@ struct zbc_device {
 	 */
 	unsigned int		zbd_drv_flags;
 
+	/**
+	 * Pool of page aligned data buffers recycled across SG
+	 * commands. As with command execution, pool accesses are
+	 * not serialized by the library.
+	 */
+	struct zbc_sg_buf	zbd_sg_buf_pool[ZBC_SG_BUF_POOL_SIZE];
+
+	/**
+	 * Zone cache enable flag (see zbc_set_zone_cache()).
+	 */
+	bool			zbd_zone_cache;
+
+	/**
+	 * Zone cache validity. The cache is invalidated whenever a
+	 * write or zone operation result cannot be applied locally.
+	 */
+	bool			zbd_zone_cache_valid;
+
+	/**
+	 * Cached zone array. Allocated only when the zone cache
+	 * is enabled.
+	 */
+	struct zbc_zone		*zbd_zones;
+
+	/**
+	 * Number of cached zones.
+	 */
+	unsigned int		zbd_nr_zones;
+
+	/**
+	 * Per-condition zone bitmaps (one bit per cached zone for each
+	 * of the ZBC_ZONE_COND_NR zone conditions), used to answer
+	 * zbc_find_zone() queries without scanning the zone array.
+	 * Allocated together with the cached zone array.
+	 */
+	unsigned long		*zbd_zone_cond_bitmaps;
+
+	/**
+	 * Number of words of a single zone condition bitmap.
+	 */
+	unsigned int		zbd_zone_bitmap_words;
+
+	/**
+	 * Shared zone cache attachment (see zbc_set_shared_zone_cache()).
+	 * NULL when the shared zone cache is not attached.
+	 */
+	struct zbc_shm		*zbd_shm;
+
+	/**
+	 * Sequential read prefetcher state (see zbc_set_read_prefetch()).
+	 * NULL when prefetching is disabled.
+	 */
+	struct zbc_prefetch	*zbd_prefetch;
+
+	/**
+	 * Write coalescing state (see zbc_set_write_coalescing()).
+	 * NULL when write coalescing is disabled.
+	 */
+	struct zbc_wbuf		*zbd_wbuf;
+
+	/**
+	 * Per-class command timeouts in milliseconds (see
+	 * zbc_set_timeout()). 0 selects the default timeout.
+	 */
+	unsigned int		zbd_timeout_ms[ZBC_TIMEOUT_CTRL + 1];
+
+	/**
+	 * Command statistics enable flag (see zbc_set_stats()).
+	 */
+	bool			zbd_stats_enabled;
+
+	/**
+	 * Command statistics, accumulated only when statistics
+	 * collection is enabled.
+	 */
+	struct zbc_stats	zbd_stats;
+
 };
 
 /**
@@ -148,6 +321,31 @@ static inline void zbc_set_errno(enum zbc_sk sk, enum zbc_asc_ascq asc_ascq)
 }
 #define zbc_clear_errno()	zbc_set_errno(0, 0)
 
+/**
+ * Command statistics timestamp in microseconds.
+ * Returns 0 when statistics collection is disabled, so that the
+ * only overhead in that case is a single test.
+ */
+static inline unsigned long long zbc_stats_start(struct zbc_device *dev)
+{
+	struct timespec ts;
+
+	if (!dev->zbd_stats_enabled)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000000ULL +
+		(unsigned long long)ts.tv_nsec / 1000;
+}
+
+/**
+ * Account for the completion of a command started at \a start,
+ * as obtained from zbc_stats_start().
+ */
+void zbc_stats_account(struct zbc_device *dev, enum zbc_stats_op op,
+		       unsigned long long start, int err);
+
 /**
  * Test if a device is zoned.
  */
@@ -218,6 +416,18 @@ struct zbc_drv zbc_fake_drv;
 #define zbc_dev_sect_paligned(dev, sect)	\
 	((((sect) << 9) & ((dev)->zbd_info.zbd_pblock_size - 1)) == 0)
 
+/**
+ * Maximum transfer size of vectored and queued commands: these always
+ * go through the SG v3 interface, which may have a lower limit than
+ * single buffer commands issued through a bsg node.
+ */
+static inline uint64_t zbc_dev_max_sg_rw_sectors(struct zbc_device *dev)
+{
+	if (dev->zbd_sg_max_rw_sectors)
+		return dev->zbd_sg_max_rw_sectors;
+	return dev->zbd_info.zbd_max_rw_sectors;
+}
+
 /**
  * Count total size of vector buffers.
  */
@@ -232,6 +442,64 @@ static inline size_t zbc_iov_count(const struct iovec *iov, int iovcnt)
 	return count;
 }
 
+/**
+ * Free all buffers of a device SG command buffer pool. This must be
+ * done before the backend driver close operation frees the device.
+ */
+void zbc_sg_drain_buf_pool(struct zbc_device *dev);
+
+/**
+ * Transparent huge page size of the system.
+ */
+size_t zbc_thp_size(void);
+
+/**
+ * Sequential read prefetcher (lib/zbc_prefetch.c). zbc_prefetch_pread()
+ * serves reads of a device with prefetching enabled. The prefetched
+ * data is discarded with zbc_prefetch_reset() whenever the device
+ * content may change, and freed with zbc_prefetch_free() when the
+ * prefetcher is disabled or the device closed.
+ */
+ssize_t zbc_prefetch_pread(struct zbc_device *dev, void *buf, size_t count,
+			   uint64_t offset);
+void zbc_prefetch_reset(struct zbc_device *dev);
+void zbc_prefetch_free(struct zbc_device *dev);
+
+/**
+ * Shared zone cache (lib/zbc_shm.c). zbc_shm_pull() refreshes the
+ * local zone cache from the shared copy, zbc_shm_publish() publishes
+ * the local cache after a device refresh and zbc_shm_update_zone()
+ * publishes a single updated zone. zbc_shm_set_stale() marks the
+ * shared copy stale when the local cache is invalidated and
+ * zbc_shm_detach() detaches the segment when the shared cache is
+ * disabled or the device closed.
+ */
+/**
+ * Write coalescing (lib/zbc_wbuf.c). zbc_wbuf_pwrite() serves writes of
+ * a device with coalescing enabled. The staged data is written out with
+ * zbc_wbuf_flush() before any operation that must see it on the device
+ * (reads, zone operations, cache flushes) and the staging state is
+ * freed with zbc_wbuf_free() when coalescing is disabled or the device
+ * closed.
+ */
+ssize_t zbc_wbuf_pwrite(struct zbc_device *dev, const void *buf, size_t count,
+			uint64_t offset);
+int zbc_wbuf_flush(struct zbc_device *dev);
+void zbc_wbuf_free(struct zbc_device *dev);
+
+/**
+ * Vector write without the write coalescing flush done by
+ * zbc_pwritev(), used by the coalescing layer to write out staged data.
+ */
+ssize_t zbc_do_pwritev(struct zbc_device *dev,
+		       const struct iovec *iov, int iovcnt, uint64_t offset);
+
+bool zbc_shm_pull(struct zbc_device *dev);
+void zbc_shm_publish(struct zbc_device *dev);
+void zbc_shm_update_zone(struct zbc_device *dev, struct zbc_zone *zone);
+void zbc_shm_set_stale(struct zbc_device *dev);
+void zbc_shm_detach(struct zbc_device *dev);
+
 /**
  * The block backend driver uses the SCSI backend information and
  * some zone operation.
@@ -266,11 +534,16 @@ enum {
  */
 int zbc_log_level;
 
+/**
+ * Emit a log message, either directly to the target stream or through
+ * the per-thread log ring when asynchronous log output is enabled
+ * (lib/zbc_log.c).
+ */
+extern void zbc_log_print(FILE *stream, const char *format, ...)
+	__attribute__((format(printf, 2, 3)));
+
 #define zbc_print(stream,format,args...)		\
-	do {						\
-		fprintf((stream), format, ## args);     \
-		fflush(stream);                         \
-	} while (0)
+	zbc_log_print((stream), format, ## args)
 
 /**
  * Log level controlled messages.
@@ -291,8 +564,24 @@ int zbc_log_level;
 #define zbc_info(format,args...)	\
 	zbc_print_level(ZBC_LOG_INFO, stdout, format, ##args)
 
+/**
+ * Debug-level messages can be compiled out entirely with the configure
+ * option --disable-debug-log so that release builds pay no log level
+ * check in the I/O paths. zbc_log_debug_enabled() guards code preparing
+ * arguments for debug messages (e.g. CDB dumps).
+ */
+#ifdef ZBC_NO_DEBUG_LOG
+
+#define zbc_debug(format,args...)	do { } while (0)
+#define zbc_log_debug_enabled()		(false)
+
+#else
+
 #define zbc_debug(format,args...)	\
 	zbc_print_level(ZBC_LOG_DEBUG, stdout, format, ##args)
+#define zbc_log_debug_enabled()		(zbc_log_level >= ZBC_LOG_DEBUG)
+
+#endif /* ZBC_NO_DEBUG_LOG */
 
 #define zbc_panic(format,args...)	\
 	do {						\
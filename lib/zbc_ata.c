@@ -337,7 +337,7 @@ static void zbc_ata_request_sense_data_ext(struct zbc_device *dev)
 		goto out;
 	}
 
-	if (zbc_log_level >= ZBC_LOG_DEBUG) {
+	if (zbc_log_debug_enabled()) {
 		zbc_debug("%s: Sense data (%d B):\n",
 			  dev->zbd_filename, cmd.io_hdr.sb_len_wr);
 		zbc_sg_print_bytes(dev, cmd.sense_buf, cmd.io_hdr.sb_len_wr);
@@ -1037,6 +1037,227 @@ static int zbc_ata_zone_op(struct zbc_device *dev, uint64_t sector,
 	return ret;
 }
 
+/**
+ * Driver flags: result of the SG write interface support test.
+ */
+#define ZBC_ATA_SG_AIO_TESTED	0x40000000
+#define ZBC_ATA_SG_AIO		0x80000000
+
+/**
+ * Asynchronous request state.
+ */
+struct zbc_ata_aio {
+	struct zbc_sg_cmd	cmd;
+};
+
+/**
+ * Test if the device node supports queued commands. The SG write/read
+ * interface is available only on SG character device nodes.
+ */
+static bool zbc_ata_aio_supported(struct zbc_device *dev)
+{
+	struct stat st;
+
+	if (!(dev->zbd_drv_flags & ZBC_ATA_SG_AIO_TESTED)) {
+		dev->zbd_drv_flags |= ZBC_ATA_SG_AIO_TESTED;
+		if (fstat(dev->zbd_sg_fd, &st) == 0 &&
+		    S_ISCHR(st.st_mode))
+			dev->zbd_drv_flags |= ZBC_ATA_SG_AIO;
+	}
+
+	return dev->zbd_drv_flags & ZBC_ATA_SG_AIO;
+}
+
+/**
+ * Submit an asynchronous request. Requests are always issued as native
+ * ATA PASSTHROUGH commands, even when a functional SAT allows using
+ * SBC commands for synchronous reads and writes: this keeps request
+ * completion handling uniform.
+ */
+static int zbc_ata_aio_submit(struct zbc_device *dev, struct zbc_aio *aio)
+{
+	struct zbc_ata_aio *aaio;
+	uint64_t lba_offset = zbc_dev_sect2lba(dev, aio->aio_sector);
+	uint32_t lba_count;
+	unsigned int af;
+	size_t sz;
+	int ret;
+
+	if (!zbc_ata_aio_supported(dev)) {
+		zbc_error("%s: Asynchronous commands need an SG node\n",
+			  dev->zbd_filename);
+		return -ENXIO;
+	}
+
+	aaio = calloc(1, sizeof(struct zbc_ata_aio));
+	if (!aaio)
+		return -ENOMEM;
+
+	switch (aio->aio_op) {
+
+	case ZBC_AIO_PREAD:
+	case ZBC_AIO_PWRITE:
+
+		sz = zbc_iov_count(aio->aio_iov, aio->aio_iovcnt);
+		lba_count = zbc_dev_sect2lba(dev, sz);
+
+		if (sz > 65536) {
+			zbc_error("%s: I/O operation too large "
+				  "(limited to 65536 x 512 B sectors)\n",
+				  dev->zbd_filename);
+			ret = -EINVAL;
+			goto err;
+		}
+
+		ret = zbc_sg_vcmd_init(dev, &aaio->cmd, ZBC_SG_ATA16,
+				       aio->aio_biov, aio->aio_iovcnt);
+		if (ret != 0)
+			goto err;
+
+		aaio->cmd.cdb[0] = ZBC_SG_ATA16_CDB_OPCODE;
+		/* DMA protocol, ext=1 */
+		aaio->cmd.cdb[1] = (0x6 << 1) | 0x01;
+		if (aio->aio_op == ZBC_AIO_PREAD) {
+			/* t_dir=1 (from device), byt_blk=1, t_length=10 */
+			aaio->cmd.io_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+			aaio->cmd.cdb[2] = 0x0e;
+			aaio->cmd.cdb[14] = ZBC_ATA_READ_DMA_EXT;
+		} else {
+			/* t_type=1, t_dir=0 (to device), byt_blk=1, t_length=10 */
+			aaio->cmd.io_hdr.dxfer_direction = SG_DXFER_TO_DEV;
+			aaio->cmd.cdb[2] = 0x06;
+			aaio->cmd.cdb[14] = ZBC_ATA_WRITE_DMA_EXT;
+		}
+		aaio->cmd.cdb[5] = (lba_count >> 8) & 0xff;
+		aaio->cmd.cdb[6] = lba_count & 0xff;
+		aaio->cmd.cdb[7] = (lba_offset >> 24) & 0xff;
+		aaio->cmd.cdb[8] = lba_offset & 0xff;
+		aaio->cmd.cdb[9] = (lba_offset >> 32) & 0xff;
+		aaio->cmd.cdb[10] = (lba_offset >> 8) & 0xff;
+		aaio->cmd.cdb[11] = (lba_offset >> 40) & 0xff;
+		aaio->cmd.cdb[12] = (lba_offset >> 16) & 0xff;
+		aaio->cmd.cdb[13] = 1 << 6;
+		break;
+
+	case ZBC_AIO_ZONE_OP:
+
+		switch (aio->aio_zone_op) {
+		case ZBC_OP_OPEN_ZONE:
+			af = ZBC_ATA_OPEN_ZONE_EXT_AF;
+			break;
+		case ZBC_OP_CLOSE_ZONE:
+			af = ZBC_ATA_CLOSE_ZONE_EXT_AF;
+			break;
+		case ZBC_OP_FINISH_ZONE:
+			af = ZBC_ATA_FINISH_ZONE_EXT_AF;
+			break;
+		case ZBC_OP_RESET_ZONE:
+			af = ZBC_ATA_RESET_WRITE_POINTER_EXT_AF;
+			break;
+		default:
+			zbc_error("%s: Invalid operation code 0x%x\n",
+				  dev->zbd_filename, aio->aio_zone_op);
+			ret = -EINVAL;
+			goto err;
+		}
+
+		ret = zbc_sg_cmd_init(dev, &aaio->cmd, ZBC_SG_ATA16, NULL, 0);
+		if (ret != 0)
+			goto err;
+
+		aaio->cmd.io_hdr.dxfer_direction = SG_DXFER_NONE;
+		aaio->cmd.cdb[0] = ZBC_SG_ATA16_CDB_OPCODE;
+		/* Non-Data protocol, ext=1 */
+		aaio->cmd.cdb[1] = (0x3 << 1) | 0x01;
+		aaio->cmd.cdb[4] = af;
+		if (aio->aio_flags & ZBC_OP_ALL_ZONES) {
+			/* Operate on all zones */
+			aaio->cmd.cdb[3] = 0x01;
+		} else {
+			/* Operate on the zone at lba */
+			aaio->cmd.cdb[8] = lba_offset & 0xff;
+			aaio->cmd.cdb[10] = (lba_offset >> 8) & 0xff;
+			aaio->cmd.cdb[12] = (lba_offset >> 16) & 0xff;
+			aaio->cmd.cdb[7] = (lba_offset >> 24) & 0xff;
+			aaio->cmd.cdb[9] = (lba_offset >> 32) & 0xff;
+			aaio->cmd.cdb[11] = (lba_offset >> 40) & 0xff;
+		}
+		aaio->cmd.cdb[13] = 1 << 6;
+		aaio->cmd.cdb[14] = ZBC_ATA_ZAC_MANAGEMENT_OUT;
+		break;
+
+	default:
+
+		zbc_error("%s: Invalid asynchronous operation 0x%x\n",
+			  dev->zbd_filename, aio->aio_op);
+		ret = -EINVAL;
+		goto err;
+
+	}
+
+	/* Queue the command */
+	aio->aio_private = aaio;
+	aaio->cmd.io_hdr.usr_ptr = aio;
+	ret = zbc_sg_cmd_submit(dev, &aaio->cmd);
+	if (ret != 0) {
+		zbc_sg_cmd_destroy(&aaio->cmd);
+		aio->aio_private = NULL;
+		goto err;
+	}
+
+	return 0;
+
+err:
+	free(aaio);
+
+	return ret;
+}
+
+/**
+ * Wait for an asynchronous request completion.
+ */
+static int zbc_ata_aio_wait(struct zbc_device *dev, struct zbc_aio **paio)
+{
+	struct zbc_ata_aio *aaio;
+	struct zbc_aio *aio;
+	sg_io_hdr_t io_hdr;
+	int ret;
+
+	ret = zbc_sg_cmd_reap(dev, &io_hdr);
+	if (ret != 0)
+		return ret;
+
+	aio = io_hdr.usr_ptr;
+	if (!aio || !aio->aio_private) {
+		zbc_error("%s: Unexpected command completion\n",
+			  dev->zbd_filename);
+		return -EIO;
+	}
+	aaio = aio->aio_private;
+
+	/* The driver returns an updated copy of the command header */
+	aaio->cmd.io_hdr = io_hdr;
+
+	ret = zbc_sg_cmd_check(dev, &aaio->cmd);
+	if (ret != 0) {
+		zbc_ata_get_sense_data(dev, &aaio->cmd, ret);
+		aio->aio_result = ret;
+	} else if (aio->aio_op == ZBC_AIO_ZONE_OP) {
+		aio->aio_result = 0;
+	} else {
+		aio->aio_result = aaio->cmd.bufsz >> 9;
+	}
+
+	/* Cleanup */
+	zbc_sg_cmd_destroy(&aaio->cmd);
+	aio->aio_private = NULL;
+	free(aaio);
+
+	*paio = aio;
+
+	return 0;
+}
+
 /**
  * Test device signature (return device model detected).
  */
@@ -1466,5 +1687,7 @@ struct zbc_drv zbc_ata_drv =
 	.zbd_flush		= zbc_ata_flush,
 	.zbd_report_zones	= zbc_ata_report_zones,
 	.zbd_zone_op		= zbc_ata_zone_op,
+	.zbd_aio_submit		= zbc_ata_aio_submit,
+	.zbd_aio_wait		= zbc_ata_aio_wait,
 };
 
@@ -34,6 +34,13 @@
 #include <linux/blkzoned.h>
 #endif
 
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 /**
  * Block device descriptor data.
  */
@@ -49,6 +56,18 @@ struct zbc_block_device {
 	char			*part_name;
 	unsigned long long	part_offset;
 
+	struct zbc_block_ring	*ring;
+
+	/*
+	 * Persistent BLKREPORTZONE buffer, allocated on the first
+	 * report and reused by subsequent reports so that repeated
+	 * zone reporting does not allocate at steady state. As with
+	 * command execution, report calls on the same handle are not
+	 * serialized by the library.
+	 */
+	void			*rep_buf;
+	size_t			rep_buf_size;
+
 };
 
 /*
@@ -479,6 +498,332 @@ static int zbc_block_get_info(struct zbc_device *dev, struct stat *st)
 	return 0;
 }
 
+#ifdef HAVE_LINUX_IO_URING_H
+
+/**
+ * Default io_uring submission queue depth.
+ */
+#define ZBC_BLOCK_URING_QD	64
+
+/**
+ * io_uring context of a block device opened with ZBC_O_ASYNC.
+ */
+struct zbc_block_ring {
+
+	int			ring_fd;
+	bool			fixed_file;
+
+	unsigned int		sq_entries;
+	unsigned int		inflight;
+
+	void			*sq_ring;
+	size_t			sq_ring_size;
+	unsigned int		*sq_head;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_array;
+
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_size;
+
+	void			*cq_ring;
+	size_t			cq_ring_size;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_cqe	*cqes;
+
+};
+
+/**
+ * Unmap and free an io_uring context.
+ */
+static void zbc_block_ring_free(struct zbc_block_ring *ring)
+{
+	if (ring->sqes)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	close(ring->ring_fd);
+	free(ring);
+}
+
+/**
+ * Set up an io_uring context for a device opened with ZBC_O_ASYNC.
+ */
+static int zbc_block_ring_setup(struct zbc_device *dev)
+{
+	struct zbc_block_device *zbd = zbc_dev_to_block(dev);
+	struct zbc_block_ring *ring;
+	struct io_uring_params p;
+	int ret;
+
+	ring = calloc(1, sizeof(struct zbc_block_ring));
+	if (!ring)
+		return -ENOMEM;
+
+	memset(&p, 0, sizeof(struct io_uring_params));
+	ring->ring_fd = syscall(__NR_io_uring_setup, ZBC_BLOCK_URING_QD, &p);
+	if (ring->ring_fd < 0) {
+		ret = -errno;
+		zbc_error("%s: io_uring setup failed %d (%s)\n",
+			  dev->zbd_filename,
+			  errno, strerror(errno));
+		free(ring);
+		return ret;
+	}
+
+	ring->sq_entries = p.sq_entries;
+	ring->sq_ring_size = p.sq_off.array +
+		p.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = p.cq_off.cqes +
+		p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = ring->sq_ring_size;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size,
+			     PROT_READ | PROT_WRITE,
+			     MAP_SHARED | MAP_POPULATE,
+			     ring->ring_fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ring == MAP_FAILED) {
+		ring->sq_ring = NULL;
+		goto err;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cq_ring = ring->sq_ring;
+	} else {
+		ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+				     PROT_READ | PROT_WRITE,
+				     MAP_SHARED | MAP_POPULATE,
+				     ring->ring_fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ring == MAP_FAILED) {
+			ring->cq_ring = NULL;
+			goto err;
+		}
+	}
+
+	ring->sq_head = (unsigned int *)
+		((char *)ring->sq_ring + p.sq_off.head);
+	ring->sq_tail = (unsigned int *)
+		((char *)ring->sq_ring + p.sq_off.tail);
+	ring->sq_mask = (unsigned int *)
+		((char *)ring->sq_ring + p.sq_off.ring_mask);
+	ring->sq_array = (unsigned int *)
+		((char *)ring->sq_ring + p.sq_off.array);
+
+	ring->cq_head = (unsigned int *)
+		((char *)ring->cq_ring + p.cq_off.head);
+	ring->cq_tail = (unsigned int *)
+		((char *)ring->cq_ring + p.cq_off.tail);
+	ring->cq_mask = (unsigned int *)
+		((char *)ring->cq_ring + p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)
+		((char *)ring->cq_ring + p.cq_off.cqes);
+
+	ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_size,
+			  PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE,
+			  ring->ring_fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		goto err;
+	}
+
+	/*
+	 * Register the device file so that requests reference it through
+	 * a fixed index instead of taking a file reference per I/O.
+	 */
+	ret = syscall(__NR_io_uring_register, ring->ring_fd,
+		      IORING_REGISTER_FILES, &dev->zbd_fd, 1);
+	ring->fixed_file = (ret == 0);
+
+	zbd->ring = ring;
+
+	return 0;
+
+err:
+	zbc_error("%s: io_uring mmap failed\n",
+		  dev->zbd_filename);
+	zbc_block_ring_free(ring);
+
+	return -ENOMEM;
+}
+
+/**
+ * Tear down the io_uring context of a device.
+ */
+static void zbc_block_ring_destroy(struct zbc_block_device *zbd)
+{
+	if (!zbd->ring)
+		return;
+
+	zbc_block_ring_free(zbd->ring);
+	zbd->ring = NULL;
+}
+
+/**
+ * Submit an asynchronous read or write request through io_uring.
+ */
+static int zbc_block_aio_submit(struct zbc_device *dev, struct zbc_aio *aio)
+{
+	struct zbc_block_device *zbd = zbc_dev_to_block(dev);
+	struct zbc_block_ring *ring = zbd->ring;
+	struct io_uring_sqe *sqe;
+	unsigned int tail, idx;
+	int ret;
+
+	if (!ring) {
+		/*
+		 * Not an error: zbc_pread() and zbc_pwrite() routinely
+		 * probe this path before falling back to serial I/O.
+		 */
+		zbc_debug("%s: Device is not open with ZBC_O_ASYNC\n",
+			  dev->zbd_filename);
+		return -ENXIO;
+	}
+
+	if (aio->aio_op == ZBC_AIO_ZONE_OP) {
+		/* Ranged zone operations probe this path too */
+		zbc_debug("%s: Zone operations are not supported "
+			  "through io_uring\n",
+			  dev->zbd_filename);
+		return -ENOTSUP;
+	}
+
+	if (ring->inflight >= ring->sq_entries) {
+		zbc_error("%s: Submission queue full (%u requests)\n",
+			  dev->zbd_filename, ring->inflight);
+		return -EBUSY;
+	}
+
+	tail = *ring->sq_tail;
+	idx = tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+	sqe->opcode = (aio->aio_op == ZBC_AIO_PWRITE) ?
+		IORING_OP_WRITEV : IORING_OP_READV;
+	if (ring->fixed_file) {
+		sqe->fd = 0;
+		sqe->flags = IOSQE_FIXED_FILE;
+	} else {
+		sqe->fd = dev->zbd_fd;
+	}
+	sqe->addr = (__u64)(uintptr_t)aio->aio_biov;
+	sqe->len = aio->aio_iovcnt;
+	sqe->off = aio->aio_sector << 9;
+	sqe->user_data = (__u64)(uintptr_t)aio;
+
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	ret = syscall(__NR_io_uring_enter, ring->ring_fd, 1, 0, 0, NULL, 0);
+	if (ret < 0) {
+		ret = -errno;
+		zbc_error("%s: io_uring submit failed %d (%s)\n",
+			  dev->zbd_filename,
+			  errno, strerror(errno));
+		return ret;
+	}
+
+	ring->inflight++;
+
+	return 0;
+}
+
+/**
+ * Wait for the completion of an asynchronous request.
+ */
+static int zbc_block_aio_wait(struct zbc_device *dev, struct zbc_aio **paio)
+{
+	struct zbc_block_device *zbd = zbc_dev_to_block(dev);
+	struct zbc_block_ring *ring = zbd->ring;
+	struct io_uring_cqe *cqe;
+	struct zbc_aio *aio;
+	unsigned int head;
+	ssize_t res;
+	int ret;
+
+	if (!ring) {
+		zbc_error("%s: Device is not open with ZBC_O_ASYNC\n",
+			  dev->zbd_filename);
+		return -ENXIO;
+	}
+
+	if (!ring->inflight) {
+		zbc_error("%s: No request in flight\n",
+			  dev->zbd_filename);
+		return -EINVAL;
+	}
+
+	head = *ring->cq_head;
+	while (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		ret = syscall(__NR_io_uring_enter, ring->ring_fd,
+			      0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR) {
+			ret = -errno;
+			zbc_error("%s: io_uring wait failed %d (%s)\n",
+				  dev->zbd_filename,
+				  errno, strerror(errno));
+			return ret;
+		}
+	}
+
+	cqe = &ring->cqes[head & *ring->cq_mask];
+	aio = (struct zbc_aio *)(uintptr_t)cqe->user_data;
+	res = cqe->res;
+
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	ring->inflight--;
+
+	if (!aio) {
+		zbc_error("%s: Unexpected request completion\n",
+			  dev->zbd_filename);
+		return -EIO;
+	}
+
+	if (res < 0)
+		aio->aio_result = res;
+	else
+		aio->aio_result = res >> 9;
+
+	*paio = aio;
+
+	return 0;
+}
+
+#else /* HAVE_LINUX_IO_URING_H */
+
+static int zbc_block_ring_setup(struct zbc_device *dev)
+{
+	zbc_error("%s: libzbc compiled without io_uring support\n",
+		  dev->zbd_filename);
+	return -ENOTSUP;
+}
+
+static void zbc_block_ring_destroy(struct zbc_block_device *zbd)
+{
+}
+
+static int zbc_block_aio_submit(struct zbc_device *dev, struct zbc_aio *aio)
+{
+	return -ENOTSUP;
+}
+
+static int zbc_block_aio_wait(struct zbc_device *dev, struct zbc_aio **paio)
+{
+	return -ENOTSUP;
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
 /**
  * Open a block device.
  */
@@ -538,6 +883,13 @@ static int zbc_block_open(const char *filename, int flags,
 	if (ret != 0)
 		goto out_free_filename;
 
+	/* Set up asynchronous request execution if requested */
+	if (flags & ZBC_O_ASYNC) {
+		ret = zbc_block_ring_setup(dev);
+		if (ret != 0)
+			goto out_free_filename;
+	}
+
 	*pdev = dev;
 
 	zbc_debug("%s: ########## BLOCK driver succeeded ##########\n",
@@ -572,6 +924,8 @@ static int zbc_block_close(struct zbc_device *dev)
 	struct zbc_block_device *zbd = zbc_dev_to_block(dev);
 	int ret = 0;
 
+	zbc_block_ring_destroy(zbd);
+
 	/* Close device */
 	if (close(dev->zbd_fd) < 0)
 		ret = -errno;
@@ -579,6 +933,7 @@ static int zbc_block_close(struct zbc_device *dev)
 	if (ret == 0) {
 		if (zbd->is_part)
 			close(dev->zbd_sg_fd);
+		free(zbd->rep_buf);
 		free(zbd->holder_name);
 		free(dev->zbd_filename);
 		free(zbd);
@@ -634,27 +989,62 @@ static bool zbc_block_must_report(struct zbc_zone *zone, uint64_t start_sector,
 /**
  * Get the block device zone information.
  */
+/**
+ * Convert a block of kernel zone descriptors to zone information
+ * entries. Both layouts describe zones in 512B sector units, so the
+ * conversion is a tight per-field batch copy.
+ */
+static void zbc_block_convert_zones(struct zbc_zone *zones,
+				    struct blk_zone *blkz, unsigned int nrz)
+{
+	struct zbc_zone *zone = zones;
+	unsigned int i;
+
+	for (i = 0; i < nrz; i++, zone++, blkz++) {
+		zone->zbz_length = blkz->len;
+		zone->zbz_start = blkz->start;
+		zone->zbz_write_pointer = blkz->wp;
+		zone->zbz_type = blkz->type;
+		zone->zbz_condition = blkz->cond;
+		zone->zbz_attributes = 0;
+		if (blkz->reset)
+			zone->zbz_attributes |= ZBC_ZA_RWP_RECOMMENDED;
+		if (blkz->non_seq)
+			zone->zbz_attributes |= ZBC_ZA_NON_SEQ;
+		memset(zone->__pad, 0, sizeof(zone->__pad));
+	}
+}
+
 static int zbc_block_report_zones(struct zbc_device *dev, uint64_t start_sector,
 				  enum zbc_reporting_options ro,
 				  struct zbc_zone *zones,
 				  unsigned int *nr_zones)
 {
+	struct zbc_block_device *zbd = zbc_dev_to_block(dev);
 	size_t rep_size;
 	uint64_t sector = start_sector;
 	struct zbc_zone zone;
 	struct blk_zone_report *rep;
 	struct blk_zone *blkz;
-	unsigned int i, n = 0;
+	unsigned long long start;
+	unsigned int i, nrz, n = 0;
 	int ret;
 
+	/* Reuse the device report buffer, allocating it on first use */
 	rep_size = sizeof(struct blk_zone_report) +
 		sizeof(struct blk_zone) * ZBC_BLOCK_ZONE_REPORT_NR_ZONES;
-	rep = malloc(rep_size);
-	if (!rep) {
-		zbc_error("%s: No memory for report zones\n",
-			  dev->zbd_filename);
-		return -ENOMEM;
+	if (zbd->rep_buf_size < rep_size) {
+		rep = malloc(rep_size);
+		if (!rep) {
+			zbc_error("%s: No memory for report zones\n",
+				  dev->zbd_filename);
+			return -ENOMEM;
+		}
+		free(zbd->rep_buf);
+		zbd->rep_buf = rep;
+		zbd->rep_buf_size = rep_size;
 	}
+	rep = zbd->rep_buf;
 	blkz = (struct blk_zone *)(rep + 1);
 
 	while (((! *nr_zones) || (n < *nr_zones)) &&
@@ -665,6 +1055,7 @@ static int zbc_block_report_zones(struct zbc_device *dev, uint64_t start_sector,
 		rep->sector = sector;
 		rep->nr_zones = ZBC_BLOCK_ZONE_REPORT_NR_ZONES;
 
+		start = zbc_stats_start(dev);
 		ret = ioctl(dev->zbd_fd, BLKREPORTZONE, rep);
 		if (ret != 0) {
 			ret = -errno;
@@ -673,28 +1064,43 @@ static int zbc_block_report_zones(struct zbc_device *dev, uint64_t start_sector,
 				  (unsigned long long)sector,
 				  errno,
 				  strerror(errno));
-			goto out;
 		}
+		zbc_stats_account(dev, ZBC_STATS_REPORT_ZONES, start, ret);
+		if (ret != 0)
+			goto out;
 
 		if (!rep->nr_zones)
 			break;
 
+		if (zones && zbc_ro_mask(ro) == ZBC_RO_ALL) {
+
+			/*
+			 * Unfiltered report into a user array: convert
+			 * the entire batch directly in place.
+			 */
+			nrz = rep->nr_zones;
+			if (*nr_zones && nrz > *nr_zones - n)
+				nrz = *nr_zones - n;
+			zbc_block_convert_zones(&zones[n], blkz, nrz);
+
+			for (i = 0; i < nrz; i++) {
+				if (sector >= dev->zbd_info.zbd_sectors)
+					break;
+				sector = zones[n].zbz_start +
+					zones[n].zbz_length;
+				n++;
+			}
+
+			continue;
+		}
+
 		for (i = 0; i < rep->nr_zones; i++) {
 
 			if ((*nr_zones && (n >= *nr_zones)) ||
 			    (sector >= dev->zbd_info.zbd_sectors))
 				break;
 
-			memset(&zone, 0, sizeof(struct zbc_zone));
-			zone.zbz_type = blkz[i].type;
-			zone.zbz_condition = blkz[i].cond;
-			zone.zbz_length = blkz[i].len;
-			zone.zbz_start = blkz[i].start;
-			zone.zbz_write_pointer = blkz[i].wp;
-			if (blkz[i].reset)
-				zone.zbz_attributes |= ZBC_ZA_RWP_RECOMMENDED;
-			if (blkz[i].non_seq)
-				zone.zbz_attributes |= ZBC_ZA_NON_SEQ;
+			zbc_block_convert_zones(&zone, &blkz[i], 1);
 
 			if (zbc_block_must_report(&zone, start_sector, ro)) {
 				if (zones)
@@ -713,8 +1119,6 @@ static int zbc_block_report_zones(struct zbc_device *dev, uint64_t start_sector,
 	*nr_zones = n;
 
 out:
-	free(rep);
-
 	return ret;
 }
 
@@ -724,6 +1128,7 @@ out:
 static int zbc_block_reset_one(struct zbc_device *dev, uint64_t sector)
 {
 	struct blk_zone_range range;
+	unsigned long long start;
 	unsigned int nr_zones = 1;
 	struct zbc_zone zone;
 	int ret;
@@ -749,16 +1154,17 @@ static int zbc_block_reset_one(struct zbc_device *dev, uint64_t sector)
 	/* Reset zone */
 	range.sector = zbc_zone_start(&zone);
 	range.nr_sectors = zbc_zone_length(&zone);
+	start = zbc_stats_start(dev);
 	ret = ioctl(dev->zbd_fd, BLKRESETZONE, &range);
 	if (ret != 0) {
 		ret = -errno;
 		zbc_error("%s: ioctl BLKRESETZONE failed %d (%s)\n",
 			  dev->zbd_filename,
 			  errno, strerror(errno));
-		return ret;
 	}
+	zbc_stats_account(dev, ZBC_STATS_ZONE_OP, start, ret);
 
-	return 0;
+	return ret;
 }
 
 /**
@@ -771,6 +1177,7 @@ static int zbc_block_reset_all(struct zbc_device *dev)
 	struct blk_zone_range range;
 	uint64_t sector = 0, seq_sector;
 	uint64_t nr_seq_sectors;
+	unsigned long long start;
 	int ret;
 
 	zones = calloc(ZBC_BLOCK_ZONE_REPORT_NR_ZONES,
@@ -823,19 +1230,119 @@ static int zbc_block_reset_all(struct zbc_device *dev)
 			/* Reset zones */
 			range.sector = seq_sector;
 			range.nr_sectors = nr_seq_sectors;
+			start = zbc_stats_start(dev);
 			ret = ioctl(dev->zbd_fd, BLKRESETZONE, &range);
 			if (ret != 0) {
 				ret = -errno;
 				zbc_error("%s: ioctl BLKRESETZONE failed %d (%s)\n",
 					  dev->zbd_filename,
 					  errno, strerror(errno));
+			}
+			zbc_stats_account(dev, ZBC_STATS_ZONE_OP, start, ret);
+			if (ret != 0)
 				break;
+
+		}
+
+	}
+
+	free(zones);
+
+	return ret;
+}
+
+/**
+ * Execute an operation on a range of zones. Only zone reset is
+ * accelerated here, using one BLKRESETZONE ioctl per run of contiguous
+ * non-empty sequential zones; other operations fall back to the
+ * generic per-zone execution.
+ */
+static int zbc_block_zone_op_range(struct zbc_device *dev, uint64_t sector,
+				   unsigned int nr_zones, enum zbc_zone_op op,
+				   unsigned int flags)
+{
+	struct zbc_zone *zones;
+	struct blk_zone_range range;
+	unsigned int i, nz, remaining = nr_zones;
+	uint64_t seq_sector, nr_seq_sectors;
+	unsigned long long start;
+	bool need_reset;
+	int ret = 0;
+
+	if (op != ZBC_OP_RESET_ZONE)
+		return -EOPNOTSUPP;
+
+	zones = calloc(ZBC_BLOCK_ZONE_REPORT_NR_ZONES,
+		       sizeof(struct zbc_zone));
+	if (!zones) {
+		zbc_error("%s: No memory for report zones\n",
+			  dev->zbd_filename);
+		return -ENOMEM;
+	}
+
+	while (remaining) {
+
+		/* Get zone info */
+		nz = ZBC_BLOCK_ZONE_REPORT_NR_ZONES;
+		if (nz > remaining)
+			nz = remaining;
+		ret = zbc_block_report_zones(dev, sector, ZBC_RO_ALL,
+					     zones, &nz);
+		if (ret || !nz)
+			break;
+
+		i = 0;
+
+		while (i < nz) {
+
+			nr_seq_sectors = 0;
+
+			/* Merge contiguous zones needing a reset */
+			while (i < nz) {
+
+				sector = zones[i].zbz_start +
+					zones[i].zbz_length;
+
+				need_reset = !zbc_zone_conventional(&zones[i]) &&
+					!zbc_zone_empty(&zones[i]);
+				if (need_reset) {
+					if (!nr_seq_sectors)
+						seq_sector = zones[i].zbz_start;
+					nr_seq_sectors += zones[i].zbz_length;
+				}
+
+				i++;
+
+				if (!need_reset && nr_seq_sectors)
+					break;
+
+			}
+
+			if (!nr_seq_sectors)
+				continue;
+
+			/* Reset zones */
+			range.sector = seq_sector;
+			range.nr_sectors = nr_seq_sectors;
+			start = zbc_stats_start(dev);
+			ret = ioctl(dev->zbd_fd, BLKRESETZONE, &range);
+			if (ret != 0) {
+				ret = -errno;
+				zbc_error("%s: ioctl BLKRESETZONE failed %d (%s)\n",
+					  dev->zbd_filename,
+					  errno, strerror(errno));
 			}
+			zbc_stats_account(dev, ZBC_STATS_ZONE_OP, start, ret);
+			if (ret != 0)
+				goto out;
 
 		}
 
+		remaining -= nz;
+
 	}
 
+out:
 	free(zones);
 
 	return ret;
@@ -890,11 +1397,16 @@ static ssize_t zbc_block_preadv(struct zbc_device *dev,
 				const struct iovec *iov, int iovcnt,
 			        uint64_t offset)
 {
+	unsigned long long start;
 	ssize_t ret;
 
+	start = zbc_stats_start(dev);
 	ret = preadv(dev->zbd_fd, iov, iovcnt, offset << 9);
 	if (ret < 0)
-		return -errno;
+		ret = -errno;
+	zbc_stats_account(dev, ZBC_STATS_READ, start, ret < 0 ? ret : 0);
+	if (ret < 0)
+		return ret;
 
 	return ret >> 9;
 }
@@ -906,11 +1418,16 @@ static ssize_t zbc_block_pwritev(struct zbc_device *dev,
 				 const struct iovec *iov, int iovcnt,
 			         uint64_t offset)
 {
+	unsigned long long start;
 	ssize_t ret;
 
+	start = zbc_stats_start(dev);
 	ret = pwritev(dev->zbd_fd, iov, iovcnt, offset << 9);
 	if (ret < 0)
-		return -errno;
+		ret = -errno;
+	zbc_stats_account(dev, ZBC_STATS_WRITE, start, ret < 0 ? ret : 0);
+	if (ret < 0)
+		return ret;
 
 	return ret >> 9;
 }
@@ -920,7 +1437,35 @@ static ssize_t zbc_block_pwritev(struct zbc_device *dev,
  */
 static int zbc_block_flush(struct zbc_device *dev)
 {
-	return fsync(dev->zbd_fd);
+	unsigned long long start;
+	int ret;
+
+	start = zbc_stats_start(dev);
+	ret = fsync(dev->zbd_fd);
+	zbc_stats_account(dev, ZBC_STATS_FLUSH, start, ret);
+
+	return ret;
+}
+
+/**
+ * Flush a range of sectors of the device.
+ */
+static int zbc_block_flush_range(struct zbc_device *dev, uint64_t sector,
+				 uint64_t count)
+{
+	unsigned long long start;
+	int ret;
+
+	start = zbc_stats_start(dev);
+	ret = sync_file_range(dev->zbd_fd, sector << 9, count << 9,
+			      SYNC_FILE_RANGE_WAIT_BEFORE |
+			      SYNC_FILE_RANGE_WRITE |
+			      SYNC_FILE_RANGE_WAIT_AFTER);
+	if (ret < 0)
+		ret = -errno;
+	zbc_stats_account(dev, ZBC_STATS_FLUSH, start, ret);
+
+	return ret;
 }
 
 #else /* HAVE_LINUX_BLKZONED_H */
@@ -939,6 +1484,13 @@ static int zbc_block_zone_op(struct zbc_device *dev, uint64_t sector,
 	return -EOPNOTSUPP;
 }
 
+static int zbc_block_zone_op_range(struct zbc_device *dev, uint64_t sector,
+				   unsigned int nr_zones, enum zbc_zone_op op,
+				   unsigned int flags)
+{
+	return -EOPNOTSUPP;
+}
+
 static ssize_t zbc_block_preadv(struct zbc_device *dev,
 				const struct iovec *iov, int iovcnt,
 				uint64_t offset)
@@ -958,6 +1510,12 @@ static int zbc_block_flush(struct zbc_device *dev)
 	return -EOPNOTSUPP;
 }
 
+static int zbc_block_flush_range(struct zbc_device *dev, uint64_t sector,
+				 uint64_t count)
+{
+	return -EOPNOTSUPP;
+}
+
 #endif /* HAVE_LINUX_BLKZONED_H */
 
 /**
@@ -971,6 +1529,10 @@ struct zbc_drv zbc_block_drv =
 	.zbd_preadv		= zbc_block_preadv,
 	.zbd_pwritev		= zbc_block_pwritev,
 	.zbd_flush		= zbc_block_flush,
+	.zbd_flush_range	= zbc_block_flush_range,
 	.zbd_report_zones	= zbc_block_report_zones,
 	.zbd_zone_op		= zbc_block_zone_op,
+	.zbd_zone_op_range	= zbc_block_zone_op_range,
+	.zbd_aio_submit		= zbc_block_aio_submit,
+	.zbd_aio_wait		= zbc_block_aio_wait,
 };
@@ -27,6 +27,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <libgen.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -52,6 +53,16 @@
  */
 #define ZBC_FAKE_META_PATH_SIZE	512
 
+/**
+ * Version 2 metadata format: the zone array is not initialized when the
+ * metadata file is created. Zone descriptors are materialized lazily from
+ * the header zone configuration on first use, keeping the metadata file
+ * sparse and making initialization of huge emulated drives constant time.
+ * Version 1 files have a zero version field (formerly reserved space) and
+ * a fully initialized zone array, and are still opened.
+ */
+#define ZBC_FAKE_META_V2	2
+
 /**
  * Metadata header.
  */
@@ -87,7 +98,39 @@ struct zbc_fake_meta {
 	 */
 	uint32_t	zbd_nr_imp_open_zones;
 
-	uint8_t		reserved[40];
+	/**
+	 * Metadata format version (0 for version 1 files).
+	 */
+	uint32_t	zbd_version;
+
+	uint32_t	reserved1;
+
+	/**
+	 * Uniform zone size in 512B sectors (version 2 and above).
+	 */
+	uint64_t	zbd_zone_size;
+
+	uint8_t		reserved[24];
+
+};
+
+/**
+ * Shared lock protecting a device metadata, kept in a POSIX shared
+ * memory segment attached by every process using the device. Locking
+ * through a process shared mutex avoids the two flock() syscalls that
+ * used to surround every single operation.
+ */
+struct zbc_fake_shm {
+
+	/**
+	 * Process shared robust mutex.
+	 */
+	pthread_mutex_t	zbd_mutex;
+
+	/**
+	 * Set once the mutex is initialized.
+	 */
+	uint32_t	zbd_mutex_init;
 
 };
 
@@ -102,6 +145,8 @@ struct zbc_fake_device {
 	size_t			zbd_meta_size;
 	struct zbc_fake_meta	*zbd_meta;
 
+	struct zbc_fake_shm	*zbd_shm;
+
 	uint32_t		zbd_nr_zones;
 	struct zbc_zone		*zbd_zones;
 
@@ -117,6 +162,16 @@ static inline void zbc_fake_dev_meta_path(struct zbc_fake_device *fdev,
 		basename(fdev->dev.zbd_filename));
 }
 
+/**
+ * zbc_fake_dev_shm_name - Build shared lock segment name for a device.
+ */
+static inline void zbc_fake_dev_shm_name(struct zbc_fake_device *fdev,
+					 char *buf)
+{
+	sprintf(buf, "/zbc-%s.lock",
+		basename(fdev->dev.zbd_filename));
+}
+
 /**
  * zbc_fake_to_file_dev - Convert device address to fake device address.
  */
@@ -126,6 +181,46 @@ zbc_fake_to_file_dev(struct zbc_device *dev)
 	return container_of(dev, struct zbc_fake_device, dev);
 }
 
+/**
+ * zbc_fake_init_zone - Build the initial descriptor of a zone.
+ */
+static void zbc_fake_init_zone(struct zbc_fake_device *fdev,
+			       unsigned int i, struct zbc_zone *zone)
+{
+	struct zbc_fake_meta *meta = fdev->zbd_meta;
+
+	memset(zone, 0, sizeof(struct zbc_zone));
+	zone->zbz_start = (uint64_t)i * meta->zbd_zone_size;
+	zone->zbz_length = meta->zbd_zone_size;
+	if (i < meta->zbd_nr_conv_zones) {
+		zone->zbz_type = ZBC_ZT_CONVENTIONAL;
+		zone->zbz_condition = ZBC_ZC_NOT_WP;
+		zone->zbz_write_pointer = (uint64_t)-1;
+	} else {
+		zone->zbz_type = ZBC_ZT_SEQUENTIAL_REQ;
+		zone->zbz_condition = ZBC_ZC_EMPTY;
+		zone->zbz_write_pointer = zone->zbz_start;
+	}
+}
+
+/**
+ * zbc_fake_zone - Get a zone descriptor, materializing it on first use.
+ *
+ * With version 2 metadata, zone descriptors are all zero until first
+ * used (the zone array pages come from the sparse metadata file) and
+ * are recognized by their zero length.
+ */
+static struct zbc_zone *zbc_fake_zone(struct zbc_fake_device *fdev,
+				      unsigned int i)
+{
+	struct zbc_zone *zone = &fdev->zbd_zones[i];
+
+	if (fdev->zbd_meta->zbd_version && !zone->zbz_length)
+		zbc_fake_init_zone(fdev, i, zone);
+
+	return zone;
+}
+
 /**
  * zbc_fake_find_zone - Find a zone using its start LBA.
  */
@@ -133,25 +228,156 @@ static struct zbc_zone *zbc_fake_find_zone(struct zbc_fake_device *fdev,
 					   uint64_t sector,
 					   bool start)
 {
-	struct zbc_zone *zone;
-	unsigned int i;
+	struct zbc_zone *zones = fdev->zbd_zones, *zone;
+	unsigned int i, low, high;
+	uint64_t zone_sz;
 
-	if (!fdev->zbd_zones)
+	if (!zones)
 		return NULL;
 
-	for (i = 0; i < fdev->zbd_nr_zones; i++) {
-		zone = &fdev->zbd_zones[i];
-		if (start) {
-			if (zone->zbz_start == sector)
-				return zone;
-		} else {
+	/*
+	 * Version 2 metadata: zones all have the size recorded in the
+	 * header, so the target zone index is known directly. This must
+	 * not rely on the zone array contents as descriptors may not be
+	 * materialized yet.
+	 */
+	if (fdev->zbd_meta->zbd_version) {
+		i = sector / fdev->zbd_meta->zbd_zone_size;
+		if (i >= fdev->zbd_nr_zones)
+			return NULL;
+		zone = zbc_fake_zone(fdev, i);
+		goto found;
+	}
+
+	/*
+	 * Zones are sorted by start sector and in most cases all have
+	 * the same size: try a direct index first and fall back to a
+	 * binary search for non-uniform zone configurations.
+	 */
+	zone_sz = zones[0].zbz_length;
+	if (zone_sz) {
+		i = sector / zone_sz;
+		if (i < fdev->zbd_nr_zones) {
+			zone = &zones[i];
 			if (sector >= zone->zbz_start &&
 			    sector < zone->zbz_start + zone->zbz_length)
-				return zone;
+				goto found;
+		}
+	}
+
+	low = 0;
+	high = fdev->zbd_nr_zones;
+	while (low < high) {
+		i = low + (high - low) / 2;
+		zone = &zones[i];
+		if (sector < zone->zbz_start) {
+			high = i;
+		} else if (sector >= zone->zbz_start + zone->zbz_length) {
+			low = i + 1;
+		} else {
+			goto found;
 		}
 	}
 
 	return NULL;
+
+found:
+	if (start && zone->zbz_start != sector)
+		return NULL;
+
+	return zone;
+}
+
+/**
+ * zbc_fake_open_shm - Attach the shared lock of a device.
+ *
+ * The lock lives in a POSIX shared memory segment separate from the
+ * metadata file so that the on-disk metadata format is unchanged.
+ * If attaching fails, locking falls back to flock() on the device file.
+ */
+static void zbc_fake_open_shm(struct zbc_fake_device *fdev)
+{
+	char shm_name[ZBC_FAKE_META_PATH_SIZE];
+	pthread_mutexattr_t attr;
+	struct zbc_fake_shm *shm;
+	int fd;
+
+	if (fdev->zbd_shm)
+		return;
+
+	zbc_fake_dev_shm_name(fdev, shm_name);
+
+	/*
+	 * Serialize segment creation and mutex initialization against
+	 * other processes opening the same device using the device
+	 * file lock.
+	 */
+	if (flock(fdev->dev.zbd_fd, LOCK_EX) < 0) {
+		zbc_error("%s: lock device file failed %d (%s)\n",
+			  fdev->dev.zbd_filename,
+			  errno, strerror(errno));
+		return;
+	}
+
+	fd = shm_open(shm_name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		zbc_error("%s: open shared lock %s failed %d (%s)\n",
+			  fdev->dev.zbd_filename,
+			  shm_name,
+			  errno, strerror(errno));
+		goto unlock;
+	}
+
+	if (ftruncate(fd, sizeof(struct zbc_fake_shm)) < 0) {
+		zbc_error("%s: truncate shared lock %s failed %d (%s)\n",
+			  fdev->dev.zbd_filename,
+			  shm_name,
+			  errno, strerror(errno));
+		close(fd);
+		goto unlock;
+	}
+
+	shm = mmap(NULL, sizeof(struct zbc_fake_shm),
+		   PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED) {
+		zbc_error("%s: mmap shared lock %s failed\n",
+			  fdev->dev.zbd_filename,
+			  shm_name);
+		goto unlock;
+	}
+
+	if (!shm->zbd_mutex_init) {
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+		pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+		pthread_mutex_init(&shm->zbd_mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+		shm->zbd_mutex_init = 1;
+	}
+
+	fdev->zbd_shm = shm;
+
+unlock:
+	if (flock(fdev->dev.zbd_fd, LOCK_UN) < 0)
+		zbc_error("%s: unlock device file failed %d (%s)\n",
+			  fdev->dev.zbd_filename,
+			  errno, strerror(errno));
+}
+
+/**
+ * zbc_fake_close_shm - Detach the shared lock of a device.
+ *
+ * The segment is never unlinked as other processes may still be
+ * using the device.
+ */
+static void zbc_fake_close_shm(struct zbc_fake_device *fdev)
+{
+	if (!fdev->zbd_shm)
+		return;
+
+	munmap(fdev->zbd_shm, sizeof(struct zbc_fake_shm));
+	fdev->zbd_shm = NULL;
 }
 
 /**
@@ -159,6 +385,27 @@ static struct zbc_zone *zbc_fake_find_zone(struct zbc_fake_device *fdev,
  */
 static inline void zbc_fake_lock(struct zbc_fake_device *fdev)
 {
+	int ret;
+
+	if (fdev->zbd_shm) {
+		ret = pthread_mutex_lock(&fdev->zbd_shm->zbd_mutex);
+		if (ret == EOWNERDEAD) {
+			/*
+			 * The lock holder died: the metadata may be
+			 * inconsistent, but make the mutex usable again.
+			 */
+			zbc_warning("%s: metadata lock holder died\n",
+				    fdev->dev.zbd_filename);
+			pthread_mutex_consistent(&fdev->zbd_shm->zbd_mutex);
+		} else if (ret) {
+			zbc_error("%s: lock metadata failed %d (%s)\n",
+				  fdev->dev.zbd_filename,
+				  ret, strerror(ret));
+		}
+		zbc_clear_errno();
+		return;
+	}
+
 	if (flock(fdev->dev.zbd_fd, LOCK_EX) < 0)
 		zbc_error("%s: lock metadata failed %d (%s)\n",
 			  fdev->dev.zbd_filename,
@@ -171,6 +418,17 @@ static inline void zbc_fake_lock(struct zbc_fake_device *fdev)
  */
 static inline void zbc_fake_unlock(struct zbc_fake_device *fdev)
 {
+	int ret;
+
+	if (fdev->zbd_shm) {
+		ret = pthread_mutex_unlock(&fdev->zbd_shm->zbd_mutex);
+		if (ret)
+			zbc_error("%s: unlock metadata failed %d (%s)\n",
+				  fdev->dev.zbd_filename,
+				  ret, strerror(ret));
+		return;
+	}
+
 	if (flock(fdev->dev.zbd_fd, LOCK_UN) < 0)
 		zbc_error("%s: unlock metadata failed %d (%s)\n",
 			  fdev->dev.zbd_filename,
@@ -182,6 +440,8 @@ static inline void zbc_fake_unlock(struct zbc_fake_device *fdev)
  */
 static void zbc_fake_close_metadata(struct zbc_fake_device *fdev)
 {
+	zbc_fake_close_shm(fdev);
+
 	if (fdev->zbd_meta_fd < 0)
 		return;
 
@@ -274,16 +534,43 @@ static int zbc_fake_open_metadata(struct zbc_fake_device *fdev,
 		goto out;
 	}
 
-	zbc_debug("%s: %llu sectors of %zuB, %u zones\n",
+	if (meta->zbd_version &&
+	    (meta->zbd_version != ZBC_FAKE_META_V2 || !meta->zbd_zone_size)) {
+		zbc_debug("%s: unknown metadata version %u in file %s\n",
+			  fdev->dev.zbd_filename,
+			  meta->zbd_version,
+			  meta_path);
+		zbc_fake_close_metadata(fdev);
+		ret = setzones ? 0 : -ENXIO;
+		goto out;
+	}
+
+	/*
+	 * Version 1 metadata: every operation walks the fully initialized
+	 * zone array, so ask for the entire mapping to be read in. For
+	 * sparse version 2 metadata, only the header is needed up front.
+	 */
+	if (meta->zbd_version)
+		madvise(fdev->zbd_meta, sizeof(struct zbc_fake_meta),
+			MADV_WILLNEED);
+	else
+		madvise(fdev->zbd_meta, fdev->zbd_meta_size, MADV_WILLNEED);
+
+	zbc_debug("%s: %llu sectors of %zuB, %u zones (metadata v%u)\n",
 		  fdev->dev.zbd_filename,
 		  (unsigned long long)dev_info->zbd_lblocks,
 		  (size_t)dev_info->zbd_lblock_size,
-		  meta->zbd_nr_zones);
+		  meta->zbd_nr_zones,
+		  meta->zbd_version ? meta->zbd_version : 1);
 
 	fdev->zbd_nr_zones = meta->zbd_nr_zones;
 	fdev->zbd_zones = (struct zbc_zone *)(meta + 1);
 	if (dev_info->zbd_max_nr_open_seq_req > meta->zbd_nr_seq_zones)
 		dev_info->zbd_max_nr_open_seq_req = meta->zbd_nr_seq_zones - 1;
+
+	/* Attach the shared metadata lock */
+	zbc_fake_open_shm(fdev);
+
 	ret = 0;
 
 out:
@@ -591,10 +878,22 @@ static int zbc_fake_report_zones(struct zbc_device *dev, uint64_t sector,
 
 	/* Get matching zones */
 	for (in = 0; in < fdev->zbd_nr_zones; in++) {
-		if (zbc_fake_must_report_zone(&fdev->zbd_zones[in],
-					      sector, options)) {
+		struct zbc_zone *zone = &fdev->zbd_zones[in];
+		struct zbc_zone z;
+
+		/*
+		 * Reporting an unmaterialized zone builds the descriptor
+		 * on the stack instead of in the zone array, so that a
+		 * full report does not populate the sparse metadata file.
+		 */
+		if (fdev->zbd_meta->zbd_version && !zone->zbz_length) {
+			zbc_fake_init_zone(fdev, in, &z);
+			zone = &z;
+		}
+
+		if (zbc_fake_must_report_zone(zone, sector, options)) {
 			if (zones && (out < max_nr_zones))
-				memcpy(&zones[out], &fdev->zbd_zones[in],
+				memcpy(&zones[out], zone,
 				       sizeof(struct zbc_zone));
 			out++;
 		}
@@ -1277,6 +1576,40 @@ static int zbc_fake_flush(struct zbc_device *dev)
 	return ret;
 }
 
+/**
+ * zbc_fake_flush_range - Flush a range of sectors of the emulated device.
+ */
+static int zbc_fake_flush_range(struct zbc_device *dev, uint64_t sector,
+				uint64_t count)
+{
+	struct zbc_fake_device *fdev = zbc_fake_to_file_dev(dev);
+	int ret;
+
+	if (!fdev->zbd_meta) {
+		zbc_set_errno(ZBC_SK_NOT_READY, ZBC_ASC_FORMAT_IN_PROGRESS);
+		return -ENXIO;
+	}
+
+	zbc_fake_lock(fdev);
+
+	/*
+	 * Metadata is small: always sync it all to keep the write
+	 * pointers of the flushed zones consistent.
+	 */
+	ret = msync(fdev->zbd_meta, fdev->zbd_meta_size, MS_SYNC);
+	if (ret == 0)
+		ret = sync_file_range(dev->zbd_fd, sector << 9, count << 9,
+				      SYNC_FILE_RANGE_WAIT_BEFORE |
+				      SYNC_FILE_RANGE_WRITE |
+				      SYNC_FILE_RANGE_WAIT_AFTER);
+	if (ret < 0)
+		ret = -errno;
+
+	zbc_fake_unlock(fdev);
+
+	return ret;
+}
+
 /**
  * zbc_fake_set_zones - Initialize an emulated device metadata.
  */
@@ -1284,12 +1617,10 @@ static int zbc_fake_set_zones(struct zbc_device *dev,
 			      uint64_t conv_sz, uint64_t zone_sz)
 {
 	struct zbc_fake_device *fdev = zbc_fake_to_file_dev(dev);
-	uint64_t sector = 0, device_size = dev->zbd_info.zbd_sectors;
+	uint64_t device_size = dev->zbd_info.zbd_sectors;
 	uint64_t capacity_bytes;
 	struct zbc_fake_meta fmeta;
 	char meta_path[ZBC_FAKE_META_PATH_SIZE];
-	struct zbc_zone *zone;
-	unsigned int z = 0;
 	int ret;
 
 	/* Initialize metadata */
@@ -1321,6 +1652,9 @@ static int zbc_fake_set_zones(struct zbc_device *dev,
 	fmeta.zbd_nr_zones = fmeta.zbd_nr_conv_zones + fmeta.zbd_nr_seq_zones;
 	fdev->zbd_nr_zones = fmeta.zbd_nr_zones;
 
+	fmeta.zbd_version = ZBC_FAKE_META_V2;
+	fmeta.zbd_zone_size = zone_sz;
+
 	dev->zbd_info.zbd_sectors = fdev->zbd_nr_zones * zone_sz;
 	capacity_bytes = dev->zbd_info.zbd_sectors << 9;
 
@@ -1343,10 +1677,16 @@ static int zbc_fake_set_zones(struct zbc_device *dev,
 		return ret;
 	}
 
-	/* Truncate metadata file */
+	/*
+	 * Truncate metadata file: dropping the size to zero first discards
+	 * the content of any previous metadata, so that the zone array of
+	 * the new file reads back as zeros and the file stays sparse until
+	 * zones are actually used.
+	 */
 	fdev->zbd_meta_size = sizeof(struct zbc_fake_meta) +
 		(fdev->zbd_nr_zones * sizeof(struct zbc_zone));
-	if (ftruncate(fdev->zbd_meta_fd, fdev->zbd_meta_size) < 0) {
+	if (ftruncate(fdev->zbd_meta_fd, 0) < 0 ||
+	    ftruncate(fdev->zbd_meta_fd, fdev->zbd_meta_size) < 0) {
 		ret = -errno;
 		zbc_error("%s: truncate meta file %s to %zu B failed %d (%s)\n",
 			  fdev->dev.zbd_filename,
@@ -1371,50 +1711,59 @@ static int zbc_fake_set_zones(struct zbc_device *dev,
 
 	fdev->zbd_zones = (struct zbc_zone *) (fdev->zbd_meta + 1);
 
-	/* Setup metadata header */
-	memcpy(fdev->zbd_meta, &fmeta, sizeof(struct zbc_fake_meta));
+	/*
+	 * Setup metadata header. Zone descriptors are not written out:
+	 * they are materialized lazily from the header zone configuration
+	 * the first time each zone is used. Make sure the header blocks
+	 * are allocated so that updating them cannot hit ENOSPC later.
+	 */
+	if (fallocate(fdev->zbd_meta_fd, 0, 0,
+		      sizeof(struct zbc_fake_meta)) < 0)
+		zbc_debug("%s: fallocate metadata file %s header failed %d (%s)\n",
+			  fdev->dev.zbd_filename,
+			  meta_path,
+			  errno, strerror(errno));
 
-	/* Setup conventional zones descriptors */
-	for (z = 0; z < fmeta.zbd_nr_conv_zones; z++) {
+	memcpy(fdev->zbd_meta, &fmeta, sizeof(struct zbc_fake_meta));
 
-		zone = &fdev->zbd_zones[z];
+	/* Attach the shared metadata lock */
+	zbc_fake_open_shm(fdev);
 
-		zone->zbz_type = ZBC_ZT_CONVENTIONAL;
-		zone->zbz_condition = ZBC_ZC_NOT_WP;
-		zone->zbz_start = sector;
-		zone->zbz_write_pointer = (uint64_t)-1;
-		zone->zbz_length = zone_sz;
+	ret = 0;
 
-		memset(&zone->__pad, 0, sizeof(zone->__pad));
+out:
+	if (ret != 0)
+		zbc_fake_close_metadata(fdev);
 
-		sector += zone_sz;
+	return ret;
+}
 
-	}
+/**
+ * Set the write pointer of a zone and adjust the zone condition
+ * accordingly. The caller must hold the device metadata lock.
+ */
+static void zbc_fake_zone_set_wp(struct zbc_fake_device *fdev,
+				 struct zbc_zone *zone, uint64_t wp_sector)
+{
 
-	/* Setup sequential zones descriptors */
-	for (; z < fdev->zbd_nr_zones; z++) {
+	/* Do nothing for conventional zones */
+	if (!zbc_zone_sequential_req(zone))
+		return;
 
-		zone = &fdev->zbd_zones[z];
+	if (zbc_zone_is_open(zone))
+		zbc_zone_do_close(fdev, zone);
 
-		zone->zbz_type = ZBC_ZT_SEQUENTIAL_REQ;
+	zone->zbz_write_pointer = wp_sector;
+	if (zone->zbz_write_pointer == zone->zbz_start) {
 		zone->zbz_condition = ZBC_ZC_EMPTY;
-		zone->zbz_start = sector;
-		zone->zbz_write_pointer = zone->zbz_start;
-		zone->zbz_length = zone_sz;
-
-		memset(&zone->__pad, 0, sizeof(zone->__pad));
-
-		sector += zone_sz;
-
+	} else if (zone->zbz_write_pointer > zone->zbz_start &&
+		   zone->zbz_write_pointer <
+		   zone->zbz_start + zone->zbz_length) {
+		zone->zbz_condition = ZBC_ZC_CLOSED;
+	} else {
+		zone->zbz_condition = ZBC_ZC_FULL;
+		zone->zbz_write_pointer = (uint64_t)-1;
 	}
-
-	ret = 0;
-
-out:
-	if (ret != 0)
-		zbc_fake_close_metadata(fdev);
-
-	return ret;
 }
 
 /**
@@ -1438,34 +1787,115 @@ static int zbc_fake_set_write_pointer(struct zbc_device *dev,
 	if (!zone)
 		goto out;
 
-	/* Do nothing for conventional zones */
-	if (zbc_zone_sequential_req(zone)) {
+	zbc_fake_zone_set_wp(fdev, zone, wp_sector);
+	ret = 0;
 
-		if (zbc_zone_is_open(zone))
-			zbc_zone_do_close(fdev, zone);
+out:
+	zbc_fake_unlock(fdev);
 
-		zone->zbz_write_pointer = wp_sector;
-		if (zone->zbz_write_pointer == zone->zbz_start) {
-			zone->zbz_condition = ZBC_ZC_EMPTY;
-		} else if (zone->zbz_write_pointer > zone->zbz_start &&
-			   zone->zbz_write_pointer <
-			   zone->zbz_start + zone->zbz_length) {
-			zone->zbz_condition = ZBC_ZC_CLOSED;
-		} else {
-			zone->zbz_condition = ZBC_ZC_FULL;
-			zone->zbz_write_pointer = (uint64_t)-1;
-		}
+	return ret;
+}
 
+/**
+ * zbc_fake_set_write_pointers - Change several zone write pointers.
+ *
+ * All the updates are applied under a single metadata lock acquisition,
+ * avoiding one lock round trip per zone when restoring the state of a
+ * device with many zones.
+ */
+static int zbc_fake_set_write_pointers(struct zbc_device *dev,
+				       const struct zbc_wp *wps,
+				       unsigned int nr_wps)
+{
+	struct zbc_fake_device *fdev = zbc_fake_to_file_dev(dev);
+	struct zbc_zone *zone;
+	unsigned int i;
+	int ret = 0;
+
+	if (!fdev->zbd_meta) {
+		zbc_set_errno(ZBC_SK_NOT_READY, ZBC_ASC_FORMAT_IN_PROGRESS);
+		return -ENXIO;
 	}
 
-	ret = 0;
+	zbc_fake_lock(fdev);
+
+	for (i = 0; i < nr_wps; i++) {
+		zone = zbc_fake_find_zone(fdev, wps[i].zbw_sector, true);
+		if (!zone) {
+			ret = -EIO;
+			break;
+		}
+		zbc_fake_zone_set_wp(fdev, zone, wps[i].zbw_wp_sector);
+	}
 
-out:
 	zbc_fake_unlock(fdev);
 
 	return ret;
 }
 
+/**
+ * zbc_fake_get_state - Get a snapshot of the device metadata.
+ */
+static ssize_t zbc_fake_get_state(struct zbc_device *dev, void *buf,
+				  size_t bufsz)
+{
+	struct zbc_fake_device *fdev = zbc_fake_to_file_dev(dev);
+	size_t size = fdev->zbd_meta_size;
+
+	if (!fdev->zbd_meta) {
+		zbc_set_errno(ZBC_SK_NOT_READY, ZBC_ASC_FORMAT_IN_PROGRESS);
+		return -ENXIO;
+	}
+
+	/* Size query */
+	if (!buf)
+		return size;
+
+	if (bufsz < size)
+		return -EINVAL;
+
+	zbc_fake_lock(fdev);
+	memcpy(buf, fdev->zbd_meta, size);
+	zbc_fake_unlock(fdev);
+
+	return size;
+}
+
+/**
+ * zbc_fake_set_state - Restore a snapshot of the device metadata.
+ */
+static int zbc_fake_set_state(struct zbc_device *dev, const void *buf,
+			      size_t bufsz)
+{
+	struct zbc_fake_device *fdev = zbc_fake_to_file_dev(dev);
+	const struct zbc_fake_meta *meta = buf;
+
+	if (!fdev->zbd_meta) {
+		zbc_set_errno(ZBC_SK_NOT_READY, ZBC_ASC_FORMAT_IN_PROGRESS);
+		return -ENXIO;
+	}
+
+	if (bufsz != fdev->zbd_meta_size)
+		return -EINVAL;
+
+	/* The snapshot must match the device zone configuration */
+	if (meta->zbd_capacity != fdev->zbd_meta->zbd_capacity ||
+	    meta->zbd_nr_zones != fdev->zbd_meta->zbd_nr_zones ||
+	    meta->zbd_version != fdev->zbd_meta->zbd_version ||
+	    meta->zbd_zone_size != fdev->zbd_meta->zbd_zone_size) {
+		zbc_error("%s: State snapshot does not match the device "
+			  "zone configuration\n",
+			  dev->zbd_filename);
+		return -EINVAL;
+	}
+
+	zbc_fake_lock(fdev);
+	memcpy(fdev->zbd_meta, buf, bufsz);
+	zbc_fake_unlock(fdev);
+
+	return 0;
+}
+
 /**
  * Fake backend driver definition.
  */
@@ -1476,8 +1906,12 @@ struct zbc_drv zbc_fake_drv = {
 	.zbd_preadv		= zbc_fake_preadv,
 	.zbd_pwritev		= zbc_fake_pwritev,
 	.zbd_flush		= zbc_fake_flush,
+	.zbd_flush_range	= zbc_fake_flush_range,
 	.zbd_report_zones	= zbc_fake_report_zones,
 	.zbd_zone_op		= zbc_fake_zone_op,
 	.zbd_set_zones		= zbc_fake_set_zones,
 	.zbd_set_wp		= zbc_fake_set_write_pointer,
+	.zbd_set_wps		= zbc_fake_set_write_pointers,
+	.zbd_get_state		= zbc_fake_get_state,
+	.zbd_set_state		= zbc_fake_set_state,
 };
@@ -0,0 +1,272 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see <http://opensource.org/licenses/BSD-2-Clause>.
+ */
+
+#include "zbc.h"
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/**
+ * Size of a single log message (longer messages are truncated) and
+ * number of messages of a per-thread log ring. Both must be powers
+ * of two.
+ */
+#define ZBC_LOG_MSG_SIZE	256
+#define ZBC_LOG_RING_SIZE	256
+
+/**
+ * A formatted log message waiting to be written out by the flusher.
+ */
+struct zbc_log_msg {
+	FILE			*stream;
+	char			buf[ZBC_LOG_MSG_SIZE];
+};
+
+/**
+ * Per-thread log message ring. The owning thread is the only producer
+ * and the flusher thread the only consumer, so the ring is operated
+ * without locks: the producer publishes messages with a release store
+ * of the head index and the consumer retires them with a release store
+ * of the tail index.
+ */
+struct zbc_log_ring {
+	struct zbc_log_ring	*next;
+	int			dead;
+	unsigned int		head;
+	unsigned int		tail;
+	unsigned long long	dropped;
+	struct zbc_log_msg	msgs[ZBC_LOG_RING_SIZE];
+};
+
+/**
+ * Deferred logging state. The ring list mutation and the flusher
+ * thread start/stop are serialized with the lock; message production
+ * never takes it.
+ */
+static pthread_mutex_t zbc_log_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct zbc_log_ring *zbc_log_rings;
+static bool zbc_log_deferred;
+static bool zbc_log_flusher_stop;
+static pthread_t zbc_log_flusher;
+static pthread_key_t zbc_log_key;
+static pthread_once_t zbc_log_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Per-thread ring cache.
+ */
+static __thread struct zbc_log_ring *zbc_log_ring;
+
+/**
+ * Thread exit: mark the thread ring dead. The flusher frees the ring
+ * once its remaining messages are written out.
+ */
+static void zbc_log_thread_exit(void *arg)
+{
+	struct zbc_log_ring *ring = arg;
+
+	__atomic_store_n(&ring->dead, 1, __ATOMIC_RELEASE);
+}
+
+static void zbc_log_key_create(void)
+{
+	pthread_key_create(&zbc_log_key, zbc_log_thread_exit);
+}
+
+/**
+ * Get the log ring of the current thread, allocating and registering
+ * it on first use.
+ */
+static struct zbc_log_ring *zbc_log_get_ring(void)
+{
+	struct zbc_log_ring *ring = zbc_log_ring;
+
+	if (ring)
+		return ring;
+
+	ring = calloc(1, sizeof(struct zbc_log_ring));
+	if (!ring)
+		return NULL;
+
+	pthread_once(&zbc_log_key_once, zbc_log_key_create);
+	pthread_setspecific(zbc_log_key, ring);
+	zbc_log_ring = ring;
+
+	pthread_mutex_lock(&zbc_log_lock);
+	ring->next = zbc_log_rings;
+	zbc_log_rings = ring;
+	pthread_mutex_unlock(&zbc_log_lock);
+
+	return ring;
+}
+
+/**
+ * Write out the messages of a ring. Returns true if the ring is empty.
+ */
+static bool zbc_log_drain_ring(struct zbc_log_ring *ring)
+{
+	struct zbc_log_msg *msg;
+	unsigned int head, tail;
+	unsigned long long dropped;
+
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	tail = ring->tail;
+
+	while (tail != head) {
+		msg = &ring->msgs[tail & (ZBC_LOG_RING_SIZE - 1)];
+		fputs(msg->buf, msg->stream);
+		fflush(msg->stream);
+		tail++;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	if (dropped) {
+		__atomic_fetch_sub(&ring->dropped, dropped, __ATOMIC_RELAXED);
+		fprintf(stderr,
+			"(libzbc) [WARNING] %llu log messages dropped\n",
+			dropped);
+	}
+
+	return tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Drain all thread rings, freeing the rings of exited threads.
+ */
+static void zbc_log_drain(void)
+{
+	struct zbc_log_ring *ring, **prev;
+
+	pthread_mutex_lock(&zbc_log_lock);
+
+	prev = &zbc_log_rings;
+	while ((ring = *prev)) {
+		if (zbc_log_drain_ring(ring) &&
+		    __atomic_load_n(&ring->dead, __ATOMIC_ACQUIRE)) {
+			*prev = ring->next;
+			free(ring);
+			continue;
+		}
+		prev = &ring->next;
+	}
+
+	pthread_mutex_unlock(&zbc_log_lock);
+}
+
+/**
+ * Background log flusher.
+ */
+static void *zbc_log_flusher_run(void *arg)
+{
+	while (!__atomic_load_n(&zbc_log_flusher_stop, __ATOMIC_ACQUIRE)) {
+		zbc_log_drain();
+		usleep(10000);
+	}
+
+	/* Final drain */
+	zbc_log_drain();
+
+	return NULL;
+}
+
+/**
+ * Emit a log message. In deferred mode, the formatted message is
+ * queued in the per-thread ring and written out by the background
+ * flusher, keeping the emitting thread free of any blocking stream
+ * output. If the ring is full, the message is dropped and accounted.
+ */
+void zbc_log_print(FILE *stream, const char *format, ...)
+{
+	struct zbc_log_ring *ring;
+	struct zbc_log_msg *msg;
+	unsigned int head;
+	va_list args;
+
+	va_start(args, format);
+
+	if (!__atomic_load_n(&zbc_log_deferred, __ATOMIC_ACQUIRE)) {
+		vfprintf(stream, format, args);
+		fflush(stream);
+		va_end(args);
+		return;
+	}
+
+	ring = zbc_log_get_ring();
+	if (!ring) {
+		vfprintf(stream, format, args);
+		fflush(stream);
+		va_end(args);
+		return;
+	}
+
+	head = ring->head;
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >=
+	    ZBC_LOG_RING_SIZE) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		va_end(args);
+		return;
+	}
+
+	msg = &ring->msgs[head & (ZBC_LOG_RING_SIZE - 1)];
+	msg->stream = stream;
+	vsnprintf(msg->buf, ZBC_LOG_MSG_SIZE, format, args);
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	va_end(args);
+}
+
+/**
+ * zbc_set_log_async - Enable or disable asynchronous log output
+ */
+int zbc_set_log_async(bool enable)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&zbc_log_lock);
+
+	if (enable == zbc_log_deferred)
+		goto out;
+
+	if (enable) {
+		__atomic_store_n(&zbc_log_flusher_stop, false,
+				 __ATOMIC_RELEASE);
+		ret = pthread_create(&zbc_log_flusher, NULL,
+				     zbc_log_flusher_run, NULL);
+		if (ret != 0) {
+			ret = -ret;
+			goto out;
+		}
+		__atomic_store_n(&zbc_log_deferred, true, __ATOMIC_RELEASE);
+		goto out;
+	}
+
+	/*
+	 * Disable: stop queueing new messages, then stop the flusher.
+	 * The lock must be released while joining as the flusher takes
+	 * it to drain the rings.
+	 */
+	__atomic_store_n(&zbc_log_deferred, false, __ATOMIC_RELEASE);
+	__atomic_store_n(&zbc_log_flusher_stop, true, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&zbc_log_lock);
+
+	pthread_join(zbc_log_flusher, NULL);
+
+	return 0;
+
+out:
+	pthread_mutex_unlock(&zbc_log_lock);
+
+	return ret;
+}
@@ -0,0 +1,440 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see <http://opensource.org/licenses/BSD-2-Clause>.
+ */
+
+#include "zbc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * A pool member device. Member devices are mapped back to back in the
+ * pool sector namespace: member i covers the pool sectors from
+ * zbp_start to zbp_start + capacity - 1.
+ */
+struct zbc_pool_dev {
+
+	/**
+	 * Open device handle.
+	 */
+	struct zbc_device	*dev;
+
+	/**
+	 * First pool sector mapped to this device.
+	 */
+	uint64_t		zbp_start;
+
+	/**
+	 * Device capacity (512B sectors).
+	 */
+	uint64_t		zbp_sectors;
+
+	/**
+	 * Number of in-flight operations on this device,
+	 * updated with atomic operations.
+	 */
+	unsigned int		zbp_in_flight;
+
+};
+
+/**
+ * Device pool descriptor.
+ */
+struct zbc_pool {
+
+	/**
+	 * Member devices.
+	 */
+	struct zbc_pool_dev	*zbp_devs;
+
+	/**
+	 * Number of member devices.
+	 */
+	unsigned int		zbp_nr_devs;
+
+	/**
+	 * Total pool capacity (512B sectors).
+	 */
+	uint64_t		zbp_sectors;
+
+	/**
+	 * Round-robin allocation cursor, updated with
+	 * atomic operations.
+	 */
+	unsigned int		zbp_next;
+
+};
+
+/**
+ * Get the member device containing a pool sector.
+ */
+static struct zbc_pool_dev *zbc_pool_dev(struct zbc_pool *pool,
+					 uint64_t sector)
+{
+	struct zbc_pool_dev *pdev;
+	unsigned int i;
+
+	for (i = 0; i < pool->zbp_nr_devs; i++) {
+		pdev = &pool->zbp_devs[i];
+		if (sector < pdev->zbp_start + pdev->zbp_sectors)
+			return pdev;
+	}
+
+	return NULL;
+}
+
+/**
+ * In-flight operation accounting.
+ */
+static inline void zbc_pool_get(struct zbc_pool_dev *pdev)
+{
+	__atomic_fetch_add(&pdev->zbp_in_flight, 1, __ATOMIC_RELAXED);
+}
+
+static inline void zbc_pool_put(struct zbc_pool_dev *pdev)
+{
+	__atomic_fetch_sub(&pdev->zbp_in_flight, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * zbc_pool_open - Open a pool of devices
+ */
+int zbc_pool_open(char * const *paths, unsigned int nr_devs, int flags,
+		  struct zbc_pool **ppool)
+{
+	struct zbc_device_info info;
+	struct zbc_pool_dev *pdev;
+	struct zbc_pool *pool;
+	uint32_t lblock_size = 0;
+	unsigned int i;
+	int ret;
+
+	if (!paths || !nr_devs || !ppool)
+		return -EINVAL;
+
+	pool = calloc(1, sizeof(struct zbc_pool));
+	if (!pool)
+		return -ENOMEM;
+
+	pool->zbp_devs = calloc(nr_devs, sizeof(struct zbc_pool_dev));
+	if (!pool->zbp_devs) {
+		free(pool);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_devs; i++) {
+
+		pdev = &pool->zbp_devs[i];
+
+		ret = zbc_open(paths[i], flags, &pdev->dev);
+		if (ret != 0) {
+			zbc_error("%s: Open pool member failed %d\n",
+				  paths[i], ret);
+			goto err;
+		}
+		pool->zbp_nr_devs++;
+
+		/*
+		 * Zone allocation and write pointer tracking use the
+		 * zone cache of the member devices.
+		 */
+		ret = zbc_set_zone_cache(pdev->dev, true);
+		if (ret != 0)
+			goto err;
+
+		zbc_get_device_info(pdev->dev, &info);
+
+		/*
+		 * Pool members must use the same logical block size for
+		 * the merged sector namespace to make sense.
+		 */
+		if (!lblock_size) {
+			lblock_size = info.zbd_lblock_size;
+		} else if (info.zbd_lblock_size != lblock_size) {
+			zbc_error("%s: Logical block size mismatch "
+				  "(%u B, pool uses %u B)\n",
+				  paths[i],
+				  (unsigned int)info.zbd_lblock_size,
+				  (unsigned int)lblock_size);
+			ret = -EINVAL;
+			goto err;
+		}
+
+		pdev->zbp_start = pool->zbp_sectors;
+		pdev->zbp_sectors = info.zbd_sectors;
+		pool->zbp_sectors += info.zbd_sectors;
+
+	}
+
+	*ppool = pool;
+
+	return 0;
+
+err:
+	zbc_pool_close(pool);
+
+	return ret;
+}
+
+/**
+ * zbc_pool_close - Close all member devices of a pool
+ */
+int zbc_pool_close(struct zbc_pool *pool)
+{
+	unsigned int i;
+	int err, ret = 0;
+
+	if (!pool)
+		return -EINVAL;
+
+	for (i = 0; i < pool->zbp_nr_devs; i++) {
+		err = zbc_close(pool->zbp_devs[i].dev);
+		if (err != 0)
+			ret = err;
+	}
+
+	free(pool->zbp_devs);
+	free(pool);
+
+	return ret;
+}
+
+/**
+ * zbc_pool_nr_devices - Get the number of member devices of a pool
+ */
+unsigned int zbc_pool_nr_devices(struct zbc_pool *pool)
+{
+	return pool->zbp_nr_devs;
+}
+
+/**
+ * zbc_pool_capacity - Get the total capacity of a pool
+ */
+uint64_t zbc_pool_capacity(struct zbc_pool *pool)
+{
+	return pool->zbp_sectors;
+}
+
+/**
+ * zbc_pool_get_device - Get the member device containing a pool sector
+ */
+struct zbc_device *zbc_pool_get_device(struct zbc_pool *pool,
+				       uint64_t sector,
+				       uint64_t *dev_sector)
+{
+	struct zbc_pool_dev *pdev = zbc_pool_dev(pool, sector);
+
+	if (!pdev)
+		return NULL;
+
+	if (dev_sector)
+		*dev_sector = sector - pdev->zbp_start;
+
+	return pdev->dev;
+}
+
+/**
+ * Rebase the zone information of a member device into the pool
+ * sector namespace.
+ */
+static void zbc_pool_rebase_zone(struct zbc_pool_dev *pdev,
+				 struct zbc_zone *zone)
+{
+	zone->zbz_start += pdev->zbp_start;
+	if (zbc_zone_sequential(zone))
+		zone->zbz_write_pointer += pdev->zbp_start;
+}
+
+/**
+ * zbc_pool_report_zones - Get zone information of a pool
+ */
+int zbc_pool_report_zones(struct zbc_pool *pool, uint64_t sector,
+			  enum zbc_reporting_options ro,
+			  struct zbc_zone *zones, unsigned int *nr_zones)
+{
+	struct zbc_pool_dev *pdev = zbc_pool_dev(pool, sector);
+	unsigned int i, n, nz = 0;
+	uint64_t dev_sector;
+	int ret;
+
+	if (!pdev)
+		return -EINVAL;
+
+	dev_sector = sector - pdev->zbp_start;
+
+	for (i = pdev - pool->zbp_devs; i < pool->zbp_nr_devs; i++) {
+
+		pdev = &pool->zbp_devs[i];
+
+		if (zones) {
+			if (nz >= *nr_zones)
+				break;
+			n = *nr_zones - nz;
+		} else {
+			n = 0;
+		}
+
+		ret = zbc_report_zones_cached(pdev->dev, dev_sector, ro,
+					      zones ? &zones[nz] : NULL, &n);
+		if (ret != 0)
+			return ret;
+
+		if (zones) {
+			while (n) {
+				zbc_pool_rebase_zone(pdev, &zones[nz]);
+				nz++;
+				n--;
+			}
+		} else {
+			nz += n;
+		}
+
+		/* Continue the report from the next member device */
+		dev_sector = 0;
+
+	}
+
+	*nr_zones = nz;
+
+	return 0;
+}
+
+/**
+ * zbc_pool_alloc_zone - Allocate an empty zone for writing
+ */
+int zbc_pool_alloc_zone(struct zbc_pool *pool, struct zbc_zone *zone)
+{
+	struct zbc_pool_dev *pdev, *best = NULL;
+	unsigned int i, next, in_flight, least = 0;
+	int ret;
+
+	if (!zone)
+		return -EINVAL;
+
+	/*
+	 * Prefer the member device with the least in-flight operations,
+	 * breaking ties round-robin so that idle pools still spread
+	 * streams over all members.
+	 */
+	next = __atomic_fetch_add(&pool->zbp_next, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < pool->zbp_nr_devs; i++) {
+		pdev = &pool->zbp_devs[(next + i) % pool->zbp_nr_devs];
+		in_flight = __atomic_load_n(&pdev->zbp_in_flight,
+					    __ATOMIC_RELAXED);
+		if (!best || in_flight < least) {
+			best = pdev;
+			least = in_flight;
+		}
+	}
+
+	/*
+	 * Get an empty zone from the selected device, moving on to the
+	 * next members if it is fully allocated.
+	 */
+	next = best - pool->zbp_devs;
+	for (i = 0; i < pool->zbp_nr_devs; i++) {
+		pdev = &pool->zbp_devs[(next + i) % pool->zbp_nr_devs];
+		ret = zbc_find_zone(pdev->dev,
+				    zbc_zone_cond_mask(ZBC_ZC_EMPTY),
+				    0, zone);
+		if (ret == 0) {
+			zbc_pool_rebase_zone(pdev, zone);
+			return 0;
+		}
+		if (ret != -ENOENT)
+			return ret;
+	}
+
+	return -ENOSPC;
+}
+
+/**
+ * zbc_pool_pread - Read sectors from a pool
+ */
+ssize_t zbc_pool_pread(struct zbc_pool *pool, void *buf, size_t count,
+		       uint64_t offset)
+{
+	struct zbc_pool_dev *pdev = zbc_pool_dev(pool, offset);
+	ssize_t ret;
+
+	if (!pdev)
+		return -EINVAL;
+
+	/* I/Os must not span member devices */
+	offset -= pdev->zbp_start;
+	if (offset + count > pdev->zbp_sectors)
+		return -EINVAL;
+
+	zbc_pool_get(pdev);
+	ret = zbc_pread(pdev->dev, buf, count, offset);
+	zbc_pool_put(pdev);
+
+	return ret;
+}
+
+/**
+ * zbc_pool_pwrite - Write sectors to a pool
+ */
+ssize_t zbc_pool_pwrite(struct zbc_pool *pool, const void *buf, size_t count,
+			uint64_t offset)
+{
+	struct zbc_pool_dev *pdev = zbc_pool_dev(pool, offset);
+	ssize_t ret;
+
+	if (!pdev)
+		return -EINVAL;
+
+	/* I/Os must not span member devices */
+	offset -= pdev->zbp_start;
+	if (offset + count > pdev->zbp_sectors)
+		return -EINVAL;
+
+	zbc_pool_get(pdev);
+	ret = zbc_pwrite(pdev->dev, buf, count, offset);
+	zbc_pool_put(pdev);
+
+	return ret;
+}
+
+/**
+ * zbc_pool_zone_operation - Execute a zone operation on a pool
+ */
+int zbc_pool_zone_operation(struct zbc_pool *pool, uint64_t sector,
+			    enum zbc_zone_op op, unsigned int flags)
+{
+	struct zbc_pool_dev *pdev;
+	unsigned int i;
+	int ret;
+
+	if (flags & ZBC_OP_ALL_ZONES) {
+		/* Operate on all zones of all member devices */
+		for (i = 0; i < pool->zbp_nr_devs; i++) {
+			pdev = &pool->zbp_devs[i];
+			zbc_pool_get(pdev);
+			ret = zbc_zone_operation(pdev->dev, 0, op, flags);
+			zbc_pool_put(pdev);
+			if (ret != 0)
+				return ret;
+		}
+		return 0;
+	}
+
+	pdev = zbc_pool_dev(pool, sector);
+	if (!pdev)
+		return -EINVAL;
+
+	zbc_pool_get(pdev);
+	ret = zbc_zone_operation(pdev->dev, sector - pdev->zbp_start,
+				 op, flags);
+	zbc_pool_put(pdev);
+
+	return ret;
+}
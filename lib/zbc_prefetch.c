@@ -0,0 +1,350 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see <http://opensource.org/licenses/BSD-2-Clause>.
+ */
+
+#include "zbc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * Number of read commands kept in flight ahead of the consumer and
+ * number of consecutive sequential reads observed before prefetching
+ * starts.
+ */
+#define ZBC_PREFETCH_DEPTH	4
+#define ZBC_PREFETCH_TRIGGER	2
+
+/**
+ * A prefetch buffer: one issue-ahead read command and its data.
+ */
+struct zbc_prefetch_buf {
+
+	/**
+	 * Asynchronous read request of the buffer.
+	 */
+	struct zbc_aio		aio;
+
+	/**
+	 * I/O vector pointing at the data buffer.
+	 */
+	struct iovec		iov;
+
+	/**
+	 * Page aligned data buffer and its allocated size (512B sectors).
+	 */
+	uint8_t			*buf;
+	size_t			bufsz;
+
+	/**
+	 * First sector of the prefetched data.
+	 */
+	uint64_t		sector;
+
+	/**
+	 * Read result: number of sectors read or a negative error code.
+	 */
+	ssize_t			result;
+
+	/**
+	 * Request submitted and completion not reaped yet.
+	 */
+	bool			busy;
+
+	/**
+	 * Data valid (completion reaped).
+	 */
+	bool			filled;
+
+};
+
+/**
+ * Sequential read prefetcher state. The prefetch buffers form a ring:
+ * zbp_head is the buffer holding the data the consumer will ask for
+ * next and the zbp_nr_bufs buffers following it hold (or will receive)
+ * the data of the sectors after it.
+ */
+struct zbc_prefetch {
+
+	/**
+	 * Prefetch buffer ring.
+	 */
+	struct zbc_prefetch_buf	zbp_bufs[ZBC_PREFETCH_DEPTH];
+	unsigned int		zbp_head;
+	unsigned int		zbp_nr_bufs;
+
+	/**
+	 * Number of submitted requests not yet reaped.
+	 */
+	unsigned int		zbp_inflight;
+
+	/**
+	 * Size of the reads of the current stream (512B sectors).
+	 */
+	size_t			zbp_chunk;
+
+	/**
+	 * Expected offset of the next read of the stream
+	 * ((uint64_t)-1 when no stream is detected).
+	 */
+	uint64_t		zbp_next;
+
+	/**
+	 * Next sector to submit a prefetch read for.
+	 */
+	uint64_t		zbp_submit;
+
+	/**
+	 * Number of consecutive sequential reads observed.
+	 */
+	unsigned int		zbp_seq;
+
+	/**
+	 * The backend cannot execute asynchronous requests: do not
+	 * attempt to submit prefetch reads again.
+	 */
+	bool			zbp_noaio;
+
+};
+
+/**
+ * Reap completed prefetch reads until the given buffer completion
+ * arrives, or all completions if @b is NULL.
+ */
+static int zbc_prefetch_reap(struct zbc_device *dev,
+			     struct zbc_prefetch_buf *b)
+{
+	struct zbc_prefetch *pf = dev->zbd_prefetch;
+	struct zbc_prefetch_buf *cb;
+	struct zbc_aio *aio;
+	int ret;
+
+	while (b ? b->busy : pf->zbp_inflight != 0) {
+
+		ret = zbc_aio_wait(dev, &aio);
+		if (ret != 0)
+			return ret;
+
+		cb = aio->aio_user;
+		cb->busy = false;
+		cb->filled = true;
+		cb->result = aio->aio_result;
+		pf->zbp_inflight--;
+
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_prefetch_reset - Discard all prefetched data
+ */
+void zbc_prefetch_reset(struct zbc_device *dev)
+{
+	struct zbc_prefetch *pf = dev->zbd_prefetch;
+	unsigned int i;
+
+	if (!pf)
+		return;
+
+	/* Wait out in-flight reads: their buffers are still in use */
+	if (pf->zbp_inflight)
+		zbc_prefetch_reap(dev, NULL);
+
+	for (i = 0; i < ZBC_PREFETCH_DEPTH; i++)
+		pf->zbp_bufs[i].filled = false;
+
+	pf->zbp_head = 0;
+	pf->zbp_nr_bufs = 0;
+	pf->zbp_chunk = 0;
+	pf->zbp_next = (uint64_t)-1;
+	pf->zbp_seq = 0;
+}
+
+/**
+ * zbc_prefetch_free - Free the prefetcher of a device
+ */
+void zbc_prefetch_free(struct zbc_device *dev)
+{
+	struct zbc_prefetch *pf = dev->zbd_prefetch;
+	unsigned int i;
+
+	if (!pf)
+		return;
+
+	zbc_prefetch_reset(dev);
+
+	for (i = 0; i < ZBC_PREFETCH_DEPTH; i++)
+		free(pf->zbp_bufs[i].buf);
+	free(pf);
+
+	dev->zbd_prefetch = NULL;
+}
+
+/**
+ * zbc_set_read_prefetch - Enable or disable sequential read prefetching
+ */
+int zbc_set_read_prefetch(struct zbc_device *dev, bool enable)
+{
+	if (!enable) {
+		zbc_prefetch_free(dev);
+		return 0;
+	}
+
+	if (dev->zbd_prefetch)
+		return 0;
+
+	/* Prefetch reads are issued through the asynchronous interface */
+	if (!dev->zbd_drv->zbd_aio_submit)
+		return -ENXIO;
+
+	dev->zbd_prefetch = calloc(1, sizeof(struct zbc_prefetch));
+	if (!dev->zbd_prefetch)
+		return -ENOMEM;
+
+	dev->zbd_prefetch->zbp_next = (uint64_t)-1;
+
+	return 0;
+}
+
+/**
+ * Submit prefetch reads until the ring is full or the end of the
+ * device is reached.
+ */
+static void zbc_prefetch_topup(struct zbc_device *dev)
+{
+	struct zbc_prefetch *pf = dev->zbd_prefetch;
+	size_t pagesize = sysconf(_SC_PAGESIZE);
+	struct zbc_prefetch_buf *b;
+	unsigned int slot;
+	int ret;
+
+	if (pf->zbp_noaio)
+		return;
+
+	while (pf->zbp_nr_bufs < ZBC_PREFETCH_DEPTH) {
+
+		if (pf->zbp_submit + pf->zbp_chunk > dev->zbd_info.zbd_sectors)
+			break;
+
+		slot = (pf->zbp_head + pf->zbp_nr_bufs) % ZBC_PREFETCH_DEPTH;
+		b = &pf->zbp_bufs[slot];
+
+		if (b->bufsz < pf->zbp_chunk) {
+			free(b->buf);
+			b->bufsz = 0;
+			if (posix_memalign((void **)&b->buf, pagesize,
+					   pf->zbp_chunk << 9) != 0) {
+				b->buf = NULL;
+				break;
+			}
+			b->bufsz = pf->zbp_chunk;
+		}
+
+		b->sector = pf->zbp_submit;
+		b->filled = false;
+		b->iov.iov_base = b->buf;
+		b->iov.iov_len = pf->zbp_chunk;
+
+		memset(&b->aio, 0, sizeof(struct zbc_aio));
+		b->aio.aio_op = ZBC_AIO_PREAD;
+		b->aio.aio_sector = b->sector;
+		b->aio.aio_iov = &b->iov;
+		b->aio.aio_iovcnt = 1;
+		b->aio.aio_user = b;
+
+		ret = zbc_aio_submit(dev, &b->aio);
+		if (ret != 0) {
+			if (ret == -ENXIO || ret == -ENOTSUP)
+				pf->zbp_noaio = true;
+			break;
+		}
+
+		b->busy = true;
+		pf->zbp_nr_bufs++;
+		pf->zbp_inflight++;
+		pf->zbp_submit += pf->zbp_chunk;
+
+	}
+}
+
+/**
+ * zbc_prefetch_pread - Serve a read of a device with prefetching enabled
+ */
+ssize_t zbc_prefetch_pread(struct zbc_device *dev, void *buf, size_t count,
+			   uint64_t offset)
+{
+	struct zbc_prefetch *pf = dev->zbd_prefetch;
+	const struct iovec iov = { buf, count };
+	struct zbc_prefetch_buf *b;
+	int ret;
+
+	/*
+	 * A read that does not continue the current stream at the
+	 * expected offset and size restarts sequential detection.
+	 */
+	if (offset != pf->zbp_next || count != pf->zbp_chunk || !count) {
+		zbc_prefetch_reset(dev);
+		pf->zbp_chunk = count;
+	}
+	pf->zbp_seq++;
+	pf->zbp_next = offset + count;
+
+	if (pf->zbp_nr_bufs) {
+
+		b = &pf->zbp_bufs[pf->zbp_head];
+
+		ret = zbc_prefetch_reap(dev, b);
+		if (ret != 0)
+			return ret;
+
+		if (b->result == (ssize_t)count) {
+			memcpy(buf, b->buf, count << 9);
+			b->filled = false;
+			pf->zbp_head = (pf->zbp_head + 1) %
+				ZBC_PREFETCH_DEPTH;
+			pf->zbp_nr_bufs--;
+			zbc_prefetch_topup(dev);
+			return count;
+		}
+
+		/*
+		 * Failed or short prefetch read, e.g. the stream ran
+		 * into unwritten sectors: drop the prefetched data and
+		 * read synchronously so that the consumer gets the
+		 * device's own answer for this range.
+		 */
+		zbc_debug("%s: Prefetch read %zu sectors at sector %llu "
+			  "failed %zd, reading synchronously\n",
+			  dev->zbd_filename,
+			  count, (unsigned long long)b->sector, b->result);
+		zbc_prefetch_reset(dev);
+		pf->zbp_chunk = count;
+		pf->zbp_seq = 1;
+		pf->zbp_next = offset + count;
+
+	} else if (pf->zbp_seq >= ZBC_PREFETCH_TRIGGER &&
+		   count <= zbc_dev_max_sg_rw_sectors(dev) &&
+		   zbc_dev_sect_laligned(dev, count) &&
+		   zbc_dev_sect_laligned(dev, offset)) {
+
+		/*
+		 * Sequential stream detected: start reading ahead of
+		 * the consumer while this read executes synchronously.
+		 */
+		pf->zbp_submit = offset + count;
+		zbc_prefetch_topup(dev);
+
+	}
+
+	return zbc_preadv(dev, &iov, 1, offset);
+}
@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -78,7 +79,6 @@ static int zbc_scsi_inquiry(struct zbc_device *dev,
 	 * | 5   |                           Control                                     |
 	 * +=============================================================================+
 	 */
-	cmd.cdb[0] = ZBC_SG_INQUIRY_CDB_OPCODE;
 	if (page) {
 		cmd.cdb[1] = 0x01;
 		cmd.cdb[2] = page;
@@ -129,8 +129,6 @@ static int zbc_scsi_test_sat(struct zbc_device *dev)
 	 * | 15  |                           Control                                     |
 	 * +=============================================================================+
 	 */
-	cmd.cdb[0] = ZBC_SG_REPORT_ZONES_CDB_OPCODE;
-	cmd.cdb[1] = ZBC_SG_REPORT_ZONES_CDB_SA;
 	zbc_sg_set_int64(&cmd.cdb[2], 0);
 	zbc_sg_set_int32(&cmd.cdb[10], (unsigned int) bufsz);
 	cmd.cdb[14] = ZBC_RO_PARTIAL;
@@ -310,6 +308,82 @@ static int zbc_scsi_classify(struct zbc_device *dev)
 	return 0;
 }
 
+/**
+ * Convert a single zone descriptor:
+ * +=============================================================================+
+ * |  Bit|   7    |   6    |   5    |   4    |   3    |   2    |   1    |   0    |
+ * |Byte |        |        |        |        |        |        |        |        |
+ * |=====+=======================================================================|
+ * |  0  |             Reserved              |            Zone type              |
+ * |-----+-----------------------------------------------------------------------|
+ * |  1  |          Zone condition           |    Reserved     |non-seq |  Reset |
+ * |-----+-----------------------------------------------------------------------|
+ * |  2  |                                                                       |
+ * |- - -+---                             Reserved                            ---|
+ * |  7  |                                                                       |
+ * |-----+-----------------------------------------------------------------------|
+ * |  8  | (MSB)                                                                 |
+ * |- - -+---                           Zone Length                           ---|
+ * | 15  |                                                                 (LSB) |
+ * |-----+-----------------------------------------------------------------------|
+ * | 16  | (MSB)                                                                 |
+ * |- - -+---                          Zone Start LBA                         ---|
+ * | 23  |                                                                 (LSB) |
+ * |-----+-----------------------------------------------------------------------|
+ * | 24  | (MSB)                                                                 |
+ * |- - -+---                         Write Pointer LBA                       ---|
+ * | 31  |                                                                 (LSB) |
+ * |-----+-----------------------------------------------------------------------|
+ * | 32  |                                                                       |
+ * |- - -+---                             Reserved                            ---|
+ * | 63  |                                                                       |
+ * +=============================================================================+
+ */
+static inline void zbc_scsi_parse_zone(struct zbc_device *dev, uint8_t *buf,
+				       struct zbc_zone *zone)
+{
+	zone->zbz_type = buf[0] & 0x0f;
+
+	zone->zbz_attributes = buf[1] & 0x03;
+	zone->zbz_condition = (buf[1] >> 4) & 0x0f;
+
+	zone->zbz_length = zbc_dev_lba2sect(dev, zbc_sg_get_int64(&buf[8]));
+	zone->zbz_start = zbc_dev_lba2sect(dev, zbc_sg_get_int64(&buf[16]));
+	if (zbc_zone_sequential(zone))
+		zone->zbz_write_pointer =
+			zbc_dev_lba2sect(dev, zbc_sg_get_int64(&buf[24]));
+	else
+		zone->zbz_write_pointer = (uint64_t)-1;
+}
+
+/**
+ * Convert a block of zone descriptors into zone information entries.
+ * The descriptors are independent of each other, so converting four per
+ * iteration lets the byte-swapping loads of consecutive descriptors
+ * overlap instead of parsing a full-drive report one field at a time.
+ */
+static void zbc_scsi_parse_zones(struct zbc_device *dev, uint8_t *buf,
+				 struct zbc_zone *zones, unsigned int nz)
+{
+	unsigned int i;
+
+	for (i = 0; i + 4 <= nz; i += 4) {
+		zbc_scsi_parse_zone(dev, buf, &zones[i]);
+		zbc_scsi_parse_zone(dev, buf + ZBC_ZONE_DESCRIPTOR_LENGTH,
+				    &zones[i + 1]);
+		zbc_scsi_parse_zone(dev, buf + ZBC_ZONE_DESCRIPTOR_LENGTH * 2,
+				    &zones[i + 2]);
+		zbc_scsi_parse_zone(dev, buf + ZBC_ZONE_DESCRIPTOR_LENGTH * 3,
+				    &zones[i + 3]);
+		buf += ZBC_ZONE_DESCRIPTOR_LENGTH * 4;
+	}
+
+	for (; i < nz; i++) {
+		zbc_scsi_parse_zone(dev, buf, &zones[i]);
+		buf += ZBC_ZONE_DESCRIPTOR_LENGTH;
+	}
+}
+
 /**
  * Get a SCSI device zone information.
  */
@@ -321,7 +395,7 @@ static int zbc_scsi_do_report_zones(struct zbc_device *dev, uint64_t sector,
 {
 	size_t bufsz = ZBC_ZONE_DESCRIPTOR_OFFSET;
 	uint64_t lba = zbc_dev_sect2lba(dev, sector);
-	unsigned int i, nz = 0, buf_nz;
+	unsigned int nz = 0, buf_nz;
 	struct zbc_sg_cmd cmd;
 	size_t max_bufsz;
 	uint8_t *buf;
@@ -363,8 +437,6 @@ static int zbc_scsi_do_report_zones(struct zbc_device *dev, uint64_t sector,
 	 * | 15  |                           Control                                     |
 	 * +=============================================================================+
 	 */
-	cmd.cdb[0] = ZBC_SG_REPORT_ZONES_CDB_OPCODE;
-	cmd.cdb[1] = ZBC_SG_REPORT_ZONES_CDB_SA;
 	zbc_sg_set_int64(&cmd.cdb[2], lba);
 	zbc_sg_set_int32(&cmd.cdb[10], (unsigned int) bufsz);
 	cmd.cdb[14] = ro & 0xbf;
@@ -441,57 +513,8 @@ static int zbc_scsi_do_report_zones(struct zbc_device *dev, uint64_t sector,
 	if (nz > buf_nz)
 		nz = buf_nz;
 
-	/* Get zone descriptors:
-	 * +=============================================================================+
-	 * |  Bit|   7    |   6    |   5    |   4    |   3    |   2    |   1    |   0    |
-	 * |Byte |        |        |        |        |        |        |        |        |
-	 * |=====+=======================================================================|
-	 * |  0  |             Reserved              |            Zone type              |
-	 * |-----+-----------------------------------------------------------------------|
-	 * |  1  |          Zone condition           |    Reserved     |non-seq |  Reset |
-	 * |-----+-----------------------------------------------------------------------|
-	 * |  2  |                                                                       |
-	 * |- - -+---                             Reserved                            ---|
-	 * |  7  |                                                                       |
-	 * |-----+-----------------------------------------------------------------------|
-	 * |  8  | (MSB)                                                                 |
-	 * |- - -+---                           Zone Length                           ---|
-	 * | 15  |                                                                 (LSB) |
-	 * |-----+-----------------------------------------------------------------------|
-	 * | 16  | (MSB)                                                                 |
-	 * |- - -+---                          Zone Start LBA                         ---|
-	 * | 23  |                                                                 (LSB) |
-	 * |-----+-----------------------------------------------------------------------|
-	 * | 24  | (MSB)                                                                 |
-	 * |- - -+---                         Write Pointer LBA                       ---|
-	 * | 31  |                                                                 (LSB) |
-	 * |-----+-----------------------------------------------------------------------|
-	 * | 32  |                                                                       |
-	 * |- - -+---                             Reserved                            ---|
-	 * | 63  |                                                                       |
-	 * +=============================================================================+
-	 */
-	buf += ZBC_ZONE_DESCRIPTOR_OFFSET;
-	for (i = 0; i < nz; i++) {
-
-		zones[i].zbz_type = buf[0] & 0x0f;
-
-		zones[i].zbz_attributes = buf[1] & 0x03;
-		zones[i].zbz_condition = (buf[1] >> 4) & 0x0f;
-
-		zones[i].zbz_length =
-			zbc_dev_lba2sect(dev, zbc_sg_get_int64(&buf[8]));
-		zones[i].zbz_start =
-			zbc_dev_lba2sect(dev, zbc_sg_get_int64(&buf[16]));
-		if (zbc_zone_sequential(&zones[i]))
-			zones[i].zbz_write_pointer =
-				zbc_dev_lba2sect(dev, zbc_sg_get_int64(&buf[24]));
-		else
-			zones[i].zbz_write_pointer = (uint64_t)-1;
-
-		buf += ZBC_ZONE_DESCRIPTOR_LENGTH;
-
-	}
+	/* Get zone descriptors */
+	zbc_scsi_parse_zones(dev, buf + ZBC_ZONE_DESCRIPTOR_OFFSET, zones, nz);
 
 out:
 	/* Return number of zones */
@@ -522,31 +545,21 @@ int zbc_scsi_zone_op(struct zbc_device *dev, uint64_t sector,
 {
 	uint64_t lba = zbc_dev_sect2lba(dev, sector);
 	unsigned int cmdid;
-	unsigned int cmdcode;
-	unsigned int cmdsa;
 	struct zbc_sg_cmd cmd;
 	int ret;
 
 	switch (op) {
 	case ZBC_OP_RESET_ZONE:
 		cmdid = ZBC_SG_RESET_ZONE;
-		cmdcode = ZBC_SG_RESET_ZONE_CDB_OPCODE;
-		cmdsa = ZBC_SG_RESET_ZONE_CDB_SA;
 		break;
 	case ZBC_OP_OPEN_ZONE:
 		cmdid = ZBC_SG_OPEN_ZONE;
-		cmdcode = ZBC_SG_OPEN_ZONE_CDB_OPCODE;
-		cmdsa = ZBC_SG_OPEN_ZONE_CDB_SA;
 		break;
 	case ZBC_OP_CLOSE_ZONE:
 		cmdid = ZBC_SG_CLOSE_ZONE;
-		cmdcode = ZBC_SG_CLOSE_ZONE_CDB_OPCODE;
-		cmdsa = ZBC_SG_CLOSE_ZONE_CDB_SA;
 		break;
 	case ZBC_OP_FINISH_ZONE:
 		cmdid = ZBC_SG_FINISH_ZONE;
-		cmdcode = ZBC_SG_FINISH_ZONE_CDB_OPCODE;
-		cmdsa = ZBC_SG_FINISH_ZONE_CDB_SA;
 		break;
 	default:
 		zbc_error("%s: Invalid operation code 0x%x\n",
@@ -581,8 +594,6 @@ int zbc_scsi_zone_op(struct zbc_device *dev, uint64_t sector,
 	 * | 15  |                           Control                                     |
 	 * +=============================================================================+
 	 */
-	cmd.cdb[0] = cmdcode;
-	cmd.cdb[1] = cmdsa;
 	if (flags & ZBC_OP_ALL_ZONES)
 		/* Operate on all zones */
 		cmd.cdb[14] = 0x01;
@@ -618,8 +629,6 @@ static int zbc_scsi_get_capacity(struct zbc_device *dev)
 		return ret;
 
 	/* Fill command CDB */
-	cmd.cdb[0] = ZBC_SG_READ_CAPACITY_CDB_OPCODE;
-	cmd.cdb[1] = ZBC_SG_READ_CAPACITY_CDB_SA;
 	zbc_sg_set_int32(&cmd.cdb[10], ZBC_SCSI_READ_CAPACITY_BUF_LEN);
 
 	/* Send the SG_IO command */
@@ -860,6 +869,9 @@ static int zbc_scsi_open(const char *filename,
 	if (ret != 0)
 		goto out_free_filename;
 
+	/* Use the bsg (SG v4) node for command execution if there is one */
+	zbc_sg_open_bsg(dev);
+
 	*pdev = dev;
 
 	zbc_debug("%s: ########## SCSI driver succeeded ##########\n",
@@ -890,6 +902,9 @@ out:
 static int zbc_scsi_close(struct zbc_device *dev)
 {
 
+	if (dev->zbd_bsg_fd > 0)
+		close(dev->zbd_bsg_fd);
+
 	if (close(dev->zbd_fd))
 		return -errno;
 
@@ -916,8 +931,6 @@ ssize_t zbc_scsi_preadv(struct zbc_device *dev,
 		return ret;
 
 	/* Fill command CDB */
-	cmd.cdb[0] = ZBC_SG_READ_CDB_OPCODE;
-	cmd.cdb[1] = 0x10;
 	zbc_sg_set_int64(&cmd.cdb[2], zbc_dev_sect2lba(dev, offset));
 	zbc_sg_set_int32(&cmd.cdb[10], zbc_dev_sect2lba(dev, count));
 
@@ -948,8 +961,6 @@ ssize_t zbc_scsi_pwritev(struct zbc_device *dev,
 		return ret;
 
 	/* Fill command CDB */
-	cmd.cdb[0] = ZBC_SG_WRITE_CDB_OPCODE;
-	cmd.cdb[1] = 0x10;
 	zbc_sg_set_int64(&cmd.cdb[2], zbc_dev_sect2lba(dev, offset));
 	zbc_sg_set_int32(&cmd.cdb[10], zbc_dev_sect2lba(dev, count));
 
@@ -976,11 +987,7 @@ int zbc_scsi_flush(struct zbc_device *dev)
 	if (ret != 0)
 		return ret;
 
-	/* Fill command CDB (immediate flush) */
-	cmd.cdb[0] = ZBC_SG_SYNC_CACHE_CDB_OPCODE;
-	cmd.cdb[1] = 0x02;
-	zbc_sg_set_int64(&cmd.cdb[2], 0);
-	zbc_sg_set_int32(&cmd.cdb[10], 0);
+	/* The CDB template requests an immediate flush of all blocks */
 
 	/* Send the SG_IO command */
 	ret = zbc_sg_cmd_exec(dev, &cmd);
@@ -990,6 +997,230 @@ int zbc_scsi_flush(struct zbc_device *dev)
 	return ret;
 }
 
+/**
+ * Flush a range of sectors of a ZBC device cache.
+ */
+static int zbc_scsi_flush_range(struct zbc_device *dev, uint64_t sector,
+				uint64_t count)
+{
+	uint64_t lba = zbc_dev_sect2lba(dev, sector);
+	uint64_t nr_lba = zbc_dev_sect2lba(dev, count);
+	struct zbc_sg_cmd cmd;
+	int ret;
+
+	/*
+	 * The number of logical blocks of SYNCHRONIZE CACHE 16 is a
+	 * 32 bits field: fall back to a full cache flush for larger
+	 * ranges.
+	 */
+	if (nr_lba > (uint64_t)UINT_MAX)
+		return -EOPNOTSUPP;
+
+	/* SYNCHRONIZE CACHE 16 */
+	ret = zbc_sg_cmd_init(dev, &cmd, ZBC_SG_SYNC_CACHE, NULL, 0);
+	if (ret != 0)
+		return ret;
+
+	/* Fill command CDB (immediate flush of the range) */
+	zbc_sg_set_int64(&cmd.cdb[2], lba);
+	zbc_sg_set_int32(&cmd.cdb[10], (unsigned int)nr_lba);
+
+	/* Send the SG_IO command */
+	ret = zbc_sg_cmd_exec(dev, &cmd);
+
+	zbc_sg_cmd_destroy(&cmd);
+
+	return ret;
+}
+
+/**
+ * Driver flags: result of the SG write interface support test.
+ */
+#define ZBC_SCSI_SG_AIO_TESTED	0x40000000
+#define ZBC_SCSI_SG_AIO		0x80000000
+
+/**
+ * Asynchronous request state.
+ */
+struct zbc_scsi_aio {
+	struct zbc_sg_cmd	cmd;
+};
+
+/**
+ * Test if the device node supports queued commands. The SG write/read
+ * interface is available only on SG character device nodes.
+ */
+static bool zbc_scsi_aio_supported(struct zbc_device *dev)
+{
+	struct stat st;
+
+	if (!(dev->zbd_drv_flags & ZBC_SCSI_SG_AIO_TESTED)) {
+		dev->zbd_drv_flags |= ZBC_SCSI_SG_AIO_TESTED;
+		if (fstat(dev->zbd_sg_fd, &st) == 0 &&
+		    S_ISCHR(st.st_mode))
+			dev->zbd_drv_flags |= ZBC_SCSI_SG_AIO;
+	}
+
+	return dev->zbd_drv_flags & ZBC_SCSI_SG_AIO;
+}
+
+/**
+ * Submit an asynchronous request.
+ */
+static int zbc_scsi_aio_submit(struct zbc_device *dev, struct zbc_aio *aio)
+{
+	struct zbc_scsi_aio *saio;
+	unsigned int cmdid;
+	size_t sz;
+	int ret;
+
+	if (!zbc_scsi_aio_supported(dev)) {
+		zbc_error("%s: Asynchronous commands need an SG node\n",
+			  dev->zbd_filename);
+		return -ENXIO;
+	}
+
+	saio = calloc(1, sizeof(struct zbc_scsi_aio));
+	if (!saio)
+		return -ENOMEM;
+
+	switch (aio->aio_op) {
+
+	case ZBC_AIO_PREAD:
+
+		/* READ 16 */
+		ret = zbc_sg_vcmd_init(dev, &saio->cmd, ZBC_SG_READ,
+				       aio->aio_biov, aio->aio_iovcnt);
+		if (ret != 0)
+			goto err;
+
+		sz = zbc_iov_count(aio->aio_iov, aio->aio_iovcnt);
+		zbc_sg_set_int64(&saio->cmd.cdb[2],
+				 zbc_dev_sect2lba(dev, aio->aio_sector));
+		zbc_sg_set_int32(&saio->cmd.cdb[10],
+				 zbc_dev_sect2lba(dev, sz));
+		break;
+
+	case ZBC_AIO_PWRITE:
+
+		/* WRITE 16 */
+		ret = zbc_sg_vcmd_init(dev, &saio->cmd, ZBC_SG_WRITE,
+				       aio->aio_biov, aio->aio_iovcnt);
+		if (ret != 0)
+			goto err;
+
+		sz = zbc_iov_count(aio->aio_iov, aio->aio_iovcnt);
+		zbc_sg_set_int64(&saio->cmd.cdb[2],
+				 zbc_dev_sect2lba(dev, aio->aio_sector));
+		zbc_sg_set_int32(&saio->cmd.cdb[10],
+				 zbc_dev_sect2lba(dev, sz));
+		break;
+
+	case ZBC_AIO_ZONE_OP:
+
+		switch (aio->aio_zone_op) {
+		case ZBC_OP_RESET_ZONE:
+			cmdid = ZBC_SG_RESET_ZONE;
+			break;
+		case ZBC_OP_OPEN_ZONE:
+			cmdid = ZBC_SG_OPEN_ZONE;
+			break;
+		case ZBC_OP_CLOSE_ZONE:
+			cmdid = ZBC_SG_CLOSE_ZONE;
+			break;
+		case ZBC_OP_FINISH_ZONE:
+			cmdid = ZBC_SG_FINISH_ZONE;
+			break;
+		default:
+			zbc_error("%s: Invalid operation code 0x%x\n",
+				  dev->zbd_filename, aio->aio_zone_op);
+			ret = -EINVAL;
+			goto err;
+		}
+
+		ret = zbc_sg_cmd_init(dev, &saio->cmd, cmdid, NULL, 0);
+		if (ret != 0)
+			goto err;
+
+		if (aio->aio_flags & ZBC_OP_ALL_ZONES)
+			/* Operate on all zones */
+			saio->cmd.cdb[14] = 0x01;
+		else
+			/* Operate on the zone at lba */
+			zbc_sg_set_int64(&saio->cmd.cdb[2],
+					 zbc_dev_sect2lba(dev, aio->aio_sector));
+		break;
+
+	default:
+
+		zbc_error("%s: Invalid asynchronous operation 0x%x\n",
+			  dev->zbd_filename, aio->aio_op);
+		ret = -EINVAL;
+		goto err;
+
+	}
+
+	/* Queue the command */
+	aio->aio_private = saio;
+	saio->cmd.io_hdr.usr_ptr = aio;
+	ret = zbc_sg_cmd_submit(dev, &saio->cmd);
+	if (ret != 0) {
+		zbc_sg_cmd_destroy(&saio->cmd);
+		aio->aio_private = NULL;
+		goto err;
+	}
+
+	return 0;
+
+err:
+	free(saio);
+
+	return ret;
+}
+
+/**
+ * Wait for an asynchronous request completion.
+ */
+static int zbc_scsi_aio_wait(struct zbc_device *dev, struct zbc_aio **paio)
+{
+	struct zbc_scsi_aio *saio;
+	struct zbc_aio *aio;
+	sg_io_hdr_t io_hdr;
+	int ret;
+
+	ret = zbc_sg_cmd_reap(dev, &io_hdr);
+	if (ret != 0)
+		return ret;
+
+	aio = io_hdr.usr_ptr;
+	if (!aio || !aio->aio_private) {
+		zbc_error("%s: Unexpected command completion\n",
+			  dev->zbd_filename);
+		return -EIO;
+	}
+	saio = aio->aio_private;
+
+	/* The driver returns an updated copy of the command header */
+	saio->cmd.io_hdr = io_hdr;
+
+	ret = zbc_sg_cmd_check(dev, &saio->cmd);
+	if (ret != 0)
+		aio->aio_result = ret;
+	else if (aio->aio_op == ZBC_AIO_ZONE_OP)
+		aio->aio_result = 0;
+	else
+		aio->aio_result = saio->cmd.bufsz >> 9;
+
+	/* Cleanup */
+	zbc_sg_cmd_destroy(&saio->cmd);
+	aio->aio_private = NULL;
+	free(saio);
+
+	*paio = aio;
+
+	return 0;
+}
+
 /**
  * ZBC SCSI device driver definition.
  */
@@ -1001,7 +1232,10 @@ struct zbc_drv zbc_scsi_drv =
 	.zbd_preadv		= zbc_scsi_preadv,
 	.zbd_pwritev		= zbc_scsi_pwritev,
 	.zbd_flush		= zbc_scsi_flush,
+	.zbd_flush_range	= zbc_scsi_flush_range,
 	.zbd_report_zones	= zbc_scsi_report_zones,
 	.zbd_zone_op		= zbc_scsi_zone_op,
+	.zbd_aio_submit		= zbc_scsi_aio_submit,
+	.zbd_aio_wait		= zbc_scsi_aio_wait,
 };
 
@@ -16,13 +16,19 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <libgen.h>
 #include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
 #include <linux/limits.h>
 #include <linux/fs.h>
+#include <linux/bsg.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <assert.h>
 
 #include "zbc.h"
@@ -30,8 +36,12 @@
 
 /**
  * Definition of the commands
- * Each command is defined by 3 fields.
- * It's name, it's length, and it's opcode.
+ * Each command is defined by its name, opcode, service action, length
+ * and data transfer direction, together with a CDB template holding
+ * the fixed CDB bytes of the command (opcode, service action and
+ * constant flag bytes). Command initialization copies the template in
+ * a single move so that callers only patch the variable fields (LBA,
+ * transfer length, options).
  */
 static struct zbc_sg_cmd_s
 {
@@ -40,6 +50,7 @@ static struct zbc_sg_cmd_s
 	int		cdb_sa;
 	size_t		cdb_length;
 	int		dir;
+	uint8_t		cdb_tpl[ZBC_SG_CDB_MAX_LENGTH];
 
 } zbc_sg_cmd_list[ZBC_SG_CMD_NUM] = {
 
@@ -49,7 +60,8 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_TEST_UNIT_READY_CDB_OPCODE,
 		0,
 		ZBC_SG_TEST_UNIT_READY_CDB_LENGTH,
-		SG_DXFER_NONE
+		SG_DXFER_NONE,
+		{ ZBC_SG_TEST_UNIT_READY_CDB_OPCODE }
 	},
 
 	[ZBC_SG_INQUIRY] =
@@ -58,7 +70,8 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_INQUIRY_CDB_OPCODE,
 		0,
 		ZBC_SG_INQUIRY_CDB_LENGTH,
-		SG_DXFER_FROM_DEV
+		SG_DXFER_FROM_DEV,
+		{ ZBC_SG_INQUIRY_CDB_OPCODE }
 	},
 
 	[ZBC_SG_READ_CAPACITY] =
@@ -67,7 +80,9 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_READ_CAPACITY_CDB_OPCODE,
 		ZBC_SG_READ_CAPACITY_CDB_SA,
 		ZBC_SG_READ_CAPACITY_CDB_LENGTH,
-		SG_DXFER_FROM_DEV
+		SG_DXFER_FROM_DEV,
+		{ ZBC_SG_READ_CAPACITY_CDB_OPCODE,
+		  ZBC_SG_READ_CAPACITY_CDB_SA }
 	},
 
 	[ZBC_SG_READ] =
@@ -76,7 +91,8 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_READ_CDB_OPCODE,
 		0,
 		ZBC_SG_READ_CDB_LENGTH,
-		SG_DXFER_FROM_DEV
+		SG_DXFER_FROM_DEV,
+		{ ZBC_SG_READ_CDB_OPCODE, 0x10 }
 	},
 
 	[ZBC_SG_WRITE] =
@@ -85,7 +101,8 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_WRITE_CDB_OPCODE,
 		0,
 		ZBC_SG_WRITE_CDB_LENGTH,
-		SG_DXFER_TO_DEV
+		SG_DXFER_TO_DEV,
+		{ ZBC_SG_WRITE_CDB_OPCODE, 0x10 }
 	},
 
 	[ZBC_SG_SYNC_CACHE] =
@@ -94,7 +111,8 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_SYNC_CACHE_CDB_OPCODE,
 		0,
 		ZBC_SG_SYNC_CACHE_CDB_LENGTH,
-		SG_DXFER_NONE
+		SG_DXFER_NONE,
+		{ ZBC_SG_SYNC_CACHE_CDB_OPCODE, 0x02 }
 	},
 
 	[ZBC_SG_REPORT_ZONES] =
@@ -103,7 +121,9 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_REPORT_ZONES_CDB_OPCODE,
 		ZBC_SG_REPORT_ZONES_CDB_SA,
 		ZBC_SG_REPORT_ZONES_CDB_LENGTH,
-		SG_DXFER_FROM_DEV
+		SG_DXFER_FROM_DEV,
+		{ ZBC_SG_REPORT_ZONES_CDB_OPCODE,
+		  ZBC_SG_REPORT_ZONES_CDB_SA }
 	},
 
 	[ZBC_SG_RESET_ZONE] =
@@ -112,7 +132,9 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_RESET_ZONE_CDB_OPCODE,
 		ZBC_SG_RESET_ZONE_CDB_SA,
 		ZBC_SG_RESET_ZONE_CDB_LENGTH,
-		SG_DXFER_NONE
+		SG_DXFER_NONE,
+		{ ZBC_SG_RESET_ZONE_CDB_OPCODE,
+		  ZBC_SG_RESET_ZONE_CDB_SA }
 	},
 
 	[ZBC_SG_OPEN_ZONE] =
@@ -121,7 +143,9 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_OPEN_ZONE_CDB_OPCODE,
 		ZBC_SG_OPEN_ZONE_CDB_SA,
 		ZBC_SG_OPEN_ZONE_CDB_LENGTH,
-		SG_DXFER_NONE
+		SG_DXFER_NONE,
+		{ ZBC_SG_OPEN_ZONE_CDB_OPCODE,
+		  ZBC_SG_OPEN_ZONE_CDB_SA }
 	},
 
 	[ZBC_SG_CLOSE_ZONE] =
@@ -130,7 +154,9 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_CLOSE_ZONE_CDB_OPCODE,
 		ZBC_SG_CLOSE_ZONE_CDB_SA,
 		ZBC_SG_CLOSE_ZONE_CDB_LENGTH,
-		SG_DXFER_NONE
+		SG_DXFER_NONE,
+		{ ZBC_SG_CLOSE_ZONE_CDB_OPCODE,
+		  ZBC_SG_CLOSE_ZONE_CDB_SA }
 	},
 
 	[ZBC_SG_FINISH_ZONE] =
@@ -139,7 +165,9 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_FINISH_ZONE_CDB_OPCODE,
 		ZBC_SG_FINISH_ZONE_CDB_SA,
 		ZBC_SG_FINISH_ZONE_CDB_LENGTH,
-		SG_DXFER_NONE
+		SG_DXFER_NONE,
+		{ ZBC_SG_FINISH_ZONE_CDB_OPCODE,
+		  ZBC_SG_FINISH_ZONE_CDB_SA }
 	},
 
 	[ZBC_SG_SET_ZONES] =
@@ -148,7 +176,9 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_SET_ZONES_CDB_OPCODE,
 		ZBC_SG_SET_ZONES_CDB_SA,
 		ZBC_SG_SET_ZONES_CDB_LENGTH,
-		SG_DXFER_NONE
+		SG_DXFER_NONE,
+		{ ZBC_SG_SET_ZONES_CDB_OPCODE,
+		  ZBC_SG_SET_ZONES_CDB_SA }
 	},
 
 	[ZBC_SG_SET_WRITE_POINTER] =
@@ -157,7 +187,9 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_SET_WRITE_POINTER_CDB_OPCODE,
 		ZBC_SG_SET_WRITE_POINTER_CDB_SA,
 		ZBC_SG_SET_WRITE_POINTER_CDB_LENGTH,
-		SG_DXFER_NONE
+		SG_DXFER_NONE,
+		{ ZBC_SG_SET_WRITE_POINTER_CDB_OPCODE,
+		  ZBC_SG_SET_WRITE_POINTER_CDB_SA }
 	},
 
 	[ZBC_SG_ATA16] =
@@ -166,7 +198,8 @@ static struct zbc_sg_cmd_s
 		ZBC_SG_ATA16_CDB_OPCODE,
 		0,
 		ZBC_SG_ATA16_CDB_LENGTH,
-		0
+		0,
+		{ ZBC_SG_ATA16_CDB_OPCODE }
 	}
 
 };
@@ -243,6 +276,133 @@ static void zbc_sg_set_sense(struct zbc_device *dev, struct zbc_sg_cmd *cmd)
 #endif
 #define ZBC_SG_FLAG_Q_AT_TAIL	0x10
 
+/**
+ * Get a page aligned command data buffer of at least @bufsz bytes,
+ * recycling a buffer from the device buffer pool when one of a
+ * suitable size is available. The allocated size of the returned
+ * buffer is stored in @allocsz.
+ */
+static uint8_t *zbc_sg_get_buf(struct zbc_device *dev, size_t bufsz,
+			       size_t *allocsz)
+{
+	size_t pagesize = sysconf_pagesize();
+	size_t size = (bufsz + pagesize - 1) & ~(pagesize - 1);
+	struct zbc_sg_buf *pbuf;
+	uint8_t *buf;
+	int i;
+
+	/*
+	 * Look for a recycled buffer large enough, but not so much
+	 * larger that small commands pin down big buffers.
+	 */
+	for (i = 0; i < ZBC_SG_BUF_POOL_SIZE; i++) {
+		pbuf = &dev->zbd_sg_buf_pool[i];
+		if (pbuf->buf &&
+		    pbuf->size >= size && pbuf->size <= size * 2) {
+			buf = pbuf->buf;
+			*allocsz = pbuf->size;
+			pbuf->buf = NULL;
+			pbuf->size = 0;
+			return buf;
+		}
+	}
+
+	/*
+	 * Align buffers of at least a huge page to the huge page size and
+	 * ask for THP backing: large buffers then need fewer SG list
+	 * entries and no page-fault work once touched.
+	 */
+	if (size >= zbc_thp_size())
+		pagesize = zbc_thp_size();
+
+	if (posix_memalign((void **) &buf, pagesize, size) != 0)
+		return NULL;
+	*allocsz = size;
+
+#ifdef MADV_HUGEPAGE
+	if (pagesize > (size_t)sysconf_pagesize())
+		madvise(buf, size, MADV_HUGEPAGE);
+#endif
+
+	/*
+	 * Touch the pages now, so that I/Os using recycled buffers do
+	 * not page-fault.
+	 */
+	memset(buf, 0, size);
+
+	return buf;
+}
+
+/**
+ * Return a command data buffer to the device buffer pool, or free it
+ * if the pool is full. Buffers larger than the device maximum command
+ * size are not kept. While a device is being probed (no backend driver
+ * assigned yet), buffers are not pooled so that a failed probe does
+ * not leak them.
+ */
+static void zbc_sg_put_buf(struct zbc_device *dev, void *buf, size_t size)
+{
+	struct zbc_sg_buf *pbuf;
+	int i;
+
+	if (dev->zbd_drv && size &&
+	    size <= dev->zbd_info.zbd_max_rw_sectors << 9) {
+		for (i = 0; i < ZBC_SG_BUF_POOL_SIZE; i++) {
+			pbuf = &dev->zbd_sg_buf_pool[i];
+			if (!pbuf->buf) {
+				pbuf->buf = buf;
+				pbuf->size = size;
+				return;
+			}
+		}
+	}
+
+	free(buf);
+}
+
+/**
+ * Free all buffers of a device SG command buffer pool.
+ */
+void zbc_sg_drain_buf_pool(struct zbc_device *dev)
+{
+	struct zbc_sg_buf *pbuf;
+	int i;
+
+	for (i = 0; i < ZBC_SG_BUF_POOL_SIZE; i++) {
+		pbuf = &dev->zbd_sg_buf_pool[i];
+		free(pbuf->buf);
+		pbuf->buf = NULL;
+		pbuf->size = 0;
+	}
+}
+
+/**
+ * zbc_buf_alloc - Allocate an I/O buffer suitable for device commands
+ */
+void *zbc_buf_alloc(struct zbc_device *dev, size_t size)
+{
+	size_t allocsz;
+
+	if (!size)
+		return NULL;
+
+	return zbc_sg_get_buf(dev, size, &allocsz);
+}
+
+/**
+ * zbc_buf_free - Free an I/O buffer obtained with zbc_buf_alloc()
+ */
+void zbc_buf_free(struct zbc_device *dev, void *buf, size_t size)
+{
+	size_t pagesize = sysconf_pagesize();
+
+	if (!buf)
+		return;
+
+	/* The allocated size is at least the page rounded buffer size */
+	zbc_sg_put_buf(dev, buf, (size + pagesize - 1) & ~(pagesize - 1));
+}
+
 /**
  * Initialize a command.
  */
@@ -255,22 +415,34 @@ int zbc_sg_vcmd_init(struct zbc_device *dev,
 
 	zbc_assert(cmd_code >= 0 && cmd_code < ZBC_SG_CMD_NUM);
 
-	/* Set command */
-	memset(cmd, 0, sizeof(struct zbc_sg_cmd));
+	/*
+	 * Set command: copy the CDB template of the command in a single
+	 * move and initialize only the fields that SG_IO and the command
+	 * execution path actually read, instead of zeroing the entire
+	 * descriptor. The sense buffer does not need clearing as the
+	 * kernel reports the amount of sense data written in sb_len_wr.
+	 */
+	cmd->dev = dev;
 	cmd->code = cmd_code;
 	cmd->cdb_sz = zbc_sg_cmd_list[cmd_code].cdb_length;
 	zbc_assert(cmd->cdb_sz <= ZBC_SG_CDB_MAX_LENGTH);
 	cmd->cdb_opcode = zbc_sg_cmd_list[cmd_code].cdb_opcode;
 	cmd->cdb_sa = zbc_sg_cmd_list[cmd_code].cdb_sa;
+	memcpy(cmd->cdb, zbc_sg_cmd_list[cmd_code].cdb_tpl,
+	       ZBC_SG_CDB_MAX_LENGTH);
+
+	cmd->buf = NULL;
+	cmd->buf_needfree = false;
+	cmd->buf_allocsz = 0;
 
 	if (!buf && bufsz) {
 		if (iovcnt != 1) {
 			zbc_error("No buffer for vector command\n");
 			return -EINVAL;
 		}
-		/* Allocate a buffer */
-		if (posix_memalign((void **) &buf,
-				   sysconf_pagesize(), bufsz) != 0) {
+		/* Get a buffer from the device buffer pool */
+		buf = zbc_sg_get_buf(dev, bufsz, &cmd->buf_allocsz);
+		if (!buf) {
 			zbc_error("No memory for command buffer (%zu B)\n",
 				  bufsz);
 			return -ENOMEM;
@@ -282,7 +454,7 @@ int zbc_sg_vcmd_init(struct zbc_device *dev,
 
 	/* Setup SGIO header */
 	cmd->io_hdr.interface_id = 'S';
-	cmd->io_hdr.timeout = 20000;
+	cmd->io_hdr.timeout = ZBC_SG_TIMEOUT;
 
 	cmd->io_hdr.flags = ZBC_SG_FLAG_Q_AT_TAIL;
 	if (dev->zbd_o_flags & ZBC_O_DIRECT && bufsz && iovcnt == 1)
@@ -299,10 +471,14 @@ int zbc_sg_vcmd_init(struct zbc_device *dev,
 	} else {
 		cmd->buf = buf;
 		cmd->io_hdr.dxferp = cmd->buf;
+		cmd->io_hdr.iovec_count = 0;
 	}
         cmd->io_hdr.dxfer_len = cmd->bufsz;
 	cmd->io_hdr.mx_sb_len = ZBC_SG_SENSE_MAX_LENGTH;
 	cmd->io_hdr.sbp = cmd->sense_buf;
+	cmd->io_hdr.pack_id = 0;
+	cmd->io_hdr.usr_ptr = NULL;
+	cmd->io_hdr.sb_len_wr = 0;
 
 	return 0;
 }
@@ -312,46 +488,20 @@ int zbc_sg_vcmd_init(struct zbc_device *dev,
  */
 void zbc_sg_cmd_destroy(struct zbc_sg_cmd *cmd)
 {
-	/* Free the command buffer */
+	/* Recycle the command buffer */
         if (cmd->buf && cmd->buf_needfree) {
-		free(cmd->buf);
+		zbc_sg_put_buf(cmd->dev, cmd->buf, cmd->buf_allocsz);
 		cmd->buf = NULL;
 		cmd->bufsz = 0;
+		cmd->buf_allocsz = 0;
         }
 }
 
 /**
- * Execute a command.
+ * Check the completion status of an executed command.
  */
-int zbc_sg_cmd_exec(struct zbc_device *dev, struct zbc_sg_cmd *cmd)
+int zbc_sg_cmd_check(struct zbc_device *dev, struct zbc_sg_cmd *cmd)
 {
-	int ret;
-
-	if (zbc_log_level >= ZBC_LOG_DEBUG) {
-		zbc_debug("%s: Sending command 0x%02x:0x%02x (%s):\n",
-			  dev->zbd_filename,
-			  cmd->cdb_opcode,
-			  cmd->cdb_sa,
-			  zbc_sg_cmd_name(cmd));
-		zbc_sg_print_bytes(dev, cmd->cdb, cmd->cdb_sz);
-	}
-
-	zbc_debug("%s: Execute %s command with buffer of %zu B\n",
-		  dev->zbd_filename,
-		  (cmd->io_hdr.flags & ZBC_SG_FLAG_DIRECT_IO) ? "direct" : "normal",
-		  cmd->bufsz);
-
-	/* Send the SG_IO command */
-	ret = ioctl(dev->zbd_sg_fd, SG_IO, &cmd->io_hdr);
-	if (ret != 0) {
-		ret = -errno;
-		zbc_debug("%s: SG_IO ioctl failed %d (%s)\n",
-			  dev->zbd_filename,
-			  errno,
-			  strerror(errno));
-		return ret;
-	}
-
 	/* Reset errno */
 	zbc_sg_set_sense(dev, NULL);
 
@@ -386,12 +536,28 @@ int zbc_sg_cmd_exec(struct zbc_device *dev, struct zbc_sg_cmd *cmd)
 
 	}
 
+	/*
+	 * A command exceeding its timeout is aborted by the kernel and
+	 * completes with a timeout host or driver status. Report it as
+	 * -ETIMEDOUT so that callers can tell a slow device apart from
+	 * a failed command.
+	 */
+	if (cmd->io_hdr.host_status == ZBC_SG_DID_TIME_OUT ||
+	    zbc_sg_cmd_driver_status(cmd) == ZBC_SG_DRIVER_TIMEOUT) {
+		zbc_error("%s: Command %s timed out after %u ms\n",
+			  dev->zbd_filename,
+			  zbc_sg_cmd_name(cmd),
+			  cmd->io_hdr.timeout);
+		zbc_set_errno(ZBC_SK_ABORTED_COMMAND, 0);
+		return -ETIMEDOUT;
+	}
+
 	if (cmd->io_hdr.status ||
 	    (cmd->io_hdr.host_status != ZBC_SG_DID_OK) ||
 	    (zbc_sg_cmd_driver_status(cmd) &&
 	     (zbc_sg_cmd_driver_status(cmd) != ZBC_SG_DRIVER_SENSE))) {
 
-		if (zbc_log_level >= ZBC_LOG_DEBUG) {
+		if (zbc_log_debug_enabled()) {
 
 			zbc_error("%s: Command %s failed with status 0x%02x "
 				  "(0x%02x), host status 0x%04x, driver status "
@@ -438,6 +604,235 @@ int zbc_sg_cmd_exec(struct zbc_device *dev, struct zbc_sg_cmd *cmd)
 	return 0;
 }
 
+/**
+ * Statistics command class of an SG command.
+ */
+static enum zbc_stats_op zbc_sg_cmd_stats_op(struct zbc_sg_cmd *cmd)
+{
+	if (cmd->code == ZBC_SG_ATA16) {
+		/* Classify using the ATA command code */
+		switch (cmd->cdb[14]) {
+		case 0x25:	/* READ DMA EXT */
+			return ZBC_STATS_READ;
+		case 0x35:	/* WRITE DMA EXT */
+			return ZBC_STATS_WRITE;
+		case 0x4A:	/* ZAC MANAGEMENT IN */
+			return ZBC_STATS_REPORT_ZONES;
+		case 0x9F:	/* ZAC MANAGEMENT OUT */
+			return ZBC_STATS_ZONE_OP;
+		case 0xEA:	/* FLUSH CACHE EXT */
+			return ZBC_STATS_FLUSH;
+		default:
+			return ZBC_STATS_OTHER;
+		}
+	}
+
+	switch (cmd->code) {
+	case ZBC_SG_READ:
+		return ZBC_STATS_READ;
+	case ZBC_SG_WRITE:
+		return ZBC_STATS_WRITE;
+	case ZBC_SG_REPORT_ZONES:
+		return ZBC_STATS_REPORT_ZONES;
+	case ZBC_SG_RESET_ZONE:
+	case ZBC_SG_OPEN_ZONE:
+	case ZBC_SG_CLOSE_ZONE:
+	case ZBC_SG_FINISH_ZONE:
+		return ZBC_STATS_ZONE_OP;
+	case ZBC_SG_SYNC_CACHE:
+		return ZBC_STATS_FLUSH;
+	default:
+		return ZBC_STATS_OTHER;
+	}
+}
+
+/**
+ * Timeout of an SG command in milliseconds, based on the timeout class
+ * of the command and the device timeouts set with zbc_set_timeout().
+ * The command class is resolved at execution time as ATA commands are
+ * all issued as ATA16 and carry their command code in the CDB.
+ */
+static unsigned int zbc_sg_cmd_timeout(struct zbc_device *dev,
+				       struct zbc_sg_cmd *cmd)
+{
+	enum zbc_timeout_class timeout_class;
+	unsigned int timeout;
+
+	switch (zbc_sg_cmd_stats_op(cmd)) {
+	case ZBC_STATS_READ:
+		timeout_class = ZBC_TIMEOUT_READ;
+		break;
+	case ZBC_STATS_WRITE:
+		timeout_class = ZBC_TIMEOUT_WRITE;
+		break;
+	case ZBC_STATS_ZONE_OP:
+		timeout_class = ZBC_TIMEOUT_ZONE_OP;
+		break;
+	default:
+		timeout_class = ZBC_TIMEOUT_CTRL;
+		break;
+	}
+
+	timeout = dev->zbd_timeout_ms[timeout_class];
+
+	return timeout ? timeout : ZBC_SG_TIMEOUT;
+}
+
+/**
+ * Execute a command through the bsg (SG v4) node of the device.
+ * The v4 completion status is folded back into the command v3 header
+ * so that zbc_sg_cmd_check() can be used unchanged. The bsg interface
+ * does not support user iovecs, so only single buffer commands can be
+ * issued this way.
+ */
+static int zbc_sg_cmd_exec_v4(struct zbc_device *dev, struct zbc_sg_cmd *cmd)
+{
+	struct sg_io_v4 io_v4;
+	int ret;
+
+	memset(&io_v4, 0, sizeof(io_v4));
+	io_v4.guard = 'Q';
+	io_v4.protocol = BSG_PROTOCOL_SCSI;
+	io_v4.subprotocol = BSG_SUB_PROTOCOL_SCSI_CMD;
+	io_v4.request_len = cmd->cdb_sz;
+	io_v4.request = (uintptr_t)cmd->cdb;
+	io_v4.max_response_len = ZBC_SG_SENSE_MAX_LENGTH;
+	io_v4.response = (uintptr_t)cmd->sense_buf;
+	io_v4.timeout = cmd->io_hdr.timeout;
+	io_v4.flags = BSG_FLAG_Q_AT_TAIL;
+
+	switch (cmd->io_hdr.dxfer_direction) {
+	case SG_DXFER_FROM_DEV:
+		io_v4.din_xferp = (uintptr_t)cmd->io_hdr.dxferp;
+		io_v4.din_xfer_len = cmd->io_hdr.dxfer_len;
+		break;
+	case SG_DXFER_TO_DEV:
+		io_v4.dout_xferp = (uintptr_t)cmd->io_hdr.dxferp;
+		io_v4.dout_xfer_len = cmd->io_hdr.dxfer_len;
+		break;
+	default:
+		break;
+	}
+
+	ret = ioctl(dev->zbd_bsg_fd, SG_IO, &io_v4);
+	if (ret != 0)
+		return ret;
+
+	/* Fold the v4 completion status back into the v3 header */
+	cmd->io_hdr.status = io_v4.device_status;
+	cmd->io_hdr.masked_status = (io_v4.device_status & 0x3e) >> 1;
+	cmd->io_hdr.host_status = io_v4.transport_status;
+	cmd->io_hdr.driver_status = io_v4.driver_status;
+	cmd->io_hdr.sb_len_wr = io_v4.response_len;
+	cmd->io_hdr.duration = io_v4.duration;
+	cmd->io_hdr.resid = io_v4.din_resid + io_v4.dout_resid;
+
+	return 0;
+}
+
+/**
+ * Execute a command.
+ */
+int zbc_sg_cmd_exec(struct zbc_device *dev, struct zbc_sg_cmd *cmd)
+{
+	unsigned long long start;
+	int ret;
+
+	if (zbc_log_debug_enabled()) {
+		zbc_debug("%s: Sending command 0x%02x:0x%02x (%s):\n",
+			  dev->zbd_filename,
+			  cmd->cdb_opcode,
+			  cmd->cdb_sa,
+			  zbc_sg_cmd_name(cmd));
+		zbc_sg_print_bytes(dev, cmd->cdb, cmd->cdb_sz);
+	}
+
+	zbc_debug("%s: Execute %s command with buffer of %zu B\n",
+		  dev->zbd_filename,
+		  (cmd->io_hdr.flags & ZBC_SG_FLAG_DIRECT_IO) ? "direct" : "normal",
+		  cmd->bufsz);
+
+	cmd->io_hdr.timeout = zbc_sg_cmd_timeout(dev, cmd);
+
+	start = zbc_stats_start(dev);
+
+	/* Send the SG_IO command, using the bsg node when available */
+	if (dev->zbd_bsg_fd > 0 && !cmd->io_hdr.iovec_count)
+		ret = zbc_sg_cmd_exec_v4(dev, cmd);
+	else
+		ret = ioctl(dev->zbd_sg_fd, SG_IO, &cmd->io_hdr);
+	if (ret != 0) {
+		ret = -errno;
+		zbc_debug("%s: SG_IO ioctl failed %d (%s)\n",
+			  dev->zbd_filename,
+			  errno,
+			  strerror(errno));
+	} else {
+		ret = zbc_sg_cmd_check(dev, cmd);
+	}
+
+	zbc_stats_account(dev, zbc_sg_cmd_stats_op(cmd), start, ret);
+
+	return ret;
+}
+
+/**
+ * Queue a command through the SG write interface. The command completion
+ * must be reaped with zbc_sg_cmd_reap(). This requires an SG character
+ * device node: the write system call on a block device node would write
+ * the command header as data to the device.
+ */
+int zbc_sg_cmd_submit(struct zbc_device *dev, struct zbc_sg_cmd *cmd)
+{
+	ssize_t ret;
+
+	if (zbc_log_debug_enabled()) {
+		zbc_debug("%s: Queueing command 0x%02x:0x%02x (%s):\n",
+			  dev->zbd_filename,
+			  cmd->cdb_opcode,
+			  cmd->cdb_sa,
+			  zbc_sg_cmd_name(cmd));
+		zbc_sg_print_bytes(dev, cmd->cdb, cmd->cdb_sz);
+	}
+
+	cmd->io_hdr.timeout = zbc_sg_cmd_timeout(dev, cmd);
+
+	/* Queue the command */
+	ret = write(dev->zbd_sg_fd, &cmd->io_hdr, sizeof(sg_io_hdr_t));
+	if (ret != sizeof(sg_io_hdr_t)) {
+		ret = (ret < 0) ? -errno : -EIO;
+		zbc_debug("%s: SG write failed %zd (%s)\n",
+			  dev->zbd_filename,
+			  -ret, strerror(-ret));
+		return ret;
+	}
+
+	return 0;
+}
+
+/**
+ * Reap the completion of a command queued with zbc_sg_cmd_submit().
+ * On success, the updated command header of the completed command is
+ * returned in @hdr. This call blocks until a completion is available.
+ */
+int zbc_sg_cmd_reap(struct zbc_device *dev, sg_io_hdr_t *hdr)
+{
+	ssize_t ret;
+
+	do {
+		ret = read(dev->zbd_sg_fd, hdr, sizeof(sg_io_hdr_t));
+	} while (ret < 0 && errno == EINTR);
+	if (ret != sizeof(sg_io_hdr_t)) {
+		ret = (ret < 0) ? -errno : -EIO;
+		zbc_debug("%s: SG read failed %zd (%s)\n",
+			  dev->zbd_filename,
+			  -ret, strerror(-ret));
+		return ret;
+	}
+
+	return 0;
+}
+
 /**
  * Get a sysfs file integer value.
  */
@@ -546,12 +941,116 @@ out:
 	if (!max_bytes || max_bytes > max_segs * pagesize)
 		max_bytes = max_segs * pagesize;
 	dev->zbd_info.zbd_max_rw_sectors = max_bytes >> 9;
+	dev->zbd_sg_max_rw_sectors = max_bytes >> 9;
 
 	zbc_debug("%s: Maximum command data transfer size is %llu sectors\n",
 		  dev->zbd_filename,
 		  (unsigned long long)dev->zbd_info.zbd_max_rw_sectors);
 }
 
+/**
+ * Get the name of the single entry of a sysfs directory.
+ * Used to resolve the bsg node and disk names of a device.
+ */
+static int zbc_sg_sysfs_link_name(char *dir_path, char *name, size_t name_sz)
+{
+	struct dirent *dirent;
+	int ret = -1;
+	DIR *dir;
+
+	dir = opendir(dir_path);
+	if (!dir)
+		return -1;
+
+	while ((dirent = readdir(dir))) {
+		if (dirent->d_name[0] == '.')
+			continue;
+		snprintf(name, name_sz, "%s", dirent->d_name);
+		ret = 0;
+		break;
+	}
+	closedir(dir);
+
+	return ret;
+}
+
+/**
+ * Open the bsg (SG v4) node of the device, if the device has one.
+ * Unlike the SG v3 interface, bsg commands are bound only by the queue
+ * hardware limits, allowing much larger single command transfers. When
+ * the node is found, raise the device maximum command size accordingly.
+ * This is a best effort: without a bsg node, the device keeps using the
+ * SG v3 interface. Vectored and queued commands cannot use the bsg
+ * node and stay bound by the SG v3 limit kept in zbd_sg_max_rw_sectors.
+ */
+int zbc_sg_open_bsg(struct zbc_device *dev)
+{
+	char path[PATH_MAX], name[256];
+	unsigned long max_kb = 0;
+	uint64_t max_sectors;
+	struct stat st;
+	char *type;
+	int fd;
+
+	if (fstat(dev->zbd_sg_fd, &st) < 0)
+		return -errno;
+
+	if (S_ISCHR(st.st_mode))
+		type = "char";
+	else if (S_ISBLK(st.st_mode))
+		type = "block";
+	else
+		return -ENXIO;
+
+	/* Get the bsg node name of the device */
+	snprintf(path, sizeof(path), "/sys/dev/%s/%u:%u/device/bsg",
+		 type, major(st.st_rdev), minor(st.st_rdev));
+	if (zbc_sg_sysfs_link_name(path, name, sizeof(name)) < 0)
+		return -ENXIO;
+
+	snprintf(path, sizeof(path), "/dev/bsg/%s", name);
+	fd = open(path, O_RDWR);
+	if (fd < 0) {
+		zbc_debug("%s: Open %s failed %d (%s)\n",
+			  dev->zbd_filename, path,
+			  errno, strerror(errno));
+		return -errno;
+	}
+
+	dev->zbd_bsg_fd = fd;
+
+	zbc_debug("%s: Using SG v4 interface %s\n",
+		  dev->zbd_filename, path);
+
+	/* Get the queue hardware transfer limit */
+	if (S_ISBLK(st.st_mode)) {
+		snprintf(path, sizeof(path),
+			 "/sys/dev/block/%u:%u/queue/max_hw_sectors_kb",
+			 major(st.st_rdev), minor(st.st_rdev));
+	} else {
+		/* Get the disk name to reach the queue attributes */
+		snprintf(path, sizeof(path), "/sys/dev/char/%u:%u/device/block",
+			 major(st.st_rdev), minor(st.st_rdev));
+		if (zbc_sg_sysfs_link_name(path, name, sizeof(name)) < 0)
+			return 0;
+		snprintf(path, sizeof(path),
+			 "/sys/block/%s/queue/max_hw_sectors_kb", name);
+	}
+
+	if (zbc_sg_get_sysfs_val(path, &max_kb) == 0) {
+		max_sectors = (uint64_t)max_kb * 2;
+		if (max_sectors > dev->zbd_info.zbd_max_rw_sectors) {
+			dev->zbd_info.zbd_max_rw_sectors = max_sectors;
+			zbc_debug("%s: Maximum command data transfer size "
+				  "raised to %llu sectors\n",
+				  dev->zbd_filename,
+				  (unsigned long long)max_sectors);
+		}
+	}
+
+	return 0;
+}
+
 /**
  * Test if unit is ready. This will retry 5 times if the command
  * returns "UNIT ATTENTION".
@@ -573,7 +1072,6 @@ int zbc_sg_test_unit_ready(struct zbc_device *dev)
 				  dev->zbd_filename);
 			return ret;
 		}
-		cmd.cdb[0] = ZBC_SG_TEST_UNIT_READY_CDB_OPCODE;
 
 		/* Execute the SG_IO command */
 		ret = zbc_sg_cmd_exec(dev, &cmd);
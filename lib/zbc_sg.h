@@ -20,6 +20,7 @@
 #include "zbc.h"
 
 #include <string.h>
+#include <endian.h>
 #include <scsi/scsi.h>
 #include <scsi/sg.h>
 
@@ -147,6 +148,12 @@ enum {
  */
 #define ZBC_SG_CDB_MAX_LENGTH			16
 
+/**
+ * Default command timeout in milliseconds, used for command classes
+ * without a timeout set with zbc_set_timeout().
+ */
+#define ZBC_SG_TIMEOUT				20000
+
 /**
  * Status codes.
  */
@@ -197,6 +204,8 @@ enum {
  */
 struct zbc_sg_cmd {
 
+	struct zbc_device *dev;
+
 	int		code;
 
 	int		cdb_opcode;
@@ -208,6 +217,7 @@ struct zbc_sg_cmd {
 
 	bool		buf_needfree;
 	size_t		bufsz;
+	size_t		buf_allocsz;
 	uint8_t		*buf;
 
 	sg_io_hdr_t	io_hdr;
@@ -248,11 +258,31 @@ extern void zbc_sg_cmd_destroy(struct zbc_sg_cmd *cmd);
  */
 extern void zbc_sg_get_max_cmd_blocks(struct zbc_device *dev);
 
+/**
+ * Open the bsg (SG v4) node of the device, if it has one.
+ */
+extern int zbc_sg_open_bsg(struct zbc_device *dev);
+
 /**
  * Execute a command.
  */
 extern int zbc_sg_cmd_exec(struct zbc_device *dev, struct zbc_sg_cmd *cmd);
 
+/**
+ * Queue a command through the SG write interface (SG nodes only).
+ */
+extern int zbc_sg_cmd_submit(struct zbc_device *dev, struct zbc_sg_cmd *cmd);
+
+/**
+ * Reap the completion of a queued command.
+ */
+extern int zbc_sg_cmd_reap(struct zbc_device *dev, sg_io_hdr_t *hdr);
+
+/**
+ * Check the completion status of an executed command.
+ */
+extern int zbc_sg_cmd_check(struct zbc_device *dev, struct zbc_sg_cmd *cmd);
+
 /**
  * Test if unit is ready. This will retry 5 times if the command
  * returns "UNIT ATTENTION".
@@ -269,7 +299,9 @@ extern void zbc_sg_set_bytes(uint8_t *cmd, void *buf, int bytes);
  */
 static inline void zbc_sg_set_int64(uint8_t *buf, uint64_t val)
 {
-	zbc_sg_set_bytes(buf, &val, 8);
+	uint64_t be = htobe64(val);
+
+	memcpy(buf, &be, 8);
 }
 
 /**
@@ -277,7 +309,9 @@ static inline void zbc_sg_set_int64(uint8_t *buf, uint64_t val)
  */
 static inline void zbc_sg_set_int32(uint8_t *buf, uint32_t val)
 {
-	zbc_sg_set_bytes(buf, &val, 4);
+	uint32_t be = htobe32(val);
+
+	memcpy(buf, &be, 4);
 }
 
 /**
@@ -285,7 +319,9 @@ static inline void zbc_sg_set_int32(uint8_t *buf, uint32_t val)
  */
 static inline void zbc_sg_set_int16(uint8_t *buf, uint16_t val)
 {
-	zbc_sg_set_bytes(buf, &val, 2);
+	uint16_t be = htobe16(val);
+
+	memcpy(buf, &be, 2);
 }
 
 /**
@@ -309,11 +345,11 @@ extern void zbc_sg_get_bytes(uint8_t *val, union converter *conv,
  */
 static inline uint64_t zbc_sg_get_int64(uint8_t *buf)
 {
-	union converter conv;
+	uint64_t be;
 
-	zbc_sg_get_bytes(buf, &conv, 8);
+	memcpy(&be, buf, 8);
 
-	return conv.val64;
+	return be64toh(be);
 }
 
 /**
@@ -321,11 +357,11 @@ static inline uint64_t zbc_sg_get_int64(uint8_t *buf)
  */
 static inline uint32_t zbc_sg_get_int32(uint8_t *buf)
 {
-	union converter conv;
+	uint32_t be;
 
-	zbc_sg_get_bytes(buf, &conv, 4);
+	memcpy(&be, buf, 4);
 
-	return conv.val32;
+	return be32toh(be);
 }
 
 /**
@@ -333,11 +369,11 @@ static inline uint32_t zbc_sg_get_int32(uint8_t *buf)
  */
 static inline uint16_t zbc_sg_get_int16(uint8_t *buf)
 {
-	union converter conv;
+	uint16_t be;
 
-	zbc_sg_get_bytes(buf, &conv, 2);
+	memcpy(&be, buf, 2);
 
-	return conv.val16;
+	return be16toh(be);
 }
 
 /**
@@ -0,0 +1,428 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see <http://opensource.org/licenses/BSD-2-Clause>.
+ */
+
+#include "zbc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Shared zone cache segment magic and layout version.
+ */
+#define ZBC_SHM_MAGIC		0x7a626353	/* "zbcS" */
+#define ZBC_SHM_VERSION		1
+
+/**
+ * Segment initialization states.
+ */
+#define ZBC_SHM_UNINIT		0
+#define ZBC_SHM_INITIALIZING	1
+#define ZBC_SHM_READY		2
+
+/**
+ * A shared zone entry: the zone information of one zone, protected by
+ * a sequence lock. The sequence is even when the entry is stable and
+ * odd while a writer is updating it; writers acquire it with a compare
+ * and exchange so that concurrent updaters of the same entry are also
+ * serialized.
+ */
+struct zbc_shm_zone {
+
+	uint32_t		seq;
+	uint32_t		reserved;
+	struct zbc_zone		zone;
+
+};
+
+/**
+ * Header of a shared zone cache segment. The header sequence lock
+ * protects the generation and stale fields. The generation is bumped
+ * on every full publish of the zone array and is 0 until the first
+ * publish, the stale flag is raised by a process that could not apply
+ * an operation result to its cache, forcing the next refresh to read
+ * from the device instead of the shared copy.
+ */
+struct zbc_shm_header {
+
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		init;
+	uint32_t		nr_zones;
+	uint32_t		seq;
+	uint32_t		stale;
+	uint64_t		generation;
+	struct zbc_shm_zone	zones[];
+
+};
+
+/**
+ * Shared zone cache attachment state of a device.
+ */
+struct zbc_shm {
+
+	/**
+	 * Name of the shared memory segment.
+	 */
+	char			zbs_name[NAME_MAX];
+
+	/**
+	 * Mapped segment and its size.
+	 */
+	struct zbc_shm_header	*zbs_hdr;
+	size_t			zbs_size;
+
+};
+
+/**
+ * Acquire a sequence lock for writing: wait for an even sequence and
+ * atomically move it to the next odd value.
+ */
+static uint32_t zbc_shm_write_lock(uint32_t *seq)
+{
+	uint32_t s;
+
+	for (;;) {
+		s = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+		if (!(s & 1) &&
+		    __atomic_compare_exchange_n(seq, &s, s + 1, false,
+						__ATOMIC_ACQUIRE,
+						__ATOMIC_RELAXED))
+			return s + 1;
+		sched_yield();
+	}
+}
+
+/**
+ * Release a sequence lock acquired with zbc_shm_write_lock().
+ */
+static void zbc_shm_write_unlock(uint32_t *seq, uint32_t s)
+{
+	__atomic_store_n(seq, s + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy a shared zone entry, retrying while a writer is updating it.
+ */
+static void zbc_shm_read_zone(struct zbc_shm_zone *e, struct zbc_zone *zone)
+{
+	uint32_t s;
+
+	do {
+		s = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+		if (s & 1) {
+			sched_yield();
+			continue;
+		}
+		memcpy(zone, &e->zone, sizeof(struct zbc_zone));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != s);
+}
+
+/**
+ * Build the shared memory segment name of a device. The zone
+ * configuration of a drive does not identify it uniquely, so the
+ * segment is keyed by the identity of the device node: the device
+ * numbers for block and character device nodes, and the file system
+ * identity for the regular files of the emulation backend. All
+ * processes opening the same device node share the segment.
+ */
+static int zbc_shm_name(struct zbc_device *dev, char *name, size_t sz)
+{
+	struct stat st;
+
+	if (fstat(dev->zbd_fd, &st) < 0)
+		return -errno;
+
+	if (S_ISBLK(st.st_mode) || S_ISCHR(st.st_mode))
+		snprintf(name, sz, "/libzbc-zcache-dev-%llx",
+			 (unsigned long long)st.st_rdev);
+	else
+		snprintf(name, sz, "/libzbc-zcache-file-%llx-%llx",
+			 (unsigned long long)st.st_dev,
+			 (unsigned long long)st.st_ino);
+
+	return 0;
+}
+
+/**
+ * zbc_shm_detach - Detach the shared zone cache of a device
+ *
+ * The segment itself is left in place for the other attached processes.
+ */
+void zbc_shm_detach(struct zbc_device *dev)
+{
+	struct zbc_shm *shm = dev->zbd_shm;
+
+	if (!shm)
+		return;
+
+	munmap(shm->zbs_hdr, shm->zbs_size);
+	free(shm);
+
+	dev->zbd_shm = NULL;
+}
+
+/**
+ * zbc_shm_set_stale - Mark the shared zone cache stale
+ *
+ * Called when the local zone cache is invalidated: the shared copy can
+ * no longer be trusted and the next refresh must read from the device.
+ */
+void zbc_shm_set_stale(struct zbc_device *dev)
+{
+	struct zbc_shm *shm = dev->zbd_shm;
+	uint32_t s;
+
+	if (!shm)
+		return;
+
+	s = zbc_shm_write_lock(&shm->zbs_hdr->seq);
+	shm->zbs_hdr->stale = 1;
+	zbc_shm_write_unlock(&shm->zbs_hdr->seq, s);
+}
+
+/**
+ * zbc_shm_update_zone - Publish one cached zone to the shared cache
+ */
+void zbc_shm_update_zone(struct zbc_device *dev, struct zbc_zone *zone)
+{
+	struct zbc_shm *shm = dev->zbd_shm;
+	unsigned int i = zone - dev->zbd_zones;
+	struct zbc_shm_zone *e;
+	uint32_t s;
+
+	if (!shm || i >= shm->zbs_hdr->nr_zones)
+		return;
+
+	e = &shm->zbs_hdr->zones[i];
+	s = zbc_shm_write_lock(&e->seq);
+	memcpy(&e->zone, zone, sizeof(struct zbc_zone));
+	zbc_shm_write_unlock(&e->seq, s);
+}
+
+/**
+ * zbc_shm_publish - Publish the entire zone cache to the shared cache
+ *
+ * Called after the local cache was refreshed from the device: copy the
+ * zone array to the shared segment, clear the stale flag and bump the
+ * generation so that the other attached processes can refresh from the
+ * shared copy instead of the device.
+ */
+void zbc_shm_publish(struct zbc_device *dev)
+{
+	struct zbc_shm *shm = dev->zbd_shm;
+	struct zbc_shm_zone *e;
+	unsigned int i;
+	uint32_t s, es;
+
+	if (!shm)
+		return;
+
+	if (shm->zbs_hdr->nr_zones != dev->zbd_nr_zones) {
+		/* The segment no longer matches the device: do not use it */
+		zbc_warning("%s: Shared zone cache has %u zones, device has %u\n",
+			    dev->zbd_filename,
+			    shm->zbs_hdr->nr_zones, dev->zbd_nr_zones);
+		zbc_shm_detach(dev);
+		return;
+	}
+
+	s = zbc_shm_write_lock(&shm->zbs_hdr->seq);
+
+	for (i = 0; i < dev->zbd_nr_zones; i++) {
+		e = &shm->zbs_hdr->zones[i];
+		es = zbc_shm_write_lock(&e->seq);
+		memcpy(&e->zone, &dev->zbd_zones[i], sizeof(struct zbc_zone));
+		zbc_shm_write_unlock(&e->seq, es);
+	}
+
+	shm->zbs_hdr->stale = 0;
+	shm->zbs_hdr->generation++;
+
+	zbc_shm_write_unlock(&shm->zbs_hdr->seq, s);
+}
+
+/**
+ * zbc_shm_pull - Refresh the local zone cache from the shared cache
+ *
+ * Returns true if the local zone array was filled from the shared
+ * copy, false if the shared cache is not attached, was never published
+ * or is stale, in which case the caller must refresh from the device.
+ */
+bool zbc_shm_pull(struct zbc_device *dev)
+{
+	struct zbc_shm *shm = dev->zbd_shm;
+	unsigned int i, nr_zones;
+	struct zbc_zone *zones;
+	uint32_t s;
+
+	if (!shm)
+		return false;
+
+retry:
+	s = __atomic_load_n(&shm->zbs_hdr->seq, __ATOMIC_ACQUIRE);
+	if (s & 1) {
+		sched_yield();
+		goto retry;
+	}
+
+	if (!shm->zbs_hdr->generation || shm->zbs_hdr->stale)
+		return false;
+
+	nr_zones = shm->zbs_hdr->nr_zones;
+	if (nr_zones != dev->zbd_nr_zones) {
+		zones = (struct zbc_zone *)
+			realloc(dev->zbd_zones,
+				(size_t)nr_zones * sizeof(struct zbc_zone));
+		if (!zones)
+			return false;
+		dev->zbd_zones = zones;
+		dev->zbd_nr_zones = nr_zones;
+	}
+
+	for (i = 0; i < nr_zones; i++)
+		zbc_shm_read_zone(&shm->zbs_hdr->zones[i],
+				  &dev->zbd_zones[i]);
+
+	/* Retry if a full publish raced with the copy */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&shm->zbs_hdr->seq, __ATOMIC_RELAXED) != s)
+		goto retry;
+
+	return true;
+}
+
+/**
+ * Initialize a newly created segment, or wait until the creating
+ * process finished initializing it.
+ */
+static int zbc_shm_init(struct zbc_device *dev, struct zbc_shm_header *hdr)
+{
+	uint32_t init = ZBC_SHM_UNINIT;
+
+	if (__atomic_compare_exchange_n(&hdr->init, &init,
+					ZBC_SHM_INITIALIZING, false,
+					__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+		hdr->magic = ZBC_SHM_MAGIC;
+		hdr->version = ZBC_SHM_VERSION;
+		hdr->nr_zones = dev->zbd_nr_zones;
+		hdr->seq = 0;
+		hdr->stale = 0;
+		hdr->generation = 0;
+		__atomic_store_n(&hdr->init, ZBC_SHM_READY, __ATOMIC_RELEASE);
+	} else {
+		while (__atomic_load_n(&hdr->init, __ATOMIC_ACQUIRE) !=
+		       ZBC_SHM_READY)
+			sched_yield();
+	}
+
+	if (hdr->magic != ZBC_SHM_MAGIC ||
+	    hdr->version != ZBC_SHM_VERSION ||
+	    hdr->nr_zones != dev->zbd_nr_zones) {
+		zbc_error("%s: Incompatible shared zone cache segment\n",
+			  dev->zbd_filename);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_set_shared_zone_cache - Attach or detach the shared zone cache
+ */
+int zbc_set_shared_zone_cache(struct zbc_device *dev, bool enable)
+{
+	struct zbc_shm *shm;
+	size_t size;
+	int fd, ret;
+
+	if (!enable) {
+		zbc_shm_detach(dev);
+		return 0;
+	}
+
+	if (dev->zbd_shm)
+		return 0;
+
+	/* The shared cache builds on the local zone cache */
+	if (!dev->zbd_zone_cache) {
+		ret = zbc_set_zone_cache(dev, true);
+		if (ret != 0)
+			return ret;
+	} else if (!dev->zbd_zone_cache_valid) {
+		ret = zbc_refresh_zone_cache(dev);
+		if (ret != 0)
+			return ret;
+	}
+
+	shm = calloc(1, sizeof(struct zbc_shm));
+	if (!shm)
+		return -ENOMEM;
+
+	ret = zbc_shm_name(dev, shm->zbs_name, sizeof(shm->zbs_name));
+	if (ret != 0)
+		goto err_free;
+
+	fd = shm_open(shm->zbs_name, O_CREAT | O_RDWR, 0666);
+	if (fd < 0) {
+		ret = -errno;
+		zbc_error("%s: Open shared zone cache %s failed %d (%s)\n",
+			  dev->zbd_filename, shm->zbs_name,
+			  errno, strerror(errno));
+		goto err_free;
+	}
+
+	size = sizeof(struct zbc_shm_header) +
+		(size_t)dev->zbd_nr_zones * sizeof(struct zbc_shm_zone);
+	if (ftruncate(fd, size) < 0) {
+		ret = -errno;
+		close(fd);
+		goto err_free;
+	}
+
+	shm->zbs_hdr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm->zbs_hdr == MAP_FAILED) {
+		ret = -errno;
+		goto err_free;
+	}
+	shm->zbs_size = size;
+
+	ret = zbc_shm_init(dev, shm->zbs_hdr);
+	if (ret != 0) {
+		munmap(shm->zbs_hdr, size);
+		goto err_free;
+	}
+
+	dev->zbd_shm = shm;
+
+	/* Publish the local cache if no process has published one yet */
+	if (!shm->zbs_hdr->generation)
+		zbc_shm_publish(dev);
+
+	zbc_debug("%s: Shared zone cache %s attached, %u zones\n",
+		  dev->zbd_filename, shm->zbs_name, dev->zbd_nr_zones);
+
+	return 0;
+
+err_free:
+	free(shm);
+
+	return ret;
+}
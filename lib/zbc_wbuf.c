@@ -0,0 +1,424 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see <http://opensource.org/licenses/BSD-2-Clause>.
+ */
+
+#include "zbc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Number of zones that can have staged write data at the same time.
+ */
+#define ZBC_WBUF_ZONES		8
+
+/**
+ * Per-zone write staging state.
+ */
+struct zbc_wbuf_zone {
+
+	/**
+	 * Start and end (start + length) sectors of the zone.
+	 */
+	uint64_t		start;
+	uint64_t		end;
+
+	/**
+	 * Device sector of the first staged sector: the data staged in
+	 * the buffer covers the sectors [sector, sector + staged).
+	 */
+	uint64_t		sector;
+
+	/**
+	 * Staging buffer and the number of sectors staged in it.
+	 */
+	uint8_t			*buf;
+	size_t			staged;
+
+	/**
+	 * Time the oldest staged sector was staged (milliseconds).
+	 */
+	unsigned long long	stamp;
+
+	/**
+	 * Slot in use.
+	 */
+	bool			used;
+
+};
+
+/**
+ * Write coalescing state of a device.
+ */
+struct zbc_wbuf {
+
+	/**
+	 * Per-zone staging slots.
+	 */
+	struct zbc_wbuf_zone	zbw_zones[ZBC_WBUF_ZONES];
+
+	/**
+	 * Staging buffer size (512B sectors).
+	 */
+	size_t			zbw_bufsz;
+
+	/**
+	 * Maximum age of staged data before it is flushed
+	 * (milliseconds, 0 for no age limit).
+	 */
+	unsigned int		zbw_hold;
+
+};
+
+/**
+ * Monotonic time in milliseconds.
+ */
+static unsigned long long zbc_wbuf_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long)ts.tv_sec * 1000ULL +
+		(unsigned long long)ts.tv_nsec / 1000000;
+}
+
+/**
+ * Write out the staged data of a slot. The slot is retired when the
+ * staged data reached the end of its zone. A failed flush drops the
+ * staged data, as an unbuffered write failure would leave the same
+ * sectors unwritten.
+ */
+static int zbc_wbuf_flush_zone(struct zbc_device *dev,
+			       struct zbc_wbuf_zone *z)
+{
+	struct iovec iov = { z->buf, z->staged };
+	ssize_t ret;
+
+	if (!z->staged)
+		return 0;
+
+	ret = zbc_do_pwritev(dev, &iov, 1, z->sector);
+	if (ret != (ssize_t)z->staged) {
+		zbc_error("%s: Flush of %zu staged sectors at sector %llu "
+			  "failed %zd\n",
+			  dev->zbd_filename,
+			  z->staged, (unsigned long long)z->sector, ret);
+		z->staged = 0;
+		z->used = false;
+		return ret < 0 ? ret : -EIO;
+	}
+
+	z->sector += z->staged;
+	z->staged = 0;
+	if (z->sector >= z->end)
+		z->used = false;
+
+	return 0;
+}
+
+/**
+ * zbc_wbuf_flush - Write out all staged data of a device
+ */
+int zbc_wbuf_flush(struct zbc_device *dev)
+{
+	struct zbc_wbuf *wbuf = dev->zbd_wbuf;
+	int i, ret, err = 0;
+
+	if (!wbuf)
+		return 0;
+
+	for (i = 0; i < ZBC_WBUF_ZONES; i++) {
+		ret = zbc_wbuf_flush_zone(dev, &wbuf->zbw_zones[i]);
+		if (ret != 0 && !err)
+			err = ret;
+	}
+
+	return err;
+}
+
+/**
+ * Write out the staged data that has been held longer than the
+ * configured age limit.
+ */
+static int zbc_wbuf_flush_aged(struct zbc_device *dev)
+{
+	struct zbc_wbuf *wbuf = dev->zbd_wbuf;
+	struct zbc_wbuf_zone *z;
+	unsigned long long now;
+	int i, ret;
+
+	if (!wbuf->zbw_hold)
+		return 0;
+
+	now = zbc_wbuf_now();
+	for (i = 0; i < ZBC_WBUF_ZONES; i++) {
+		z = &wbuf->zbw_zones[i];
+		if (z->used && z->staged &&
+		    now - z->stamp >= wbuf->zbw_hold) {
+			ret = zbc_wbuf_flush_zone(dev, z);
+			if (ret != 0)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * zbc_wbuf_free - Release the write coalescing state of a device
+ *
+ * Any remaining staged data is written out first; as this path cannot
+ * report an error to the caller, applications should call zbc_flush()
+ * before closing the device to catch write errors.
+ */
+void zbc_wbuf_free(struct zbc_device *dev)
+{
+	struct zbc_wbuf *wbuf = dev->zbd_wbuf;
+	int i;
+
+	if (!wbuf)
+		return;
+
+	zbc_wbuf_flush(dev);
+
+	for (i = 0; i < ZBC_WBUF_ZONES; i++)
+		zbc_buf_free(dev, wbuf->zbw_zones[i].buf,
+			     wbuf->zbw_bufsz << 9);
+	free(wbuf);
+
+	dev->zbd_wbuf = NULL;
+}
+
+/**
+ * Get a staging slot for the zone containing a sector, flushing the
+ * slot with the oldest staged data if all slots are busy. Returns NULL
+ * if the zone cannot be resolved or no staging buffer can be
+ * allocated, in which case the caller falls back to an unbuffered
+ * write.
+ */
+static struct zbc_wbuf_zone *zbc_wbuf_get_zone(struct zbc_device *dev,
+					       uint64_t sector)
+{
+	struct zbc_wbuf *wbuf = dev->zbd_wbuf;
+	struct zbc_wbuf_zone *z, *victim = NULL;
+	struct zbc_zone zone;
+	unsigned int nr_zones = 1;
+	int i, ret;
+
+	for (i = 0; i < ZBC_WBUF_ZONES; i++) {
+		z = &wbuf->zbw_zones[i];
+		if (!z->used) {
+			victim = z;
+			break;
+		}
+		if (!victim || z->stamp < victim->stamp)
+			victim = z;
+	}
+
+	if (victim->used) {
+		ret = zbc_wbuf_flush_zone(dev, victim);
+		if (ret != 0)
+			return NULL;
+		victim->used = false;
+	}
+
+	/* Get the zone containing the sector to bound the staged data */
+	ret = zbc_report_zones_cached(dev, sector, ZBC_RO_ALL,
+				      &zone, &nr_zones);
+	if (ret != 0 || !nr_zones ||
+	    zbc_zone_start(&zone) > sector)
+		return NULL;
+
+	if (!victim->buf) {
+		victim->buf = zbc_buf_alloc(dev, wbuf->zbw_bufsz << 9);
+		if (!victim->buf)
+			return NULL;
+	}
+
+	victim->start = zbc_zone_start(&zone);
+	victim->end = zbc_zone_start(&zone) + zbc_zone_length(&zone);
+	victim->sector = sector;
+	victim->staged = 0;
+	victim->used = true;
+
+	return victim;
+}
+
+/**
+ * Find the slot staging the zone that contains a sector.
+ */
+static struct zbc_wbuf_zone *zbc_wbuf_find_zone(struct zbc_device *dev,
+						uint64_t sector)
+{
+	struct zbc_wbuf *wbuf = dev->zbd_wbuf;
+	struct zbc_wbuf_zone *z;
+	int i;
+
+	for (i = 0; i < ZBC_WBUF_ZONES; i++) {
+		z = &wbuf->zbw_zones[i];
+		if (z->used && sector >= z->start && sector < z->end)
+			return z;
+	}
+
+	return NULL;
+}
+
+/**
+ * zbc_wbuf_pwrite - Serve a write of a device with coalescing enabled
+ */
+ssize_t zbc_wbuf_pwrite(struct zbc_device *dev, const void *buf, size_t count,
+			uint64_t offset)
+{
+	struct zbc_wbuf *wbuf = dev->zbd_wbuf;
+	const uint8_t *b = buf;
+	struct zbc_wbuf_zone *z;
+	struct iovec iov;
+	size_t total = count, append;
+	ssize_t ret;
+
+	/*
+	 * Pass zero-length and unaligned writes through unbuffered:
+	 * staging them would only delay the error the device write
+	 * path reports for them. Any data staged for the target zone
+	 * is written out first to preserve the write order.
+	 */
+	if (!count || !zbc_dev_sect_paligned(dev, count) ||
+	    !zbc_dev_sect_paligned(dev, offset)) {
+		z = zbc_wbuf_find_zone(dev, offset);
+		if (z) {
+			ret = zbc_wbuf_flush_zone(dev, z);
+			if (ret != 0)
+				return ret;
+		}
+		iov.iov_base = (void *)buf;
+		iov.iov_len = count;
+		return zbc_do_pwritev(dev, &iov, 1, offset);
+	}
+
+	ret = zbc_wbuf_flush_aged(dev);
+	if (ret != 0)
+		return ret;
+
+	while (count) {
+
+		z = zbc_wbuf_find_zone(dev, offset);
+		if (z && z->sector + z->staged != offset) {
+			/*
+			 * The write does not continue the staged stream
+			 * of the zone: write out the staged data and
+			 * restage from the new position.
+			 */
+			ret = zbc_wbuf_flush_zone(dev, z);
+			if (ret != 0)
+				return ret;
+			if (!z->used)
+				/* The slot was retired: re-acquire one */
+				continue;
+			z->sector = offset;
+		} else if (!z) {
+			if (count >= wbuf->zbw_bufsz)
+				/* Too large to benefit from staging */
+				break;
+			z = zbc_wbuf_get_zone(dev, offset);
+			if (!z)
+				break;
+		}
+
+		append = wbuf->zbw_bufsz - z->staged;
+		if (append > z->end - offset)
+			append = z->end - offset;
+		if (append > count)
+			append = count;
+
+		if (!append) {
+			/* The write runs past the end of the zone */
+			ret = zbc_wbuf_flush_zone(dev, z);
+			if (ret != 0)
+				return ret;
+			break;
+		}
+
+		if (!z->staged)
+			z->stamp = zbc_wbuf_now();
+		memcpy(z->buf + (z->staged << 9), b, append << 9);
+		z->staged += append;
+
+		b += append << 9;
+		offset += append;
+		count -= append;
+
+		if (z->staged == wbuf->zbw_bufsz ||
+		    z->sector + z->staged >= z->end) {
+			ret = zbc_wbuf_flush_zone(dev, z);
+			if (ret != 0)
+				return ret;
+		}
+
+	}
+
+	if (count) {
+		/* Write out what could not be staged */
+		iov.iov_base = (void *)b;
+		iov.iov_len = count;
+		ret = zbc_do_pwritev(dev, &iov, 1, offset);
+		if (ret < 0)
+			return ret;
+		if ((size_t)ret != count)
+			return total - count + ret;
+	}
+
+	return total;
+}
+
+/**
+ * zbc_set_write_coalescing - Enable or disable write coalescing
+ */
+int zbc_set_write_coalescing(struct zbc_device *dev, size_t bufsz,
+			     unsigned int hold_ms)
+{
+	struct zbc_wbuf *wbuf;
+	size_t sectors;
+
+	/* Flush and release any current staging state */
+	if (dev->zbd_wbuf) {
+		int ret = zbc_wbuf_flush(dev);
+
+		if (ret != 0)
+			return ret;
+		zbc_wbuf_free(dev);
+	}
+
+	if (!bufsz)
+		return 0;
+
+	/* Stage full physical blocks, in at most one command worth */
+	sectors = (bufsz + dev->zbd_info.zbd_pblock_size - 1) /
+		dev->zbd_info.zbd_pblock_size *
+		(dev->zbd_info.zbd_pblock_size >> 9);
+	if (sectors > dev->zbd_info.zbd_max_rw_sectors)
+		sectors = dev->zbd_info.zbd_max_rw_sectors /
+			(dev->zbd_info.zbd_pblock_size >> 9) *
+			(dev->zbd_info.zbd_pblock_size >> 9);
+	if (!sectors)
+		return -EINVAL;
+
+	wbuf = calloc(1, sizeof(struct zbc_wbuf));
+	if (!wbuf)
+		return -ENOMEM;
+
+	wbuf->zbw_bufsz = sectors;
+	wbuf->zbw_hold = hold_ms;
+
+	dev->zbd_wbuf = wbuf;
+
+	return 0;
+}
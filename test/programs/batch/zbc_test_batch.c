@@ -0,0 +1,498 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the BSD 2-clause license,
+ * "as is," without technical support, and WITHOUT ANY WARRANTY, without
+ * even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ * PURPOSE. You should have received a copy of the BSD 2-clause license along
+ * with libzbc. If not, see  <http://opensource.org/licenses/BSD-2-Clause>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libzbc/zbc.h"
+#include "zbc_private.h"
+
+/**
+ * Maximum number of words of a test case line.
+ */
+#define ZBC_TEST_BATCH_MAX_ARGS		16
+
+/**
+ * Maximum length of a test case line.
+ */
+#define ZBC_TEST_BATCH_MAX_LINE		512
+
+/**
+ * Print the sense key and additional sense code of the last
+ * failed command of the device.
+ */
+static void zbc_test_print_sense(struct zbc_device *dev)
+{
+	struct zbc_errno zbc_err;
+
+	zbc_errno(dev, &zbc_err);
+	printf("[TEST][ERROR][SENSE_KEY],%s\n",
+	       zbc_sk_str(zbc_err.sk));
+	printf("[TEST][ERROR][ASC_ASCQ],%s\n",
+	       zbc_asc_ascq_str(zbc_err.asc_ascq));
+}
+
+/**
+ * print_devinfo case: no argument.
+ */
+static int zbc_test_batch_devinfo(struct zbc_device *dev,
+				  struct zbc_device_info *info,
+				  int argc, char **argv)
+{
+	struct zbc_zone *zones, last_zone;
+	unsigned int nr_zones;
+	int ret;
+
+	/* Get the last zone of the device */
+	ret = zbc_list_zones(dev, 0, ZBC_RO_ALL, &zones, &nr_zones);
+	if (ret != 0) {
+		fprintf(stderr,
+			"[TEST][ERROR],zbc_list_zones failed %d\n",
+			ret);
+		zbc_test_print_sense(dev);
+		return 1;
+	}
+	memcpy(&last_zone, &zones[nr_zones - 1], sizeof(struct zbc_zone));
+	free(zones);
+
+	fprintf(stdout,
+		"[TEST][INFO][DEVICE_MODEL],%s\n",
+		zbc_device_model_str(info->zbd_model));
+
+	fprintf(stdout,
+		"[TEST][INFO][MAX_NUM_OF_OPEN_SWRZ],%d\n",
+		info->zbd_max_nr_open_seq_req);
+
+	fprintf(stdout,
+		"[TEST][INFO][MAX_LBA],%llu\n",
+		(unsigned long long)info->zbd_lblocks - 1);
+
+	fprintf(stdout,
+		"[TEST][INFO][LOGICAL_BLOCK_SIZE],%llu\n",
+		(unsigned long long)info->zbd_lblock_size);
+
+	fprintf(stdout,
+		"[TEST][INFO][PHYSICAL_BLOCK_SIZE],%llu\n",
+		(unsigned long long)info->zbd_pblock_size);
+
+	fprintf(stdout,
+		"[TEST][INFO][URSWRZ],%x\n",
+		info->zbd_flags);
+
+	fprintf(stdout,
+		"[TEST][INFO][LAST_ZONE_LBA],%llu\n",
+		(unsigned long long)zbc_sect2lba(info, zbc_zone_start(&last_zone)));
+
+	fprintf(stdout,
+		"[TEST][INFO][LAST_ZONE_SIZE],%llu\n",
+		(unsigned long long)zbc_sect2lba(info, zbc_zone_length(&last_zone)));
+
+	return 0;
+}
+
+/**
+ * report_zones case: [-lba <lba>] [-ro <opt>] [-p]
+ */
+static int zbc_test_batch_report_zones(struct zbc_device *dev,
+				       struct zbc_device_info *info,
+				       int argc, char **argv)
+{
+	enum zbc_reporting_options ro = ZBC_RO_ALL;
+	enum zbc_reporting_options partial = 0;
+	unsigned long long lba = 0;
+	struct zbc_zone *z, *zones = NULL;
+	unsigned int nr_zones;
+	int i, ret;
+
+	/* Parse options */
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-lba") == 0) {
+			if (i >= argc - 1)
+				return 1;
+			i++;
+			lba = strtoll(argv[i], NULL, 10);
+		} else if (strcmp(argv[i], "-ro") == 0) {
+			if (i >= argc - 1)
+				return 1;
+			i++;
+			ro = atoi(argv[i]);
+		} else if (strcmp(argv[i], "-p") == 0) {
+			partial = ZBC_RO_PARTIAL;
+		} else {
+			fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
+			return 1;
+		}
+	}
+
+	ro |= partial;
+
+	/* Get the number of zones */
+	ret = zbc_report_nr_zones(dev, zbc_lba2sect(info, lba), ro, &nr_zones);
+	if (ret != 0) {
+		fprintf(stderr, "[TEST][ERROR],zbc_report_nr_zones lba %llu, ro 0x%02x failed %d\n",
+			lba, (unsigned int)ro, ret);
+		zbc_test_print_sense(dev);
+		return 1;
+	}
+
+	/* Allocate zone array */
+	zones = (struct zbc_zone *) calloc(nr_zones, sizeof(struct zbc_zone));
+	if (!zones) {
+		fprintf(stderr, "[TEST][ERROR],No memory\n");
+		return 1;
+	}
+
+	/* Get zone information */
+	ret = zbc_report_zones(dev, zbc_lba2sect(info, lba), ro,
+			       zones, &nr_zones);
+	if (ret != 0) {
+		fprintf(stderr,
+			"[TEST][ERROR],zbc_report_zones failed %d\n",
+			ret);
+		zbc_test_print_sense(dev);
+		free(zones);
+		return 1;
+	}
+
+	for (i = 0; i < (int)nr_zones; i++) {
+		z = &zones[i];
+		if (zbc_zone_conventional(z))
+			printf("[ZONE_INFO],%05d,0x%x,0x%x,%llu,%llu,N/A\n",
+			       i,
+			       zbc_zone_type(z),
+			       zbc_zone_condition(z),
+			       zbc_sect2lba(info, zbc_zone_start(z)),
+			       zbc_sect2lba(info, zbc_zone_length(z)));
+		else
+			printf("[ZONE_INFO],%05d,0x%x,0x%x,%llu,%llu,%llu\n",
+			       i,
+			       zbc_zone_type(z),
+			       zbc_zone_condition(z),
+			       zbc_sect2lba(info, zbc_zone_start(z)),
+			       zbc_sect2lba(info, zbc_zone_length(z)),
+			       zbc_sect2lba(info, zbc_zone_wp(z)));
+	}
+
+	free(zones);
+
+	return 0;
+}
+
+/**
+ * reset_zone, open_zone, close_zone and finish_zone cases: <lba>,
+ * with -1 addressing all zones of the device.
+ */
+static int zbc_test_batch_zone_op(struct zbc_device *dev,
+				  struct zbc_device_info *info,
+				  int argc, char **argv)
+{
+	enum zbc_zone_op op;
+	unsigned int flags = 0;
+	long long lba;
+	int ret;
+
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <lba>\n", argv[0]);
+		return 1;
+	}
+
+	if (strcmp(argv[0], "reset_zone") == 0)
+		op = ZBC_OP_RESET_ZONE;
+	else if (strcmp(argv[0], "open_zone") == 0)
+		op = ZBC_OP_OPEN_ZONE;
+	else if (strcmp(argv[0], "close_zone") == 0)
+		op = ZBC_OP_CLOSE_ZONE;
+	else
+		op = ZBC_OP_FINISH_ZONE;
+
+	lba = atoll(argv[1]);
+	if (lba == -1) {
+		flags = ZBC_OP_ALL_ZONES;
+		lba = 0;
+	}
+
+	ret = zbc_zone_operation(dev, zbc_lba2sect(info, lba), op, flags);
+	if (ret != 0) {
+		fprintf(stderr,
+			"[TEST][ERROR],zbc_test_%s failed %d\n",
+			argv[0], ret);
+		zbc_test_print_sense(dev);
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * read_zone and write_zone cases: [-p <num>] [-n <nio>] <lba> <num lba>
+ */
+static int zbc_test_batch_rw_zone(struct zbc_device *dev,
+				  struct zbc_device_info *info,
+				  int argc, char **argv)
+{
+	unsigned long long lba, sector, start_sect;
+	unsigned int lba_count, sector_count;
+	int i, nio = 1, pattern = 0;
+	bool read, ptrn_set = false;
+	unsigned char *b;
+	void *iobuf = NULL;
+	size_t bufsize;
+	ssize_t ret;
+	char *end;
+
+	read = strcmp(argv[0], "read_zone") == 0;
+
+	/* Parse options */
+	for (i = 1; i < argc - 2; i++) {
+		if (strcmp(argv[i], "-p") == 0) {
+			if (i >= argc - 1)
+				return 1;
+			i++;
+			pattern = strtol(argv[i], &end, 0);
+			if (*end != '\0' || pattern > 0xff) {
+				fprintf(stderr,
+					"Invalid data pattern value \"%s\"\n",
+					argv[i]);
+				return 1;
+			}
+			ptrn_set = true;
+		} else if (strcmp(argv[i], "-n") == 0) {
+			if (i >= argc - 1)
+				return 1;
+			i++;
+			nio = atoi(argv[i]);
+			if (nio <= 0) {
+				fprintf(stderr, "Invalid number of I/O\n");
+				return 1;
+			}
+		} else {
+			fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (i != argc - 2) {
+		fprintf(stderr, "Usage: %s [-p <num>] [-n <nio>] <lba> <num lba>\n",
+			argv[0]);
+		return 1;
+	}
+
+	lba = atoll(argv[i]);
+	lba_count = (uint32_t)atoi(argv[i + 1]);
+
+	sector = zbc_lba2sect(info, lba);
+	start_sect = sector;
+	sector_count = zbc_lba2sect(info, lba_count);
+
+	bufsize = lba_count * info->zbd_lblock_size;
+	ret = posix_memalign(&iobuf, info->zbd_lblock_size, bufsize);
+	if (ret != 0) {
+		fprintf(stderr,
+			"[TEST][ERROR],No memory for I/O buffer (%zu B)\n",
+			bufsize);
+		return 1;
+	}
+
+	if (!read)
+		memset(iobuf, pattern, bufsize);
+
+	while (nio) {
+
+		if (read)
+			ret = zbc_pread(dev, iobuf, sector_count, sector);
+		else
+			ret = zbc_pwrite(dev, iobuf, sector_count, sector);
+		if (ret <= 0) {
+			fprintf(stderr,
+				"[TEST][ERROR],zbc_%s_zone failed %zd,"
+				" sector=%llu, sector_count=%u\n",
+				read ? "read" : "write",
+				ret, sector, sector_count);
+			zbc_test_print_sense(dev);
+			ret = 1;
+			goto out;
+		}
+
+		if (read && ptrn_set) {
+			for (i = 0, b = iobuf; i < (ret << 9); i++, b++) {
+				if (*b != (unsigned char)pattern) {
+					unsigned long long err_sect =
+						start_sect + (i >> 9);
+					fprintf(stderr,
+						"[TEST][ERROR],Data mismatch @ sector %llu: read %#x, exp %#x\n",
+						err_sect, *b, pattern);
+					ret = 1;
+					goto out;
+				}
+			}
+		}
+
+		nio--;
+		sector += sector_count;
+		ret = 0;
+
+	}
+
+out:
+	free(iobuf);
+
+	return ret;
+}
+
+/**
+ * Test case operations.
+ */
+static struct zbc_test_batch_op {
+	char		*name;
+	int		(*exec)(struct zbc_device *, struct zbc_device_info *,
+				int, char **);
+} zbc_test_batch_ops[] = {
+	{ "print_devinfo",	zbc_test_batch_devinfo		},
+	{ "report_zones",	zbc_test_batch_report_zones	},
+	{ "reset_zone",		zbc_test_batch_zone_op		},
+	{ "open_zone",		zbc_test_batch_zone_op		},
+	{ "close_zone",		zbc_test_batch_zone_op		},
+	{ "finish_zone",	zbc_test_batch_zone_op		},
+	{ "read_zone",		zbc_test_batch_rw_zone		},
+	{ "write_zone",		zbc_test_batch_rw_zone		},
+	{ NULL,			NULL				}
+};
+
+/**
+ * Split a test case line into words. Returns the number of words,
+ * or -1 if the line has too many of them.
+ */
+static int zbc_test_batch_split(char *line, char **words)
+{
+	int n = 0;
+	char *w;
+
+	w = strtok(line, " \t\n");
+	while (w) {
+		if (n >= ZBC_TEST_BATCH_MAX_ARGS)
+			return -1;
+		words[n++] = w;
+		w = strtok(NULL, " \t\n");
+	}
+
+	return n;
+}
+
+int main(int argc, char **argv)
+{
+	struct zbc_device_info info;
+	struct zbc_device *dev;
+	struct zbc_test_batch_op *op;
+	char line[ZBC_TEST_BATCH_MAX_LINE];
+	char *words[ZBC_TEST_BATCH_MAX_ARGS];
+	unsigned int oflags, nr_cases = 0, nr_failed = 0;
+	int n, ret;
+	char *path;
+
+	/* Check command line */
+	if (argc < 2 || argc > 3) {
+		printf("Usage: %s [-v] <dev>\n"
+		       "  Execute test cases read from the standard input,\n"
+		       "  one case per line, on a single open device:\n"
+		       "    <operation> [options] [arguments]\n"
+		       "  Operations are print_devinfo, report_zones,\n"
+		       "  reset_zone, open_zone, close_zone, finish_zone,\n"
+		       "  read_zone and write_zone, taking the options and\n"
+		       "  arguments of the standalone test programs, without\n"
+		       "  the device path. Empty lines and lines starting\n"
+		       "  with \"#\" are ignored. The result of each case is\n"
+		       "  reported as \"[TEST][CASE],<num>,<operation>,<ret>\"\n"
+		       "Options:\n"
+		       "  -v : Verbose mode\n",
+		       argv[0]);
+		return 1;
+	}
+
+	if (argc == 3) {
+		if (strcmp(argv[1], "-v") == 0) {
+			zbc_set_log_level("debug");
+		} else {
+			printf("Unknown option \"%s\"\n", argv[1]);
+			return 1;
+		}
+		path = argv[2];
+	} else {
+		path = argv[1];
+	}
+
+	/* Open device */
+	oflags = ZBC_O_DEVTEST;
+	oflags |= ZBC_O_DRV_ATA | ZBC_O_DRV_FAKE;
+	if (!getenv("ZBC_TEST_FORCE_ATA"))
+		oflags |= ZBC_O_DRV_SCSI;
+
+	ret = zbc_open(path, oflags | O_RDWR, &dev);
+	if (ret != 0) {
+		fprintf(stderr, "[TEST][ERROR],open device failed %d\n",
+			ret);
+		printf("[TEST][ERROR][SENSE_KEY],open-device-failed\n");
+		printf("[TEST][ERROR][ASC_ASCQ],open-device-failed\n");
+		return 1;
+	}
+
+	zbc_get_device_info(dev, &info);
+
+	/* Execute the test cases */
+	while (fgets(line, sizeof(line), stdin)) {
+
+		n = zbc_test_batch_split(line, words);
+		if (n < 0) {
+			fprintf(stderr,
+				"[TEST][ERROR],case %u: too many words\n",
+				nr_cases + 1);
+			nr_cases++;
+			nr_failed++;
+			continue;
+		}
+
+		/* Skip empty lines and comments */
+		if (n == 0 || words[0][0] == '#')
+			continue;
+
+		nr_cases++;
+
+		for (op = zbc_test_batch_ops; op->name; op++) {
+			if (strcmp(words[0], op->name) == 0)
+				break;
+		}
+		if (!op->name) {
+			fprintf(stderr,
+				"[TEST][ERROR],case %u: unknown operation \"%s\"\n",
+				nr_cases, words[0]);
+			nr_failed++;
+			continue;
+		}
+
+		ret = op->exec(dev, &info, n, words);
+		if (ret != 0)
+			nr_failed++;
+
+		printf("[TEST][CASE],%u,%s,%d\n", nr_cases, words[0], ret);
+
+	}
+
+	printf("[TEST][BATCH],%u,%u\n", nr_cases, nr_failed);
+
+	/* Close device file */
+	zbc_close(dev);
+
+	return nr_failed ? 1 : 0;
+}
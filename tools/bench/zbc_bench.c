@@ -0,0 +1,634 @@
+/*
+ * This file is part of libzbc.
+ *
+ * Copyright (C) 2016, Western Digital. All rights reserved.
+ *
+ * This software is distributed under the terms of the
+ * GNU Lesser General Public License version 3, "as is," without technical
+ * support, and WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. You should have
+ * received a copy of the GNU Lesser General Public License along with libzbc.
+ * If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE     /* O_LARGEFILE & O_DIRECT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include <libzbc/zbc.h>
+
+/**
+ * Benchmark workloads.
+ */
+enum zbc_bench_workload {
+	ZBC_BENCH_WRITE = 0,	/* Sequential zone fill		*/
+	ZBC_BENCH_READ,		/* Sequential zone read		*/
+	ZBC_BENCH_RESET,	/* Zone reset storm		*/
+	ZBC_BENCH_REPORT,	/* Report zones sweep		*/
+};
+
+/**
+ * Maximum number of recorded latency samples.
+ */
+#define ZBC_BENCH_MAX_SAMPLES	(1024 * 1024)
+
+/**
+ * Default number of report zones sweeps.
+ */
+#define ZBC_BENCH_NR_REPORTS	100
+
+/**
+ * Benchmark abort.
+ */
+static int zbc_bench_abort = 0;
+
+/**
+ * Operation results.
+ */
+static unsigned long long *zbc_bench_lat;
+static unsigned long long zbc_bench_nr_samples;
+static unsigned long long zbc_bench_nr_ops;
+static unsigned long long zbc_bench_bytes;
+
+/**
+ * System time in usecs.
+ */
+static inline unsigned long long zbc_bench_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (unsigned long long) ts.tv_sec * 1000000LL +
+		(unsigned long long) ts.tv_nsec / 1000;
+}
+
+/**
+ * Signal handler.
+ */
+static void zbc_bench_sigcatcher(int sig)
+{
+	zbc_bench_abort = 1;
+}
+
+/**
+ * Account for one operation.
+ */
+static void zbc_bench_account(unsigned long long lat,
+			      unsigned long long bytes)
+{
+	if (zbc_bench_nr_samples < ZBC_BENCH_MAX_SAMPLES)
+		zbc_bench_lat[zbc_bench_nr_samples++] = lat;
+	zbc_bench_nr_ops++;
+	zbc_bench_bytes += bytes;
+}
+
+/**
+ * Compare two latency samples (qsort callback).
+ */
+static int zbc_bench_lat_cmp(const void *a, const void *b)
+{
+	unsigned long long la = *(const unsigned long long *)a;
+	unsigned long long lb = *(const unsigned long long *)b;
+
+	if (la < lb)
+		return -1;
+	if (la > lb)
+		return 1;
+
+	return 0;
+}
+
+/**
+ * Get a latency percentile (per mil) from the sorted samples.
+ */
+static unsigned long long zbc_bench_pctl(unsigned long long permil)
+{
+	unsigned long long idx;
+
+	idx = (zbc_bench_nr_samples * permil) / 1000;
+	if (idx >= zbc_bench_nr_samples)
+		idx = zbc_bench_nr_samples - 1;
+
+	return zbc_bench_lat[idx];
+}
+
+/**
+ * Print the workload results.
+ */
+static void zbc_bench_report_results(const char *name,
+				     unsigned long long elapsed)
+{
+	unsigned long long avg = 0, brate;
+	unsigned long long i;
+
+	printf("%s: %llu operations in %llu.%03llu sec\n",
+	       name,
+	       zbc_bench_nr_ops,
+	       elapsed / 1000000,
+	       (elapsed % 1000000) / 1000);
+
+	if (!zbc_bench_nr_ops || !elapsed)
+		return;
+
+	printf("  IOPS %llu\n",
+	       zbc_bench_nr_ops * 1000000 / elapsed);
+
+	if (zbc_bench_bytes) {
+		brate = zbc_bench_bytes * 1000000 / elapsed;
+		printf("  BW %llu.%03llu MB/s\n",
+		       brate / 1000000,
+		       (brate % 1000000) / 1000);
+	}
+
+	if (!zbc_bench_nr_samples)
+		return;
+
+	qsort(zbc_bench_lat, zbc_bench_nr_samples,
+	      sizeof(unsigned long long), zbc_bench_lat_cmp);
+
+	for (i = 0; i < zbc_bench_nr_samples; i++)
+		avg += zbc_bench_lat[i];
+	avg /= zbc_bench_nr_samples;
+
+	printf("  Latency (usec): min %llu, avg %llu, max %llu\n",
+	       zbc_bench_lat[0],
+	       avg,
+	       zbc_bench_lat[zbc_bench_nr_samples - 1]);
+	printf("  Latency percentiles (usec): "
+	       "p50 %llu, p99 %llu, p999 %llu\n",
+	       zbc_bench_pctl(500),
+	       zbc_bench_pctl(990),
+	       zbc_bench_pctl(999));
+
+	if (zbc_bench_nr_ops > zbc_bench_nr_samples)
+		printf("  (percentiles over the first %llu operations)\n",
+		       zbc_bench_nr_samples);
+}
+
+/**
+ * Sequential zone fill workload.
+ */
+static int zbc_bench_write(struct zbc_device *dev, struct zbc_zone *zones,
+			   unsigned int nr_zones, void *iobuf, size_t iosize,
+			   unsigned long long ionum)
+{
+	struct zbc_zone *zone;
+	unsigned long long start;
+	long long sector_ofst, sector_end, sector_count;
+	unsigned int i;
+	ssize_t ret;
+
+	for (i = 0; i < nr_zones && !zbc_bench_abort; i++) {
+
+		zone = &zones[i];
+		if (!zbc_zone_sequential_req(zone))
+			continue;
+
+		/* Start the fill from an empty zone */
+		ret = zbc_zone_operation(dev, zbc_zone_start(zone),
+					 ZBC_OP_RESET_ZONE, 0);
+		if (ret != 0) {
+			fprintf(stderr, "zbc_reset_zone failed %zd (%s)\n",
+				-ret, strerror(-ret));
+			return ret;
+		}
+
+		sector_ofst = zbc_zone_start(zone);
+		sector_end = zbc_zone_start(zone) + zbc_zone_length(zone);
+
+		while (sector_ofst < sector_end && !zbc_bench_abort) {
+
+			sector_count = iosize >> 9;
+			if (sector_ofst + sector_count > sector_end)
+				sector_count = sector_end - sector_ofst;
+
+			start = zbc_bench_usec();
+			ret = zbc_pwrite(dev, iobuf, sector_count,
+					 sector_ofst);
+			if (ret <= 0) {
+				fprintf(stderr,
+					"zbc_pwrite failed %zd (%s)\n",
+					-ret, strerror(-ret));
+				return ret;
+			}
+			zbc_bench_account(zbc_bench_usec() - start,
+					  (unsigned long long)ret << 9);
+
+			sector_ofst += ret;
+
+			if (ionum && zbc_bench_nr_ops >= ionum)
+				return 0;
+		}
+
+	}
+
+	return 0;
+}
+
+/**
+ * Sequential zone read workload.
+ */
+static int zbc_bench_read(struct zbc_device *dev, struct zbc_zone *zones,
+			  unsigned int nr_zones, void *iobuf, size_t iosize,
+			  unsigned long long ionum)
+{
+	struct zbc_zone *zone;
+	unsigned long long start;
+	long long sector_ofst, sector_end, sector_count;
+	unsigned int i;
+	ssize_t ret;
+
+	for (i = 0; i < nr_zones && !zbc_bench_abort; i++) {
+
+		zone = &zones[i];
+
+		sector_ofst = zbc_zone_start(zone);
+		if (zbc_zone_sequential_req(zone) && !zbc_zone_full(zone))
+			sector_end = zbc_zone_wp(zone);
+		else
+			sector_end = zbc_zone_start(zone) +
+				zbc_zone_length(zone);
+
+		while (sector_ofst < sector_end && !zbc_bench_abort) {
+
+			sector_count = iosize >> 9;
+			if (sector_ofst + sector_count > sector_end)
+				sector_count = sector_end - sector_ofst;
+
+			start = zbc_bench_usec();
+			ret = zbc_pread(dev, iobuf, sector_count,
+					sector_ofst);
+			if (ret <= 0) {
+				fprintf(stderr,
+					"zbc_pread failed %zd (%s)\n",
+					-ret, strerror(-ret));
+				return ret;
+			}
+			zbc_bench_account(zbc_bench_usec() - start,
+					  (unsigned long long)ret << 9);
+
+			sector_ofst += ret;
+
+			if (ionum && zbc_bench_nr_ops >= ionum)
+				return 0;
+		}
+
+	}
+
+	return 0;
+}
+
+/**
+ * Zone reset storm workload.
+ */
+static int zbc_bench_reset(struct zbc_device *dev, struct zbc_zone *zones,
+			   unsigned int nr_zones, unsigned long long ionum)
+{
+	struct zbc_zone *zone;
+	unsigned long long start;
+	unsigned int i;
+	int ret;
+
+	while (!zbc_bench_abort) {
+
+		for (i = 0; i < nr_zones && !zbc_bench_abort; i++) {
+
+			zone = &zones[i];
+			if (!zbc_zone_sequential_req(zone))
+				continue;
+
+			start = zbc_bench_usec();
+			ret = zbc_zone_operation(dev, zbc_zone_start(zone),
+						 ZBC_OP_RESET_ZONE, 0);
+			if (ret != 0) {
+				fprintf(stderr,
+					"zbc_reset_zone failed %d (%s)\n",
+					-ret, strerror(-ret));
+				return ret;
+			}
+			zbc_bench_account(zbc_bench_usec() - start, 0);
+
+			if (ionum && zbc_bench_nr_ops >= ionum)
+				return 0;
+		}
+
+		if (!ionum)
+			/* A single pass over the target zones */
+			break;
+
+	}
+
+	return 0;
+}
+
+/**
+ * Report zones sweep workload.
+ */
+static int zbc_bench_report(struct zbc_device *dev, unsigned long long ionum)
+{
+	struct zbc_zone *zones;
+	unsigned long long start;
+	unsigned int nr_zones;
+	int ret;
+
+	ret = zbc_report_nr_zones(dev, 0, ZBC_RO_ALL, &nr_zones);
+	if (ret != 0) {
+		fprintf(stderr, "zbc_report_nr_zones failed %d (%s)\n",
+			-ret, strerror(-ret));
+		return ret;
+	}
+
+	zones = calloc(nr_zones, sizeof(struct zbc_zone));
+	if (!zones) {
+		fprintf(stderr, "No memory for zone array\n");
+		return -ENOMEM;
+	}
+
+	if (!ionum)
+		ionum = ZBC_BENCH_NR_REPORTS;
+
+	while (zbc_bench_nr_ops < ionum && !zbc_bench_abort) {
+
+		start = zbc_bench_usec();
+		ret = zbc_report_zones(dev, 0, ZBC_RO_ALL,
+				       zones, &nr_zones);
+		if (ret != 0) {
+			fprintf(stderr, "zbc_report_zones failed %d (%s)\n",
+				-ret, strerror(-ret));
+			break;
+		}
+		zbc_bench_account(zbc_bench_usec() - start, 0);
+
+	}
+
+	free(zones);
+
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	struct zbc_device_info info;
+	struct zbc_device *dev = NULL;
+	struct zbc_zone *zones = NULL;
+	unsigned long long elapsed, ionum = 0;
+	unsigned int nr_zones = 0, nz = 0;
+	enum zbc_bench_workload workload;
+	size_t iosize = 1024 * 1024;
+	void *iobuf = NULL;
+	const char *wname;
+	char *path;
+	int zstart = 0;
+	int i, flags = 0, ret;
+
+	/* Check command line */
+	if (argc < 3) {
+usage:
+		printf("Usage: %s [options] <dev> <workload>\n"
+		       "  Measure the throughput and latency of libzbc\n"
+		       "  operations on a device\n"
+		       "Workloads:\n"
+		       "    write  : Sequentially fill zones (resets the\n"
+		       "             target zones first: DESTROYS DATA)\n"
+		       "    read   : Sequentially read zones up to their\n"
+		       "             write pointer\n"
+		       "    reset  : Reset the target zones one at a time\n"
+		       "             (DESTROYS DATA)\n"
+		       "    report : Repeatedly report all zones\n"
+		       "Options:\n"
+		       "    -v         : Verbose mode\n"
+		       "    -dio       : Use direct I/Os\n"
+		       "    -s <size>  : I/O size in bytes for the read and\n"
+		       "                 write workloads (default: 1 MiB)\n"
+		       "    -z <num>   : Index of the first target zone\n"
+		       "                 (default: 0)\n"
+		       "    -n <num>   : Number of target zones\n"
+		       "                 (default: all zones)\n"
+		       "    -nio <num> : Limit the number of operations\n"
+		       "                 (default for report: %d)\n"
+		       "    -scsi      : Force the SCSI backend driver\n"
+		       "    -ata       : Force the ATA backend driver\n"
+		       "    -block     : Force the block backend driver\n",
+		       argv[0], ZBC_BENCH_NR_REPORTS);
+		return 1;
+	}
+
+	/* Parse options */
+	for (i = 1; i < (argc - 2); i++) {
+
+		if (strcmp(argv[i], "-v") == 0) {
+
+			zbc_set_log_level("debug");
+
+		} else if (strcmp(argv[i], "-dio") == 0) {
+
+			flags |= O_DIRECT;
+
+		} else if (strcmp(argv[i], "-s") == 0) {
+
+			if (i >= (argc - 2))
+				goto usage;
+			i++;
+
+			iosize = atol(argv[i]);
+			if (!iosize) {
+				fprintf(stderr, "Invalid I/O size\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-z") == 0) {
+
+			if (i >= (argc - 2))
+				goto usage;
+			i++;
+
+			zstart = atoi(argv[i]);
+			if (zstart < 0) {
+				fprintf(stderr, "Invalid zone index\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-n") == 0) {
+
+			if (i >= (argc - 2))
+				goto usage;
+			i++;
+
+			nz = atoi(argv[i]);
+			if (!nz) {
+				fprintf(stderr, "Invalid number of zones\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-nio") == 0) {
+
+			if (i >= (argc - 2))
+				goto usage;
+			i++;
+
+			ionum = atoll(argv[i]);
+
+		} else if (strcmp(argv[i], "-scsi") == 0) {
+
+			flags |= ZBC_O_DRV_SCSI;
+
+		} else if (strcmp(argv[i], "-ata") == 0) {
+
+			flags |= ZBC_O_DRV_ATA;
+
+		} else if (strcmp(argv[i], "-block") == 0) {
+
+			flags |= ZBC_O_DRV_BLOCK;
+
+		} else {
+
+			fprintf(stderr, "Unknown option \"%s\"\n", argv[i]);
+			goto usage;
+
+		}
+
+	}
+
+	if (i != (argc - 2))
+		goto usage;
+
+	/* Get parameters */
+	path = argv[i];
+	wname = argv[i + 1];
+
+	if (strcmp(wname, "write") == 0) {
+		workload = ZBC_BENCH_WRITE;
+		flags |= O_RDWR;
+	} else if (strcmp(wname, "read") == 0) {
+		workload = ZBC_BENCH_READ;
+		flags |= O_RDONLY;
+	} else if (strcmp(wname, "reset") == 0) {
+		workload = ZBC_BENCH_RESET;
+		flags |= O_RDWR;
+	} else if (strcmp(wname, "report") == 0) {
+		workload = ZBC_BENCH_REPORT;
+		flags |= O_RDONLY;
+	} else {
+		fprintf(stderr, "Unknown workload \"%s\"\n", wname);
+		goto usage;
+	}
+
+	if (iosize % 512) {
+		fprintf(stderr,
+			"Invalid I/O size %zu (must be a multiple of 512 B)\n",
+			iosize);
+		return 1;
+	}
+
+	/* Setup signal handler */
+	signal(SIGQUIT, zbc_bench_sigcatcher);
+	signal(SIGINT, zbc_bench_sigcatcher);
+	signal(SIGTERM, zbc_bench_sigcatcher);
+
+	/* Open device */
+	ret = zbc_open(path, flags, &dev);
+	if (ret != 0) {
+		if (ret == -ENODEV)
+			fprintf(stderr,
+				"Open %s failed (not a zoned block device)\n",
+				path);
+		else
+			fprintf(stderr, "Open %s failed (%s)\n",
+				path, strerror(-ret));
+		return 1;
+	}
+
+	zbc_get_device_info(dev, &info);
+
+	printf("Device %s:\n", path);
+	zbc_print_device_info(&info, stdout);
+
+	zbc_bench_lat = calloc(ZBC_BENCH_MAX_SAMPLES,
+			       sizeof(unsigned long long));
+	if (!zbc_bench_lat) {
+		fprintf(stderr, "No memory for latency samples\n");
+		ret = 1;
+		goto out;
+	}
+
+	if (workload != ZBC_BENCH_REPORT) {
+
+		/* Get the target zones */
+		ret = zbc_list_zones(dev, 0, ZBC_RO_ALL, &zones, &nr_zones);
+		if (ret != 0) {
+			fprintf(stderr, "zbc_list_zones failed\n");
+			ret = 1;
+			goto out;
+		}
+
+		if ((unsigned int)zstart >= nr_zones) {
+			fprintf(stderr, "Target zone not found\n");
+			ret = 1;
+			goto out;
+		}
+		if (!nz || zstart + nz > nr_zones)
+			nz = nr_zones - zstart;
+
+	}
+
+	if (workload == ZBC_BENCH_WRITE || workload == ZBC_BENCH_READ) {
+		ret = posix_memalign(&iobuf, sysconf(_SC_PAGESIZE), iosize);
+		if (ret != 0) {
+			fprintf(stderr, "No memory for I/O buffer (%zu B)\n",
+				iosize);
+			ret = 1;
+			goto out;
+		}
+		memset(iobuf, 0, iosize);
+	}
+
+	printf("Running %s workload on %u zone(s) from zone %d, "
+	       "%zu B I/Os\n",
+	       wname,
+	       workload == ZBC_BENCH_REPORT ? nr_zones : nz,
+	       zstart, iosize);
+
+	elapsed = zbc_bench_usec();
+
+	switch (workload) {
+	case ZBC_BENCH_WRITE:
+		ret = zbc_bench_write(dev, &zones[zstart], nz,
+				      iobuf, iosize, ionum);
+		break;
+	case ZBC_BENCH_READ:
+		ret = zbc_bench_read(dev, &zones[zstart], nz,
+				     iobuf, iosize, ionum);
+		break;
+	case ZBC_BENCH_RESET:
+		ret = zbc_bench_reset(dev, &zones[zstart], nz, ionum);
+		break;
+	case ZBC_BENCH_REPORT:
+	default:
+		ret = zbc_bench_report(dev, ionum);
+		break;
+	}
+
+	elapsed = zbc_bench_usec() - elapsed;
+
+	zbc_bench_report_results(wname, elapsed);
+
+	if (ret != 0)
+		ret = 1;
+
+out:
+	free(zbc_bench_lat);
+	free(iobuf);
+	free(zones);
+
+	zbc_close(dev);
+
+	return ret;
+}
@@ -174,7 +174,8 @@ int main(int argc, char **argv)
  */
 static int dz_report_zones(dz_dev_t *dzd)
 {
-	unsigned int i, j = 0;
+	unsigned int i, j = 0, istart, zact, nr_zones;
+	uint64_t from = 0;
 	int ret;
 
 	if (!dzd->zones || !dzd->max_nr_zones) {
@@ -197,41 +198,103 @@ static int dz_report_zones(dz_dev_t *dzd)
 		for (i = 0; i < dzd->max_nr_zones; i++) {
 			dzd->zones[i].no = i;
 			dzd->zones[i].visible = 1;
+			dzd->zones[i].changed = 1;
 			memcpy(&dzd->zones[i].info,
 			       &dzd->zbc_zones[i],
 			       sizeof(struct zbc_zone));
 		}
 
+		dzd->zact_no = 0;
+		dzd->nr_zone_changes = dzd->max_nr_zones;
+		dzd->nr_visible_changes = dzd->max_nr_zones;
+
 		return 0;
 
 	}
 
-	/* Refresh zone list */
-	dzd->nr_zones = dzd->max_nr_zones;
+	/*
+	 * Refresh zone list: when listing all zones, most refreshes only
+	 * fetch zones at or after the start of the last known activity
+	 * region, that is, the first zone that was open, closed or had
+	 * changed on the previous refresh. New activity below that region
+	 * (e.g. a reset issued by another user of the device) is picked up
+	 * by the periodic full refresh and by the full refresh forced after
+	 * every zone operation.
+	 */
+	if (dzd->zone_ro == ZBC_RO_ALL && !dzd->refresh_all &&
+	    (dzd->refresh_count % DZ_FULL_REFRESH_PERIOD) &&
+	    dzd->zact_no < dzd->max_nr_zones) {
+		istart = dzd->zact_no;
+		from = zbc_zone_start(&dzd->zones[istart].info);
+	} else {
+		istart = 0;
+	}
+	dzd->refresh_count++;
+	dzd->refresh_all = 0;
+
+	nr_zones = dzd->max_nr_zones - istart;
 	ret = zbc_report_zones(dzd->dev,
-			       0, dzd->zone_ro,
-			       dzd->zbc_zones, &dzd->nr_zones);
+			       from, dzd->zone_ro,
+			       dzd->zbc_zones, &nr_zones);
 	if (ret != 0) {
 		fprintf(stderr, "Get zone information failed %d (%s)\n",
 			errno,
 			strerror(errno));
-		dzd->nr_zones = 0;
+		nr_zones = 0;
 	}
 
-	/* Apply filter */
-	for (i = 0; i < dzd->max_nr_zones; i++) {
-		if (j < dzd->nr_zones &&
-		    zbc_zone_start(&dzd->zones[i].info) ==
+	/*
+	 * Keep the device zone count when the refresh only re-reported
+	 * the zones of the activity region: nr_zones is used as the
+	 * total by the zone operation and zone list range code.
+	 */
+	if (!istart)
+		dzd->nr_zones = nr_zones;
+
+	/*
+	 * Apply filter, diffing the result against the cached zone
+	 * information so that only changed zones are marked for
+	 * rendering.
+	 */
+	zact = dzd->max_nr_zones;
+	for (i = istart; i < dzd->max_nr_zones; i++) {
+		dz_dev_zone_t *zone = &dzd->zones[i];
+		int visible = 0;
+
+		if (j < nr_zones &&
+		    zbc_zone_start(&zone->info) ==
 		    zbc_zone_start(&dzd->zbc_zones[j])) {
-			memcpy(&dzd->zones[i].info,
-			       &dzd->zbc_zones[j],
-			       sizeof(struct zbc_zone));
-			dzd->zones[i].visible = 1;
+			if (memcmp(&zone->info, &dzd->zbc_zones[j],
+				   sizeof(struct zbc_zone)) != 0) {
+				memcpy(&zone->info, &dzd->zbc_zones[j],
+				       sizeof(struct zbc_zone));
+				if (!zone->changed) {
+					zone->changed = 1;
+					dzd->nr_zone_changes++;
+				}
+			}
+			visible = 1;
 			j++;
-		} else {
-			dzd->zones[i].visible = 0;
 		}
+
+		if (zone->visible != visible) {
+			zone->visible = visible;
+			dzd->nr_visible_changes++;
+			if (!zone->changed) {
+				zone->changed = 1;
+				dzd->nr_zone_changes++;
+			}
+		}
+
+		/* Track the start of the activity region */
+		if (zact == dzd->max_nr_zones &&
+		    (zone->changed ||
+		     zbc_zone_imp_open(&zone->info) ||
+		     zbc_zone_exp_open(&zone->info) ||
+		     zbc_zone_closed(&zone->info)))
+			zact = i;
 	}
+	dzd->zact_no = zact;
 
 	return ret;
 }
@@ -246,6 +309,9 @@ static int dz_zone_operation(dz_dev_t *dzd)
 	uint64_t sector = 0;
 	int ret;
 
+	/* The operation may change any zone: force a full refresh */
+	dzd->refresh_all = 1;
+
 	if (zno < 0) {
 		flags = ZBC_OP_ALL_ZONES;
 	} else {
@@ -28,6 +28,13 @@
  */
 #define DZ_INTERVAL     1000
 
+/**
+ * Number of refreshes between two full zone reports: in between,
+ * refreshes only fetch zones at or after the last known activity
+ * region.
+ */
+#define DZ_FULL_REFRESH_PERIOD	16
+
 /**
  * Zone information list columns.
  */
@@ -64,6 +71,7 @@ typedef struct dz_dev_zone {
 
 	int			no;
 	int			visible;
+	int			changed;
 	struct zbc_zone		info;
 
 } dz_dev_zone_t;
@@ -89,6 +97,18 @@ typedef struct dz_dev {
 	struct zbc_zone		*zbc_zones;
 	dz_dev_zone_t		*zones;
 
+	/**
+	 * Incremental refresh control: force the next refresh to report
+	 * all zones, refresh counter, first zone of the last known
+	 * activity region, and counters of changes accumulated since the
+	 * zone list was last rendered.
+	 */
+	int			refresh_all;
+	unsigned int		refresh_count;
+	unsigned int		zact_no;
+	unsigned int		nr_zone_changes;
+	unsigned int		nr_visible_changes;
+
 	/**
 	 * Command execution.
 	 */
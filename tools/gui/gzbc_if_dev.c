@@ -77,7 +77,7 @@ static void dz_if_zlist_set_use_hexa_cb(GtkToggleButton *togglebutton,
 					gpointer user_data);
 static gboolean dz_if_zlist_entry_visible(GtkTreeModel *model,
 					  GtkTreeIter *iter, gpointer data);
-static void dz_if_zlist_fill(dz_dev_t *dzd);
+static void dz_if_zlist_fill(dz_dev_t *dzd, gboolean force);
 static gboolean dz_if_zlist_refresh_cb(GtkWidget *widget, gpointer user_data);
 static void dz_if_zlist_scroll_cb(GtkWidget *widget, gpointer user_data);
 static gboolean dz_if_zlist_select_cb(GtkTreeSelection *selection,
@@ -411,7 +411,7 @@ dz_dev_t *dz_if_dev_open(char *path)
 	gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
 
 	/* Fill the model with zone data */
-	dz_if_zlist_fill(dzd);
+	dz_if_zlist_fill(dzd, TRUE);
 
 	/* Zone state drawing frame */
 	frame = gtk_frame_new("<b>Zone Write State</b>");
@@ -866,7 +866,7 @@ static gboolean dz_if_zlist_entry_visible(GtkTreeModel *model,
 	return dzd->zones[i].visible ? TRUE : FALSE;
 }
 
-static void dz_if_zlist_fill(dz_dev_t *dzd)
+static void dz_if_zlist_fill(dz_dev_t *dzd, gboolean force)
 {
 	GtkTreeModel *model = GTK_TREE_MODEL(dzd->zlist_store);
 	GtkTreeIter iter;
@@ -876,6 +876,13 @@ static void dz_if_zlist_fill(dz_dev_t *dzd)
 	gtk_tree_model_get_iter_first(model, &iter);
 
 	for (i = 0; i < dzd->max_nr_zones; i++) {
+
+		/* Only render rows of zones that changed */
+		if (!force && !dzd->zones[i].changed) {
+			gtk_tree_model_iter_next(model, &iter);
+			continue;
+		}
+
 		z = &dzd->zones[i].info;
 		gtk_list_store_set(dzd->zlist_store, &iter,
 				   DZ_ZONE_NUM, dzd->zones[i].no,
@@ -888,11 +895,17 @@ static void dz_if_zlist_fill(dz_dev_t *dzd)
 				   DZ_ZONE_WP, dz_if_sect2block(dzd, zbc_zone_wp(z)),
 				   DZ_ZONE_VISIBLE, dzd->zones[i].visible,
 				   -1);
+		dzd->zones[i].changed = 0;
 		gtk_tree_model_iter_next(model, &iter);
 
 	}
 
-	gtk_tree_model_filter_refilter(GTK_TREE_MODEL_FILTER(dzd->zlist_model));
+	/* Refiltering is only needed if zone visibility changed */
+	if (force || dzd->nr_visible_changes)
+		gtk_tree_model_filter_refilter(GTK_TREE_MODEL_FILTER(dzd->zlist_model));
+
+	dzd->nr_zone_changes = 0;
+	dzd->nr_visible_changes = 0;
 }
 
 static void dz_if_zlist_update_range(dz_dev_t *dzd)
@@ -1106,6 +1119,7 @@ static void dz_if_zblock_set_cb(GtkEntry *entry, gpointer user_data)
 
 static void dz_if_refresh_zlist(dz_dev_t *dzd)
 {
+	unsigned int nr_changes = dzd->nr_zone_changes;
 	char str[256];
 
 	/* Update number of zones */
@@ -1115,11 +1129,12 @@ static void dz_if_refresh_zlist(dz_dev_t *dzd)
 	gtk_label_set_text(GTK_LABEL(dzd->zlist_frame_label), str);
 	gtk_label_set_use_markup(GTK_LABEL(dzd->zlist_frame_label), TRUE);
 
-	/* Update list store and refilter the view */
-	dz_if_zlist_fill(dzd);
+	/* Update the rows of changed zones and refilter the view */
+	dz_if_zlist_fill(dzd, FALSE);
 
-	/* Redraw visible zone range */
-	dz_if_redraw_zones(dzd);
+	/* Redraw visible zone range if anything changed */
+	if (nr_changes)
+		dz_if_redraw_zones(dzd);
 }
 
 static void dz_if_update_zones(dz_dev_t *dzd)
@@ -1175,6 +1190,7 @@ static gboolean dz_if_zlist_filter_cb(GtkComboBox *button, gpointer user_data)
 		dzd->zone_ro = zone_ro;
 		dzd->zlist_start_no = 0;
 		dzd->zlist_end_no = 0;
+		dzd->refresh_all = 1;
 		dz_if_update_zones(dzd);
 		dz_if_zlist_clear_selection(dzd);
 		dz_if_zlist_set_view_range(dzd, 0);
@@ -1204,7 +1220,7 @@ static void dz_if_zlist_set_block_size_cb(GtkEntry *entry, gpointer user_data)
 	gtk_entry_set_text(entry, str);
 
 	/* Update list */
-	dz_if_zlist_fill(dzd);
+	dz_if_zlist_fill(dzd, TRUE);
 	dz_if_zblock_set(dzd);
 }
 
@@ -1219,14 +1235,17 @@ static void dz_if_zlist_set_use_hexa_cb(GtkToggleButton *togglebutton,
 
 	/* Update list */
 	dzd->use_hexa = use_hexa;
-	dz_if_zlist_fill(dzd);
+	dz_if_zlist_fill(dzd, TRUE);
 	dz_if_zblock_set(dzd);
 }
 
 static gboolean dz_if_zlist_refresh_cb(GtkWidget *widget, gpointer user_data)
 {
+	dz_dev_t *dzd = (dz_dev_t *) user_data;
 
-	dz_if_update_zones((dz_dev_t *) user_data);
+	/* A manual refresh reports all zones */
+	dzd->refresh_all = 1;
+	dz_if_update_zones(dzd);
 
 	return FALSE;
 }
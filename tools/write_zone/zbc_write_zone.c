@@ -24,6 +24,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <sys/time.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -57,6 +58,340 @@ static void zbc_write_zone_sigcatcher(int sig)
 	zbc_write_zone_abort = 1;
 }
 
+/**
+ * Aggregated I/O counts of the multi-zone queue depth mode, updated
+ * by the workers and read by the main thread for interval reports.
+ */
+static unsigned long long zbc_write_zone_bcount;
+static unsigned long long zbc_write_zone_iocount;
+static int zbc_write_zone_workers_active;
+
+/**
+ * Worker state of the multi-zone queue depth mode.
+ */
+struct zbc_write_zone_worker {
+	pthread_t		thread;
+	struct zbc_device	*dev;
+	struct zbc_zone		*zone;
+	size_t			iosize;
+	int			iodepth;
+	unsigned long		pattern;
+	unsigned long long	ionum;
+	int			ret;
+};
+
+/**
+ * Account a completed write.
+ */
+static void zbc_write_zone_account(ssize_t sectors)
+{
+	__atomic_fetch_add(&zbc_write_zone_bcount,
+			   (unsigned long long)sectors << 9,
+			   __ATOMIC_RELAXED);
+	__atomic_fetch_add(&zbc_write_zone_iocount, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Write one zone, keeping up to the worker I/O depth of asynchronous
+ * writes in flight. Sequential write required zones are always written
+ * at depth 1, from the zone write pointer: queued writes may be
+ * reordered by the device and fail the write pointer alignment check.
+ * Synchronous writes are used if the backend does not support
+ * asynchronous requests.
+ */
+static void *zbc_write_zone_worker_run(void *arg)
+{
+	struct zbc_write_zone_worker *w = arg;
+	struct zbc_zone *zone = w->zone;
+	struct zbc_aio *aios = NULL, *aio;
+	struct iovec *iovs = NULL;
+	int *free_slots = NULL;
+	void *iobuf = NULL;
+	unsigned long long iocount = 0;
+	unsigned long long zone_ofst = 0, sector_max;
+	size_t sector_count;
+	int iodepth = w->iodepth, inflight = 0, nr_free, slot;
+	ssize_t ret;
+
+	w->ret = 0;
+
+	if (zbc_zone_sequential_req(zone)) {
+		if (zbc_zone_full(zone))
+			goto out;
+		zone_ofst = zbc_zone_wp(zone) - zbc_zone_start(zone);
+		iodepth = 1;
+	}
+	sector_max = zbc_zone_length(zone);
+
+	ret = posix_memalign(&iobuf, sysconf(_SC_PAGESIZE),
+			     w->iosize * iodepth);
+	if (ret != 0) {
+		fprintf(stderr, "No memory for I/O buffer (%zu B)\n",
+			w->iosize * iodepth);
+		w->ret = 1;
+		goto out;
+	}
+	memset(iobuf, w->pattern, w->iosize * iodepth);
+
+	if (iodepth > 1) {
+		aios = calloc(iodepth, sizeof(struct zbc_aio));
+		iovs = calloc(iodepth, sizeof(struct iovec));
+		free_slots = calloc(iodepth, sizeof(int));
+		if (!aios || !iovs || !free_slots) {
+			fprintf(stderr, "No memory for I/O requests\n");
+			w->ret = 1;
+			goto out;
+		}
+		for (slot = 0; slot < iodepth; slot++)
+			free_slots[slot] = slot;
+	}
+	nr_free = iodepth;
+
+sync:
+	if (iodepth == 1) {
+
+		/* Synchronous writes */
+		while (!zbc_write_zone_abort && !w->ret) {
+
+			sector_count = w->iosize >> 9;
+			if (zone_ofst + sector_count > sector_max)
+				sector_count = sector_max - zone_ofst;
+			if (!sector_count ||
+			    (w->ionum && iocount >= w->ionum))
+				break;
+
+			ret = zbc_pwrite(w->dev, iobuf, sector_count,
+					 zbc_zone_start(zone) + zone_ofst);
+			if (ret <= 0) {
+				fprintf(stderr, "zbc_pwrite failed %zd (%s)\n",
+					-ret, strerror(-ret));
+				w->ret = 1;
+				break;
+			}
+
+			zone_ofst += ret;
+			iocount++;
+			zbc_write_zone_account(ret);
+		}
+
+		goto out;
+	}
+
+	/* Asynchronous writes */
+	while (!w->ret) {
+
+		while (nr_free && !zbc_write_zone_abort) {
+
+			sector_count = w->iosize >> 9;
+			if (zone_ofst + sector_count > sector_max)
+				sector_count = sector_max - zone_ofst;
+			if (!sector_count ||
+			    (w->ionum && iocount >= w->ionum))
+				break;
+
+			slot = free_slots[nr_free - 1];
+			iovs[slot].iov_base = iobuf + slot * w->iosize;
+			iovs[slot].iov_len = sector_count;
+
+			aio = &aios[slot];
+			memset(aio, 0, sizeof(struct zbc_aio));
+			aio->aio_op = ZBC_AIO_PWRITE;
+			aio->aio_sector = zbc_zone_start(zone) + zone_ofst;
+			aio->aio_iov = &iovs[slot];
+			aio->aio_iovcnt = 1;
+
+			ret = zbc_aio_submit(w->dev, aio);
+			if (ret != 0) {
+				if ((ret == -ENXIO || ret == -ENOTSUP) &&
+				    !inflight && !iocount) {
+					/* No async support: go synchronous */
+					iodepth = 1;
+					goto sync;
+				}
+				fprintf(stderr,
+					"zbc_aio_submit failed %zd (%s)\n",
+					-ret, strerror(-ret));
+				w->ret = 1;
+				break;
+			}
+
+			nr_free--;
+			inflight++;
+			zone_ofst += sector_count;
+			iocount++;
+		}
+
+		if (!inflight)
+			break;
+
+		ret = zbc_aio_wait(w->dev, &aio);
+		if (ret != 0) {
+			fprintf(stderr, "zbc_aio_wait failed %zd (%s)\n",
+				-ret, strerror(-ret));
+			w->ret = 1;
+			break;
+		}
+
+		inflight--;
+		free_slots[nr_free++] = aio - aios;
+
+		if (aio->aio_result <= 0) {
+			fprintf(stderr, "Write at %llu failed %zd (%s)\n",
+				(unsigned long long)aio->aio_sector,
+				-aio->aio_result,
+				strerror(-aio->aio_result));
+			w->ret = 1;
+		} else {
+			zbc_write_zone_account(aio->aio_result);
+		}
+	}
+
+	/* Drain in-flight writes */
+	while (inflight) {
+		if (zbc_aio_wait(w->dev, &aio) != 0)
+			break;
+		inflight--;
+		if (aio->aio_result > 0)
+			zbc_write_zone_account(aio->aio_result);
+	}
+
+out:
+	free(iobuf);
+	free(aios);
+	free(iovs);
+	free(free_slots);
+
+	__atomic_fetch_sub(&zbc_write_zone_workers_active, 1,
+			   __ATOMIC_RELAXED);
+
+	return NULL;
+}
+
+/**
+ * Fan writes across consecutive zones with a pool of worker threads,
+ * reporting the aggregated throughput every second.
+ */
+static int zbc_write_zone_multi(char *path, int oflags,
+				struct zbc_zone *zones, int zidx,
+				int nr_threads, int iodepth, size_t iosize,
+				unsigned long pattern,
+				unsigned long long ionum)
+{
+	struct zbc_write_zone_worker *workers;
+	unsigned long long start, interval_start, now, elapsed;
+	unsigned long long bcount, iocount, last_bcount = 0, brate;
+	int i, nr_devs, ret = 0;
+
+	workers = calloc(nr_threads, sizeof(struct zbc_write_zone_worker));
+	if (!workers) {
+		fprintf(stderr, "No memory for workers\n");
+		return 1;
+	}
+
+	/*
+	 * A device handle must not be shared between threads issuing
+	 * asynchronous requests: waiting reaps any completion queued on
+	 * the handle. Open a separate handle for each worker.
+	 */
+	for (nr_devs = 0; nr_devs < nr_threads; nr_devs++) {
+		ret = zbc_open(path, oflags, &workers[nr_devs].dev);
+		if (ret != 0) {
+			fprintf(stderr, "Open %s failed (%s)\n",
+				path, strerror(-ret));
+			while (nr_devs--)
+				zbc_close(workers[nr_devs].dev);
+			free(workers);
+			return 1;
+		}
+	}
+
+	printf("Writing zones %d to %d with %d worker(s), "
+	       "I/O depth %d, %zu B I/Os\n",
+	       zidx, zidx + nr_threads - 1, nr_threads, iodepth, iosize);
+
+	__atomic_store_n(&zbc_write_zone_workers_active, nr_threads,
+			 __ATOMIC_RELAXED);
+
+	start = zbc_write_zone_usec();
+	interval_start = start;
+
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].zone = &zones[zidx + i];
+		workers[i].iosize = iosize;
+		workers[i].iodepth = iodepth;
+		workers[i].pattern = pattern;
+		workers[i].ionum = ionum;
+		ret = pthread_create(&workers[i].thread, NULL,
+				     zbc_write_zone_worker_run, &workers[i]);
+		if (ret != 0) {
+			fprintf(stderr, "pthread_create failed %d\n", ret);
+			zbc_write_zone_abort = 1;
+			__atomic_fetch_sub(&zbc_write_zone_workers_active,
+					   nr_threads - i, __ATOMIC_RELAXED);
+			nr_threads = i;
+			ret = 1;
+			break;
+		}
+	}
+
+	/* Report the aggregated throughput every second */
+	while (__atomic_load_n(&zbc_write_zone_workers_active,
+			       __ATOMIC_RELAXED)) {
+
+		sleep(1);
+
+		bcount = __atomic_load_n(&zbc_write_zone_bcount,
+					 __ATOMIC_RELAXED);
+		now = zbc_write_zone_usec();
+		elapsed = now - interval_start;
+		if (!elapsed)
+			continue;
+
+		brate = (bcount - last_bcount) * 1000000 / elapsed;
+		printf("  %llu.%03llu s: %llu.%03llu MB/s\n",
+		       (now - start) / 1000000,
+		       ((now - start) % 1000000) / 1000,
+		       brate / 1000000,
+		       (brate % 1000000) / 1000);
+
+		last_bcount = bcount;
+		interval_start = now;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		if (workers[i].ret != 0)
+			ret = 1;
+	}
+
+	for (i = 0; i < nr_devs; i++)
+		zbc_close(workers[i].dev);
+
+	elapsed = zbc_write_zone_usec() - start;
+	bcount = zbc_write_zone_bcount;
+	iocount = zbc_write_zone_iocount;
+
+	if (elapsed) {
+		printf("Wrote %llu B (%llu I/Os) in %llu.%03llu sec\n",
+		       bcount, iocount,
+		       elapsed / 1000000,
+		       (elapsed % 1000000) / 1000);
+		printf("  IOPS %llu\n",
+		       iocount * 1000000 / elapsed);
+		brate = bcount * 1000000 / elapsed;
+		printf("  BW %llu.%03llu MB/s\n",
+		       brate / 1000000,
+		       (brate % 1000000) / 1000);
+	} else {
+		printf("Wrote %llu B (%llu I/Os)\n",
+		       bcount, iocount);
+	}
+
+	free(workers);
+
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	struct zbc_device_info info;
@@ -83,6 +418,7 @@ int main(int argc, char **argv)
 	int flags = O_WRONLY;
 	struct iovec *iov = NULL;
 	int iovcnt = 1, n;
+	int nr_threads = 1, iodepth = 1;
 
 	/* Check command line */
 	if (argc < 4) {
@@ -101,6 +437,13 @@ usage:
 		       "    -p <num>   : Set the byte pattern to write. If this option\n"
 		       "                 is omitted, write data buffer is zeroed out\n"
 		       "    -nio <num> : Limit the number of I/O executed to <num>\n"
+		       "                 (per worker in multi-zone mode)\n"
+		       "    -threads <num> : Write <num> consecutive zones starting\n"
+		       "                 at <zone no> with <num> worker threads,\n"
+		       "                 reporting throughput every second\n"
+		       "    -iodepth <num> : Number of writes to keep in flight per\n"
+		       "                 worker (conventional zones only, sequential\n"
+		       "                 zones are written at depth 1)\n"
 		       "    -f <file>  : Write the content of <file>\n"
 		       "    -loop      : If a file is specified, repeatedly write the\n"
 		       "                 file to the zone until the zone is full\n"
@@ -170,6 +513,30 @@ usage:
 				return 1;
 			}
 
+		} else if (strcmp(argv[i], "-threads") == 0) {
+
+			if (i >= (argc - 1))
+				goto usage;
+			i++;
+
+			nr_threads = atoi(argv[i]);
+			if (nr_threads <= 0) {
+				fprintf(stderr, "Invalid number of threads\n");
+				return 1;
+			}
+
+		} else if (strcmp(argv[i], "-iodepth") == 0) {
+
+			if (i >= (argc - 1))
+				goto usage;
+			i++;
+
+			iodepth = atoi(argv[i]);
+			if (iodepth <= 0) {
+				fprintf(stderr, "Invalid I/O depth\n");
+				return 1;
+			}
+
 		} else if (strcmp(argv[i], "-f") == 0) {
 
 			if (i >= (argc - 1))
@@ -301,6 +668,37 @@ usage:
 		goto out;
 	}
 
+	/* Multi-zone queue depth mode */
+	if (nr_threads > 1 || iodepth > 1) {
+
+		if (file || vio || zone_ofst) {
+			fprintf(stderr,
+				"-threads/-iodepth cannot be used with "
+				"-f, -vio or -ofst\n");
+			ret = 1;
+			goto out;
+		}
+		if (zidx + nr_threads > (int)nr_zones) {
+			fprintf(stderr, "Not enough zones for %d workers\n",
+				nr_threads);
+			ret = 1;
+			goto out;
+		}
+
+		ret = zbc_write_zone_multi(path, flags, zones, zidx, nr_threads,
+					   iodepth, bufsize, pattern, ionum);
+
+		if (flush) {
+			printf("Flushing device...\n");
+			if (zbc_flush(dev) != 0) {
+				fprintf(stderr, "zbc_flush failed\n");
+				ret = 1;
+			}
+		}
+
+		goto out;
+	}
+
 	if (vio) {
 		iov = calloc(iovcnt, sizeof(struct iovec));
 		if (!iov) {
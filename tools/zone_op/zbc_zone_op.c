@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include <libzbc/zbc.h>
 #include "zbc_zone_op.h"
@@ -38,6 +40,147 @@ static const char *zbc_zone_op_name(enum zbc_zone_op op)
 	}
 }
 
+/**
+ * Progress accounting shared by all workers.
+ */
+static unsigned int zbc_zone_op_done;
+static unsigned int zbc_zone_op_errors;
+static unsigned int zbc_zone_op_workers_active;
+
+/**
+ * Worker executing zone operations on a partition of the target range.
+ */
+struct zbc_zone_op_worker {
+	pthread_t		thread;
+	struct zbc_device	*dev;
+	enum zbc_zone_op	op;
+	struct zbc_zone		*zones;
+	unsigned int		nr_zones;
+	int			ret;
+};
+
+static void *zbc_zone_op_worker_run(void *data)
+{
+	struct zbc_zone_op_worker *worker = data;
+	struct zbc_zone *zone;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < worker->nr_zones; i++) {
+
+		zone = &worker->zones[i];
+
+		/* Zone operations only apply to sequential zones */
+		if (zbc_zone_sequential(zone)) {
+			ret = zbc_zone_operation(worker->dev,
+						 zbc_zone_start(zone),
+						 worker->op, 0);
+			if (ret != 0) {
+				/* Report the first error of this worker */
+				if (!worker->ret)
+					fprintf(stderr,
+						"zbc_%s_zone sector %llu failed %d (%s)\n",
+						zbc_zone_op_name(worker->op),
+						(unsigned long long)zbc_zone_start(zone),
+						-ret, strerror(-ret));
+				worker->ret = ret;
+				__atomic_fetch_add(&zbc_zone_op_errors, 1,
+						   __ATOMIC_RELAXED);
+			}
+		}
+
+		__atomic_fetch_add(&zbc_zone_op_done, 1, __ATOMIC_RELAXED);
+
+	}
+
+	__atomic_fetch_sub(&zbc_zone_op_workers_active, 1, __ATOMIC_RELAXED);
+
+	return NULL;
+}
+
+/**
+ * Execute a zone operation on a range of zones, partitioning the range
+ * across a pool of worker threads, each with its own command in flight.
+ */
+static int zbc_zone_op_parallel(struct zbc_device *dev, enum zbc_zone_op op,
+				struct zbc_zone *zones, unsigned int nr_zones,
+				unsigned int nr_threads)
+{
+	struct zbc_zone_op_worker *workers;
+	unsigned int per_worker, zno = 0, done, errors;
+	unsigned int n, nr_workers = 0;
+	int ret = 0;
+
+	if (nr_threads > nr_zones)
+		nr_threads = nr_zones;
+
+	workers = calloc(nr_threads, sizeof(struct zbc_zone_op_worker));
+	if (!workers) {
+		fprintf(stderr, "No memory\n");
+		return -ENOMEM;
+	}
+
+	zbc_zone_op_done = 0;
+	zbc_zone_op_errors = 0;
+	zbc_zone_op_workers_active = nr_threads;
+
+	/* Start the workers, partitioning the zone range across them */
+	per_worker = (nr_zones + nr_threads - 1) / nr_threads;
+	for (n = 0; n < nr_threads; n++) {
+
+		workers[n].dev = dev;
+		workers[n].op = op;
+		workers[n].zones = &zones[zno];
+		workers[n].nr_zones = per_worker;
+		if (workers[n].nr_zones > nr_zones - zno)
+			workers[n].nr_zones = nr_zones - zno;
+		zno += workers[n].nr_zones;
+
+		ret = pthread_create(&workers[n].thread, NULL,
+				     zbc_zone_op_worker_run, &workers[n]);
+		if (ret != 0) {
+			fprintf(stderr, "Create worker thread failed %d (%s)\n",
+				ret, strerror(ret));
+			__atomic_fetch_sub(&zbc_zone_op_workers_active,
+					   nr_threads - n, __ATOMIC_RELAXED);
+			ret = -ret;
+			break;
+		}
+
+		nr_workers++;
+
+	}
+
+	/* Report aggregated progress until all workers are done */
+	while (__atomic_load_n(&zbc_zone_op_workers_active,
+			       __ATOMIC_RELAXED)) {
+		sleep(1);
+		done = __atomic_load_n(&zbc_zone_op_done, __ATOMIC_RELAXED);
+		errors = __atomic_load_n(&zbc_zone_op_errors,
+					 __ATOMIC_RELAXED);
+		printf("\r%s: %u / %u zones (%u %%), %u errors",
+		       zbc_zone_op_name(op), done, nr_zones,
+		       nr_zones ? done * 100 / nr_zones : 0, errors);
+		fflush(stdout);
+	}
+
+	for (n = 0; n < nr_workers; n++) {
+		pthread_join(workers[n].thread, NULL);
+		if (workers[n].ret != 0 && ret == 0)
+			ret = workers[n].ret;
+	}
+
+	done = zbc_zone_op_done;
+	errors = zbc_zone_op_errors;
+	printf("\r%s: %u / %u zones (%u %%), %u errors\n",
+	       zbc_zone_op_name(op), done, nr_zones,
+	       nr_zones ? done * 100 / nr_zones : 0, errors);
+
+	free(workers);
+
+	return ret;
+}
+
 int zbc_zone_op(char *bin_name, enum zbc_zone_op op,
 		int argc, char **argv)
 {
@@ -48,7 +191,8 @@ int zbc_zone_op(char *bin_name, enum zbc_zone_op op,
 	unsigned long long start_sector = -1ULL;
 	unsigned int flags = 0;
 	int i, ret = 1;
-	unsigned int nr_zones, tgt_idx;
+	unsigned int nr_zones, tgt_idx = 0;
+	unsigned int nr_threads = 1, nr_op_zones = 1;
 	bool sector_unit = false;
 	bool lba_unit = false;
 	char *path;
@@ -67,7 +211,12 @@ usage:
 		       "  -v      : Verbose mode\n"
 		       "  -sector : Interpret <zone> as a zone start sector\n"
 		       "  -lba    : Interpret <zone> as a zone start LBA\n"
-		       "  -all    : Operate on all sequential zones\n",
+		       "  -all    : Operate on all sequential zones\n"
+		       "  -n <nz> : Operate on the <nz> zones starting from\n"
+		       "            the target zone (default: 1)\n"
+		       "  -p <N>  : Execute operations in parallel using N\n"
+		       "            threads, partitioning the target zones\n"
+		       "            among them (default: 1)\n",
 		       bin_name);
 		return 1;
 	}
@@ -91,6 +240,30 @@ usage:
 
 			flags |= ZBC_OP_ALL_ZONES;
 
+		} else if (strcmp(argv[i], "-n") == 0) {
+
+			if (i >= (argc - 2))
+				goto usage;
+			i++;
+
+			if (atoi(argv[i]) <= 0) {
+				fprintf(stderr, "Invalid number of zones\n");
+				return 1;
+			}
+			nr_op_zones = atoi(argv[i]);
+
+		} else if (strcmp(argv[i], "-p") == 0) {
+
+			if (i >= (argc - 2))
+				goto usage;
+			i++;
+
+			if (atoi(argv[i]) <= 0) {
+				fprintf(stderr, "Invalid number of threads\n");
+				return 1;
+			}
+			nr_threads = atoi(argv[i]);
+
 		} else if ( argv[i][0] == '-' ) {
 
 			printf("Unknown option \"%s\"\n",
@@ -214,21 +387,47 @@ usage:
 
 	}
 
-	switch (op) {
-	case ZBC_OP_RESET_ZONE:
-	case ZBC_OP_OPEN_ZONE:
-	case ZBC_OP_CLOSE_ZONE:
-	case ZBC_OP_FINISH_ZONE:
-		ret = zbc_zone_operation(dev, start_sector, op, flags);
-		if (ret != 0) {
-			fprintf(stderr, "zbc_%s_zone failed\n",
-				zbc_zone_op_name(op));
-			ret = 1;
-		}
-		break;
-	default:
+	if (!zbc_zone_op_name(op)) {
 		printf("Unknown operation\n");
 		ret = 1;
+		goto out;
+	}
+
+	/*
+	 * Worker pool mode: execute per-zone operations on the target
+	 * zone range, partitioned across the worker threads.
+	 */
+	if (nr_threads > 1 || (nr_op_zones > 1 && !(flags & ZBC_OP_ALL_ZONES))) {
+
+		if (flags & ZBC_OP_ALL_ZONES) {
+			/* Get zone list */
+			ret = zbc_list_zones(dev, 0, ZBC_RO_ALL,
+					     &zones, &nr_zones);
+			if (ret != 0) {
+				fprintf(stderr, "zbc_list_zones failed\n");
+				ret = 1;
+				goto out;
+			}
+			tgt_idx = 0;
+			nr_op_zones = nr_zones;
+		} else if (tgt_idx + nr_op_zones > nr_zones) {
+			nr_op_zones = nr_zones - tgt_idx;
+		}
+
+		ret = zbc_zone_op_parallel(dev, op, &zones[tgt_idx],
+					   nr_op_zones, nr_threads);
+		if (ret != 0)
+			ret = 1;
+
+		goto out;
+
+	}
+
+	ret = zbc_zone_operation(dev, start_sector, op, flags);
+	if (ret != 0) {
+		fprintf(stderr, "zbc_%s_zone failed\n",
+			zbc_zone_op_name(op));
+		ret = 1;
 	}
 
 out: